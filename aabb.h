@@ -0,0 +1,93 @@
+#pragma once
+#include "vec3.h"
+#include "ray.h"
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+
+//------------------------------------------------------------------------------
+/**
+    Axis aligned bounding box. Default constructed boxes are empty and can be
+    grown to fit points or other boxes.
+*/
+struct AABB
+{
+    vec3 min = { FLT_MAX, FLT_MAX, FLT_MAX };
+    vec3 max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+    void Grow(vec3 const& p)
+    {
+        min.x = std::min(min.x, p.x); min.y = std::min(min.y, p.y); min.z = std::min(min.z, p.z);
+        max.x = std::max(max.x, p.x); max.y = std::max(max.y, p.y); max.z = std::max(max.z, p.z);
+    }
+
+    void Grow(AABB const& b)
+    {
+        min.x = std::min(min.x, b.min.x); min.y = std::min(min.y, b.min.y); min.z = std::min(min.z, b.min.z);
+        max.x = std::max(max.x, b.max.x); max.y = std::max(max.y, b.max.y); max.z = std::max(max.z, b.max.z);
+    }
+
+    bool IsEmpty() const
+    {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    // true for the bounds of unbounded objects like planes, which can't go in a BVH
+    bool IsInfinite() const
+    {
+        return std::isinf(min.x) || std::isinf(min.y) || std::isinf(min.z) || std::isinf(max.x) || std::isinf(max.y) || std::isinf(max.z);
+    }
+
+    vec3 Centroid() const
+    {
+        return { (min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f, (min.z + max.z) * 0.5f };
+    }
+
+    // half of the surface area, which is all the SAH needs since it only compares ratios
+    float HalfArea() const
+    {
+        if (IsEmpty())
+            return 0.0f;
+
+        float dx = max.x - min.x;
+        float dy = max.y - min.y;
+        float dz = max.z - min.z;
+        return dx * dy + dy * dz + dz * dx;
+    }
+};
+
+//------------------------------------------------------------------------------
+/**
+    Ray with the reciprocal direction precomputed, used by the slab tests
+*/
+struct RayInv
+{
+    RayInv(Ray const& ray) :
+        ox(ray.b.x), oy(ray.b.y), oz(ray.b.z),
+        ix(1.0f / ray.m.x), iy(1.0f / ray.m.y), iz(1.0f / ray.m.z)
+    {
+    }
+
+    float ox, oy, oz;
+    float ix, iy, iz;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Slab test against a box given as min/max arrays.
+    Returns the entry distance, or FLT_MAX if the box is missed or further away than tMax.
+*/
+inline float
+IntersectAABB(RayInv const& ray, float const bmin[3], float const bmax[3], float tMax)
+{
+    float tx1 = (bmin[0] - ray.ox) * ray.ix, tx2 = (bmax[0] - ray.ox) * ray.ix;
+    float tmin = std::min(tx1, tx2), tmax = std::max(tx1, tx2);
+    float ty1 = (bmin[1] - ray.oy) * ray.iy, ty2 = (bmax[1] - ray.oy) * ray.iy;
+    tmin = std::max(tmin, std::min(ty1, ty2)), tmax = std::min(tmax, std::max(ty1, ty2));
+    float tz1 = (bmin[2] - ray.oz) * ray.iz, tz2 = (bmax[2] - ray.oz) * ray.iz;
+    tmin = std::max(tmin, std::min(tz1, tz2)), tmax = std::min(tmax, std::max(tz1, tz2));
+
+    if (tmax >= tmin && tmin < tMax && tmax > 0)
+        return tmin;
+    return FLT_MAX;
+}
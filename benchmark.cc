@@ -0,0 +1,1127 @@
+#include "benchmark.h"
+#include <chrono>
+#include <iostream>
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include "raytracer.h"
+#include "scene.h"
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#endif
+
+// the linear accelerator is skipped above this many spheres, it would take forever
+static constexpr int MaxLinearSpheres = 20000;
+
+//------------------------------------------------------------------------------
+/**
+    Hardware events the benchmarks can count. The generic perf events only
+    name the first and the last level of the cache, the levels in between
+    differ between CPUs.
+*/
+enum class PerfEvent
+{
+    // misses in the last level cache, loads and stores
+    CacheMisses,
+    L1DataLoads,
+    L1DataLoadMisses,
+    LastLevelLoads,
+    LastLevelLoadMisses,
+};
+
+//------------------------------------------------------------------------------
+/**
+    Counts one hardware event on the calling thread with a performance
+    counter. Only on Linux, and only if the kernel allows it, otherwise
+    Available() is false and Stop() returns 0.
+*/
+class PerfCounter
+{
+public:
+    explicit PerfCounter(PerfEvent event)
+    {
+#if defined(__linux__)
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        uint64_t const readOp = uint64_t(PERF_COUNT_HW_CACHE_OP_READ) << 8;
+        uint64_t const access = uint64_t(PERF_COUNT_HW_CACHE_RESULT_ACCESS) << 16;
+        uint64_t const miss = uint64_t(PERF_COUNT_HW_CACHE_RESULT_MISS) << 16;
+        switch (event)
+        {
+        case PerfEvent::CacheMisses:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        case PerfEvent::L1DataLoads: attr.config = PERF_COUNT_HW_CACHE_L1D | readOp | access; break;
+        case PerfEvent::L1DataLoadMisses: attr.config = PERF_COUNT_HW_CACHE_L1D | readOp | miss; break;
+        case PerfEvent::LastLevelLoads: attr.config = PERF_COUNT_HW_CACHE_LL | readOp | access; break;
+        case PerfEvent::LastLevelLoadMisses: attr.config = PERF_COUNT_HW_CACHE_LL | readOp | miss; break;
+        }
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        this->fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+        (void)event;
+#endif
+    }
+
+    ~PerfCounter()
+    {
+#if defined(__linux__)
+        if (this->fd >= 0)
+            close(this->fd);
+#endif
+    }
+
+    PerfCounter(PerfCounter const&) = delete;
+    PerfCounter& operator=(PerfCounter const&) = delete;
+
+    bool Available() const { return this->fd >= 0; }
+
+    void Start()
+    {
+#if defined(__linux__)
+        if (this->fd < 0)
+            return;
+        ioctl(this->fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(this->fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+
+    uint64_t Stop()
+    {
+        uint64_t count = 0;
+#if defined(__linux__)
+        if (this->fd < 0)
+            return 0;
+        ioctl(this->fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(this->fd, &count, sizeof(count)) != sizeof(count))
+            count = 0;
+#endif
+        return count;
+    }
+
+private:
+    int fd = -1;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Camera rays through the center of every pixel, same camera as RenderOneFrame
+*/
+static std::vector<Ray>
+PrimaryRays(Raytracer& rt, unsigned w, unsigned h)
+{
+    mat4 cameraTransform = multiply(rotationy(0), rotationx(0));
+    cameraTransform.m30 = 0.0f;
+    cameraTransform.m31 = 1.0f;
+    cameraTransform.m32 = 10.0f;
+    rt.SetViewMatrix(cameraTransform);
+
+    std::vector<Ray> rays;
+    rays.reserve(size_t(w) * h);
+    for (unsigned y = 0; y < h; ++y)
+    {
+        for (unsigned x = 0; x < w; ++x)
+        {
+            float u = (((x + 0.5f) * (1.0f / w)) * 2.0f) - 1.0f;
+            float v = (((y + 0.5f) * (1.0f / h)) * 2.0f) - 1.0f;
+            vec3 direction = transform(vec3(u, v, -1.0f), rt.frustum);
+            rays.push_back(Ray(get_position(rt.view), direction));
+        }
+    }
+    return rays;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Scatter every primary ray that hits something once, gives incoherent rays
+*/
+static std::vector<Ray>
+SecondaryRays(Raytracer& rt, std::vector<Ray> const& primaryRays)
+{
+    std::vector<Ray> rays;
+    for (unsigned i = 0; i < primaryRays.size(); i++)
+    {
+        Ray const& ray = primaryRays[i];
+        RandomStream rng(i, 0, 0);
+        vec3 hitPoint;
+        vec3 hitNormal;
+        Object* hitObject = nullptr;
+        float distance = FLT_MAX;
+        if (rt.Raycast(ray, hitPoint, hitNormal, hitObject, distance))
+            rays.push_back(BSDF(rt.GetMaterial(hitObject->GetMaterial()), ray, hitPoint, hitNormal, rng));
+    }
+    return rays;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+struct TraceResult
+{
+    double seconds = 0;
+    TraversalStats stats;
+    // distance to the closest hit for every ray, used to check that all structures agree
+    std::vector<float> distances;
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+static TraceResult
+TraceRays(Raytracer& rt, std::vector<Ray> const& rays)
+{
+    TraceResult result;
+    result.distances.resize(rays.size());
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        vec3 hitPoint;
+        vec3 hitNormal;
+        Object* hitObject = nullptr;
+        float distance = FLT_MAX;
+        rt.Raycast(rays[i], hitPoint, hitNormal, hitObject, distance, &result.stats);
+        result.distances[i] = distance;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    return result;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static size_t
+CountMismatches(std::vector<float> const& a, std::vector<float> const& b)
+{
+    size_t mismatches = 0;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (a[i] != b[i])
+            mismatches++;
+    }
+    return mismatches;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BenchmarkAccelerators(unsigned w, unsigned h, int spheresAmount)
+{
+    std::vector<Color> framebuffer(size_t(w) * h);
+    Raytracer rt = Raytracer(w, h, framebuffer, 1, 1);
+    CreateRandomSphereScene(rt, spheresAmount);
+
+    rt.accelerator = Accelerator::BVH;
+    rt.BuildAccelerationStructure();
+    std::vector<Ray> primaryRays = PrimaryRays(rt, w, h);
+    std::vector<Ray> secondaryRays = SecondaryRays(rt, primaryRays);
+
+    std::cout << "Accelerator benchmark, " << spheresAmount << " spheres, "
+              << primaryRays.size() << " primary and " << secondaryRays.size() << " secondary rays\n";
+    printf(" %-8s %10s %10s %9s | %9s %9s %9s | %9s %9s %9s | %s\n",
+           "", "build ms", "nodes", "node MB", "prim MR/s", "nodes/ray", "tests/ray", "sec MR/s", "nodes/ray", "tests/ray", "mismatches");
+
+    TraceResult referencePrimary;
+    TraceResult referenceSecondary;
+    bool haveReference = false;
+
+    for (Accelerator accelerator : { Accelerator::Linear, Accelerator::BVH, Accelerator::BVH4, Accelerator::BVH8, Accelerator::BVH4Q, Accelerator::Grid, Accelerator::Grid2 })
+    {
+        if (accelerator == Accelerator::Linear && spheresAmount > MaxLinearSpheres)
+            continue;
+
+        rt.accelerator = accelerator;
+        auto buildStart = std::chrono::high_resolution_clock::now();
+        rt.BuildAccelerationStructure();
+        auto buildEnd = std::chrono::high_resolution_clock::now();
+        double buildMs = std::chrono::duration<double, std::milli>(buildEnd - buildStart).count();
+
+        TraceResult primary = TraceRays(rt, primaryRays);
+        TraceResult secondary = TraceRays(rt, secondaryRays);
+
+        if (!haveReference)
+        {
+            referencePrimary = primary;
+            referenceSecondary = secondary;
+            haveReference = true;
+        }
+        size_t mismatches = CountMismatches(primary.distances, referencePrimary.distances)
+                          + CountMismatches(secondary.distances, referenceSecondary.distances);
+
+        double numPrimary = double(primaryRays.size());
+        double numSecondary = double(std::max<size_t>(secondaryRays.size(), 1));
+        printf(" %-8s %10.2f %10zu %9.2f | %9.3f %9.2f %9.2f | %9.3f %9.2f %9.2f | %zu\n",
+               AcceleratorName(accelerator), buildMs, rt.NodeCount(), rt.NodeBytes() / (1024.0 * 1024.0),
+               numPrimary / primary.seconds / 1'000'000.0, primary.stats.nodeVisits / numPrimary, primary.stats.primitiveTests / numPrimary,
+               numSecondary / secondary.seconds / 1'000'000.0, secondary.stats.nodeVisits / numSecondary, secondary.stats.primitiveTests / numSecondary,
+               mismatches);
+    }
+
+    // a faster build only pays off if the rays traced before the next rebuild don't lose it again
+    std::cout << "\nBVH builders, build on all threads, trace on one\n";
+    printf(" %-10s %10s %9s | %9s %9s | %9s %9s | %14s | %s\n",
+           "", "build ms", "SAH cost", "prim MR/s", "nodes/ray", "sec MR/s", "nodes/ray", "build+trace ms", "mismatches");
+    rt.accelerator = Accelerator::BVH;
+    for (BVHBuilder builder : { BVHBuilder::SweepSAH, BVHBuilder::BinnedSAH, BVHBuilder::Linear })
+    {
+        rt.bvhBuilder = builder;
+        auto buildStart = std::chrono::high_resolution_clock::now();
+        rt.BuildAccelerationStructure();
+        auto buildEnd = std::chrono::high_resolution_clock::now();
+        double buildMs = std::chrono::duration<double, std::milli>(buildEnd - buildStart).count();
+
+        TraceResult primary = TraceRays(rt, primaryRays);
+        TraceResult secondary = TraceRays(rt, secondaryRays);
+        size_t mismatches = CountMismatches(primary.distances, referencePrimary.distances)
+                          + CountMismatches(secondary.distances, referenceSecondary.distances);
+
+        double numPrimary = double(primaryRays.size());
+        double numSecondary = double(std::max<size_t>(secondaryRays.size(), 1));
+        printf(" %-10s %10.2f %9.2f | %9.3f %9.2f | %9.3f %9.2f | %14.2f | %zu\n",
+               BVHBuilderName(builder), buildMs, rt.GetBVH().SAHCost(),
+               numPrimary / primary.seconds / 1'000'000.0, primary.stats.nodeVisits / numPrimary,
+               numSecondary / secondary.seconds / 1'000'000.0, secondary.stats.nodeVisits / numSecondary,
+               buildMs + (primary.seconds + secondary.seconds) * 1000.0, mismatches);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BenchmarkFrameLatency(unsigned w, unsigned h, int raysPerPixel, int maxBounces, int spheresAmount, unsigned NumberOfJobs, int frames)
+{
+    std::vector<Color> framebuffer(size_t(w) * h);
+    Raytracer rt = Raytracer(w, h, framebuffer, raysPerPixel, maxBounces);
+    CreateRandomSphereScene(rt, spheresAmount);
+
+    mat4 cameraTransform = multiply(rotationy(0), rotationx(0));
+    cameraTransform.m30 = 0.0f;
+    cameraTransform.m31 = 1.0f;
+    cameraTransform.m32 = 10.0f;
+    rt.SetViewMatrix(cameraTransform);
+    rt.BuildAccelerationStructure();
+
+    // warm up, the first frame also pays for page faults in the framebuffer
+    rt.RaytraceMultithreaded(NumberOfJobs);
+
+    std::vector<double> frameMs;
+    frameMs.reserve(std::max(frames, 1));
+    for (int i = 0; i < frames; i++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        rt.RaytraceMultithreaded(NumberOfJobs);
+        auto end = std::chrono::high_resolution_clock::now();
+        frameMs.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    if (frameMs.empty())
+        return;
+
+    std::sort(frameMs.begin(), frameMs.end());
+    auto percentile = [&frameMs](double p)
+    {
+        size_t index = size_t(p * (frameMs.size() - 1) + 0.5);
+        return frameMs[index];
+    };
+
+    std::cout << "Frame latency, " << frames << " frames at " << w << "x" << h << ", "
+              << raysPerPixel << " rpp, " << spheresAmount << " spheres\n";
+    printf(" %9s %9s %9s %9s %9s\n", "min ms", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    printf(" %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+           frameMs.front(), percentile(0.5), percentile(0.9), percentile(0.99), frameMs.back());
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BenchmarkFrameBufferLayout(unsigned w, unsigned h)
+{
+    constexpr int Passes = 5;
+
+    std::vector<Color> framebuffer(size_t(w) * h);
+    Raytracer rt = Raytracer(w, h, framebuffer, 1, 1);
+    rt.BuildAccelerationStructure();
+
+    std::cout << "Framebuffer layout benchmark, " << w << "x" << h << ", empty scene, 1 rpp, best of " << Passes << " passes\n";
+    printf(" %-14s %10s %10s\n", "", "ms", "ns/pixel");
+
+    auto run = [&](char const* name, std::function<void()> const& pass)
+    {
+        double best = 1e30;
+        for (int i = 0; i < Passes; i++)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            pass();
+            auto end = std::chrono::high_resolution_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+        }
+        printf(" %-14s %10.2f %10.2f\n", name, best, best * 1'000'000.0 / (double(w) * h));
+    };
+
+    // the order Raytrace used to walk the image in, every write strides a whole row
+    rt.tiledFrameBuffer = false;
+    run("column major", [&rt, w, h]()
+    {
+        for (unsigned x = 0; x < w; ++x)
+            for (unsigned y = 0; y < h; ++y)
+                rt.RaytracePixel(x, y);
+    });
+    run("row major", [&rt]() { rt.Raytrace(); });
+
+    rt.tiledFrameBuffer = true;
+    run("tiled", [&rt]() { rt.Raytrace(); });
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BenchmarkWavefront(unsigned w, unsigned h, int raysPerPixel, int spheresAmount)
+{
+    std::vector<Color> framebuffer(size_t(w) * h);
+    Raytracer rt = Raytracer(w, h, framebuffer, raysPerPixel, 1);
+    CreateRandomSphereScene(rt, spheresAmount);
+
+    mat4 cameraTransform = multiply(rotationy(0), rotationx(0));
+    cameraTransform.m30 = 0.0f;
+    cameraTransform.m31 = 1.0f;
+    cameraTransform.m32 = 10.0f;
+    rt.SetViewMatrix(cameraTransform);
+    rt.BuildAccelerationStructure();
+
+    std::cout << "Wavefront benchmark, " << w << "x" << h << ", " << raysPerPixel << " rpp, " << spheresAmount << " spheres, single thread\n";
+    printf(" %8s | %12s %12s | %8s | %s\n", "bounces", "path MR/s", "wavefront", "speedup", "same image");
+
+    double numRays = double(w) * h * raysPerPixel;
+    for (unsigned bounces : { 1u, 2u, 4u, 8u, 16u })
+    {
+        rt.bounces = bounces;
+
+        // both render frame 0, so they draw the same random numbers
+        double seconds[2];
+        std::vector<Color> images[2];
+        for (int wavefront = 0; wavefront < 2; wavefront++)
+        {
+            rt.wavefront = wavefront == 1;
+            rt.frameIndex = 0;
+            rt.Clear();
+
+            auto start = std::chrono::high_resolution_clock::now();
+            rt.Raytrace();
+            auto end = std::chrono::high_resolution_clock::now();
+            seconds[wavefront] = std::chrono::duration<double>(end - start).count();
+            images[wavefront] = framebuffer;
+        }
+
+        bool same = true;
+        for (size_t i = 0; i < framebuffer.size() && same; i++)
+        {
+            same = images[0][i].r == images[1][i].r && images[0][i].g == images[1][i].g && images[0][i].b == images[1][i].b;
+        }
+
+        printf(" %8u | %12.3f %12.3f | %8.2f | %s\n", bounces,
+               numRays / seconds[0] / 1'000'000.0, numRays / seconds[1] / 1'000'000.0,
+               seconds[0] / seconds[1], same ? "yes" : "NO");
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Same as TraceRays, but the rays are cast in packets of 4x2 pixel blocks.
+    rays has to be the w x h grid from PrimaryRays.
+*/
+static TraceResult
+TracePrimaryPackets(Raytracer& rt, std::vector<Ray> const& rays, unsigned w, unsigned h)
+{
+    TraceResult result;
+    result.distances.resize(rays.size());
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (unsigned y = 0; y < h; y += Raytracer::PacketHeight)
+    {
+        for (unsigned x = 0; x < w; x += Raytracer::PacketWidth)
+        {
+            uint32_t laneMask = 0;
+            Ray packet[RayPacket::Size] = { rays[0], rays[0], rays[0], rays[0], rays[0], rays[0], rays[0], rays[0] };
+            for (unsigned lane = 0; lane < RayPacket::Size; lane++)
+            {
+                unsigned px = x + lane % Raytracer::PacketWidth, py = y + lane / Raytracer::PacketWidth;
+                if (px < w && py < h)
+                {
+                    packet[lane] = rays[size_t(py) * w + px];
+                    laneMask |= 1u << lane;
+                }
+            }
+
+            HitResult hits[RayPacket::Size];
+            rt.RaycastPacket(packet, laneMask, hits, &result.stats);
+            for (unsigned lane = 0; lane < RayPacket::Size; lane++)
+            {
+                // Raycast reports FLT_MAX for misses too
+                if (laneMask & (1u << lane))
+                    result.distances[size_t(y + lane / Raytracer::PacketWidth) * w + x + lane % Raytracer::PacketWidth] = hits[lane].t;
+            }
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    return result;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BenchmarkPackets(unsigned w, unsigned h, int spheresAmount)
+{
+    std::vector<Color> framebuffer(size_t(w) * h);
+    Raytracer rt = Raytracer(w, h, framebuffer, 1, 1);
+    CreateRandomSphereScene(rt, spheresAmount);
+
+    rt.accelerator = Accelerator::BVH;
+    rt.BuildAccelerationStructure();
+    std::vector<Ray> primaryRays = PrimaryRays(rt, w, h);
+    double numPrimary = double(primaryRays.size());
+
+    std::cout << "Packet benchmark, " << w << "x" << h << ", " << spheresAmount << " spheres, single thread\n";
+    printf(" %-8s | %9s %9s | %9s %9s | %8s | %s\n", "camera", "ray MR/s", "nodes/ray", "pkt MR/s", "nodes/ray", "speedup", "mismatches");
+    for (Accelerator accelerator : { Accelerator::Linear, Accelerator::BVH })
+    {
+        if (accelerator == Accelerator::Linear && spheresAmount > MaxLinearSpheres)
+            continue;
+
+        rt.accelerator = accelerator;
+        rt.BuildAccelerationStructure();
+        TraceResult single = TraceRays(rt, primaryRays);
+        TraceResult packet = TracePrimaryPackets(rt, primaryRays, w, h);
+
+        // a packet node visit is counted once for all 8 rays
+        printf(" %-8s | %9.3f %9.2f | %9.3f %9.2f | %8.2f | %zu\n", AcceleratorName(accelerator),
+               numPrimary / single.seconds / 1'000'000.0, single.stats.nodeVisits / numPrimary,
+               numPrimary / packet.seconds / 1'000'000.0, packet.stats.nodeVisits / numPrimary,
+               single.seconds / packet.seconds, CountMismatches(single.distances, packet.distances));
+    }
+
+    // whole frames, only the camera rays are packets so the gain shrinks with every bounce
+    rt.accelerator = Accelerator::BVH;
+    rt.BuildAccelerationStructure();
+    printf("\n %8s | %12s %12s | %8s | %s\n", "bounces", "path MR/s", "packets", "speedup", "same image");
+    for (unsigned bounces : { 1u, 2u, 4u, 8u })
+    {
+        rt.bounces = bounces;
+
+        double seconds[2];
+        std::vector<Color> images[2];
+        for (int packets = 0; packets < 2; packets++)
+        {
+            rt.packets = packets == 1;
+            rt.frameIndex = 0;
+            rt.Clear();
+
+            auto start = std::chrono::high_resolution_clock::now();
+            rt.Raytrace();
+            auto end = std::chrono::high_resolution_clock::now();
+            seconds[packets] = std::chrono::duration<double>(end - start).count();
+            images[packets] = framebuffer;
+        }
+
+        bool same = true;
+        for (size_t i = 0; i < framebuffer.size() && same; i++)
+        {
+            same = images[0][i].r == images[1][i].r && images[0][i].g == images[1][i].g && images[0][i].b == images[1][i].b;
+        }
+
+        printf(" %8u | %12.3f %12.3f | %8.2f | %s\n", bounces,
+               numPrimary / seconds[0] / 1'000'000.0, numPrimary / seconds[1] / 1'000'000.0,
+               seconds[0] / seconds[1], same ? "yes" : "NO");
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BenchmarkRaySorting(unsigned w, unsigned h, int raysPerPixel, int spheresAmount)
+{
+    std::vector<Color> framebuffer(size_t(w) * h);
+    Raytracer rt = Raytracer(w, h, framebuffer, raysPerPixel, 1);
+    CreateRandomSphereScene(rt, spheresAmount);
+
+    mat4 cameraTransform = multiply(rotationy(0), rotationx(0));
+    cameraTransform.m30 = 0.0f;
+    cameraTransform.m31 = 1.0f;
+    cameraTransform.m32 = 10.0f;
+    rt.SetViewMatrix(cameraTransform);
+    rt.BuildAccelerationStructure();
+    rt.wavefront = true;
+
+    PerfCounter cacheMisses(PerfEvent::CacheMisses);
+    std::cout << "Ray sorting benchmark, " << w << "x" << h << ", " << raysPerPixel << " rpp, " << spheresAmount << " spheres, "
+              << AcceleratorName(rt.accelerator) << ", single thread\n";
+    if (!cacheMisses.Available())
+        std::cout << "cache miss counter not available, misses are reported as n/a\n";
+    printf(" %8s | %12s %12s | %12s %12s | %8s | %s\n", "bounces", "pixel MR/s", "sorted", "pixel miss/r", "sorted", "speedup", "same image");
+
+    double numRays = double(w) * h * raysPerPixel;
+    for (unsigned bounces : { 2u, 4u, 8u })
+    {
+        rt.bounces = bounces;
+
+        // both render frame 0, so they draw the same random numbers
+        double seconds[2];
+        uint64_t misses[2];
+        std::vector<Color> images[2];
+        for (int sorted = 0; sorted < 2; sorted++)
+        {
+            rt.sortRays = sorted == 1;
+            rt.frameIndex = 0;
+            rt.Clear();
+
+            cacheMisses.Start();
+            auto start = std::chrono::high_resolution_clock::now();
+            rt.Raytrace();
+            auto end = std::chrono::high_resolution_clock::now();
+            misses[sorted] = cacheMisses.Stop();
+            seconds[sorted] = std::chrono::duration<double>(end - start).count();
+            images[sorted] = framebuffer;
+        }
+
+        bool same = true;
+        for (size_t i = 0; i < framebuffer.size() && same; i++)
+        {
+            same = images[0][i].r == images[1][i].r && images[0][i].g == images[1][i].g && images[0][i].b == images[1][i].b;
+        }
+
+        char missText[2][16] = { "n/a", "n/a" };
+        if (cacheMisses.Available())
+        {
+            snprintf(missText[0], sizeof(missText[0]), "%.3f", misses[0] / numRays);
+            snprintf(missText[1], sizeof(missText[1]), "%.3f", misses[1] / numRays);
+        }
+        printf(" %8u | %12.3f %12.3f | %12s %12s | %8.2f | %s\n", bounces,
+               numRays / seconds[0] / 1'000'000.0, numRays / seconds[1] / 1'000'000.0,
+               missText[0], missText[1], seconds[0] / seconds[1], same ? "yes" : "NO");
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BenchmarkRefit(unsigned w, unsigned h, int raysPerPixel, int maxBounces, int spheresAmount, unsigned NumberOfJobs, int frames)
+{
+    std::vector<Color> framebuffer(size_t(w) * h);
+    Raytracer rt = Raytracer(w, h, framebuffer, raysPerPixel, maxBounces);
+    std::vector<Sphere*> spheres = CreateRandomSphereScene(rt, spheresAmount);
+    std::vector<vec3> startPositions;
+    for (Sphere const* sphere : spheres)
+        startPositions.push_back(sphere->center);
+
+    mat4 cameraTransform = multiply(rotationy(0), rotationx(0));
+    cameraTransform.m30 = 0.0f;
+    cameraTransform.m31 = 1.0f;
+    cameraTransform.m32 = 10.0f;
+    rt.SetViewMatrix(cameraTransform);
+    rt.BuildAccelerationStructure();
+
+    TaskRunner runTasks = [&rt](std::vector<std::function<void()>>& tasks)
+    {
+        rt.RunTasks(tasks);
+    };
+
+    std::cout << "Refit benchmark, " << frames << " frames at " << w << "x" << h << ", " << raysPerPixel << " rpp, "
+              << spheresAmount << " spheres, rebuild threshold " << rt.refitRebuildThreshold << "\n";
+    printf(" %6s | %9s %10s | %9s %9s | %8s | %9s\n", "frame", "refit ms", "rebuild ms", "refit SAH", "fresh SAH", "rebuilt", "frame ms");
+
+    double refitTotal = 0.0, rebuildTotal = 0.0, frameTotal = 0.0;
+    int rebuilds = 0;
+    int printEvery = std::max(frames / 10, 1);
+    std::vector<AABB> bounds(spheres.size());
+    for (int frame = 1; frame <= frames; frame++)
+    {
+        // 30 frames per second of animation
+        AnimateSpheres(spheres, startPositions, frame / 30.0f);
+        rt.ObjectsMoved();
+
+        auto refitStart = std::chrono::high_resolution_clock::now();
+        bool rebuilt = rt.RefitAccelerationStructure();
+        auto refitEnd = std::chrono::high_resolution_clock::now();
+        float refitCost = rt.GetBVH().SAHCost();
+
+        // what the interactive loop would have to do every frame without refitting
+        for (size_t i = 0; i < spheres.size(); i++)
+            bounds[i] = spheres[i]->GetBounds();
+        BVH fresh;
+        auto rebuildStart = std::chrono::high_resolution_clock::now();
+        fresh.Build(bounds, rt.bvhBuilder, runTasks);
+        auto rebuildEnd = std::chrono::high_resolution_clock::now();
+
+        auto frameStart = std::chrono::high_resolution_clock::now();
+        rt.RaytraceMultithreaded(NumberOfJobs);
+        auto frameEnd = std::chrono::high_resolution_clock::now();
+
+        double refitMs = std::chrono::duration<double, std::milli>(refitEnd - refitStart).count();
+        double rebuildMs = std::chrono::duration<double, std::milli>(rebuildEnd - rebuildStart).count();
+        double frameMs = std::chrono::duration<double, std::milli>(frameEnd - frameStart).count();
+        refitTotal += refitMs;
+        rebuildTotal += rebuildMs;
+        frameTotal += frameMs;
+        rebuilds += rebuilt ? 1 : 0;
+
+        if (frame % printEvery == 0 || rebuilt)
+        {
+            printf(" %6d | %9.3f %10.3f | %9.2f %9.2f | %8s | %9.3f\n", frame, refitMs, rebuildMs,
+                   refitCost, fresh.SAHCost(), rebuilt ? "yes" : "no", frameMs);
+        }
+    }
+
+    if (frames <= 0)
+        return;
+    printf(" %6s | %9.3f %10.3f | %9s %9s | %8d | %9.3f\n", "avg", refitTotal / frames, rebuildTotal / frames,
+           "", "", rebuilds, frameTotal / frames);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BenchmarkSpatialSplits(unsigned w, unsigned h, int spheresAmount)
+{
+    std::cout << "Spatial split benchmark, " << spheresAmount << " spheres, trace on one thread\n";
+    printf(" %-11s %-11s %10s %10s %9s %9s | %9s %9s %9s | %9s %9s %9s | %s\n",
+           "scene", "builder", "build ms", "refs", "MB", "SAH cost", "prim MR/s", "nodes/ray", "tests/ray", "sec MR/s", "nodes/ray", "tests/ray", "mismatches");
+
+    struct Scene
+    {
+        char const* name;
+        std::vector<Sphere*> (*create)(Raytracer&, int);
+    };
+    for (Scene const& scene : { Scene{ "random", &CreateRandomSphereScene }, Scene{ "overlapping", &CreateOverlappingSphereScene } })
+    {
+        std::vector<Color> framebuffer(size_t(w) * h);
+        Raytracer rt = Raytracer(w, h, framebuffer, 1, 1);
+        scene.create(rt, spheresAmount);
+
+        rt.accelerator = Accelerator::BVH;
+        rt.bvhBuilder = BVHBuilder::BinnedSAH;
+        rt.BuildAccelerationStructure();
+        std::vector<Ray> primaryRays = PrimaryRays(rt, w, h);
+        std::vector<Ray> secondaryRays = SecondaryRays(rt, primaryRays);
+
+        TraceResult referencePrimary;
+        TraceResult referenceSecondary;
+        bool haveReference = false;
+
+        for (BVHBuilder builder : { BVHBuilder::BinnedSAH, BVHBuilder::SpatialSAH })
+        {
+            rt.bvhBuilder = builder;
+            auto buildStart = std::chrono::high_resolution_clock::now();
+            rt.BuildAccelerationStructure();
+            auto buildEnd = std::chrono::high_resolution_clock::now();
+            double buildMs = std::chrono::duration<double, std::milli>(buildEnd - buildStart).count();
+
+            TraceResult primary = TraceRays(rt, primaryRays);
+            TraceResult secondary = TraceRays(rt, secondaryRays);
+            if (!haveReference)
+            {
+                referencePrimary = primary;
+                referenceSecondary = secondary;
+                haveReference = true;
+            }
+            size_t mismatches = CountMismatches(primary.distances, referencePrimary.distances)
+                              + CountMismatches(secondary.distances, referenceSecondary.distances);
+
+            // the index list and the sphere pack grow with every reference a split adds
+            BVH const& bvh = rt.GetBVH();
+            size_t references = bvh.primitiveIndices.size();
+            double megabytes = (bvh.nodes.size() * sizeof(BVHNode) + references * (sizeof(uint32_t) + sizeof(float) * 5 + sizeof(uint32_t))) / (1024.0 * 1024.0);
+
+            double numPrimary = double(primaryRays.size());
+            double numSecondary = double(std::max<size_t>(secondaryRays.size(), 1));
+            printf(" %-11s %-11s %10.2f %10zu %9.2f %9.2f | %9.3f %9.2f %9.2f | %9.3f %9.2f %9.2f | %zu\n",
+                   scene.name, BVHBuilderName(builder), buildMs, references, megabytes, bvh.SAHCost(),
+                   numPrimary / primary.seconds / 1'000'000.0, primary.stats.nodeVisits / numPrimary, primary.stats.primitiveTests / numPrimary,
+                   numSecondary / secondary.seconds / 1'000'000.0, secondary.stats.nodeVisits / numSecondary, secondary.stats.primitiveTests / numSecondary,
+                   mismatches);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BenchmarkNodeLayout(unsigned w, unsigned h, int spheresAmount)
+{
+    std::vector<Color> framebuffer(size_t(w) * h);
+    Raytracer rt = Raytracer(w, h, framebuffer, 1, 1);
+    CreateRandomSphereScene(rt, spheresAmount);
+
+    rt.accelerator = Accelerator::BVH;
+    rt.BuildAccelerationStructure();
+    std::vector<Ray> primaryRays = PrimaryRays(rt, w, h);
+    std::vector<Ray> secondaryRays = SecondaryRays(rt, primaryRays);
+    BVH built = rt.GetBVH();
+
+    PerfCounter l1Loads(PerfEvent::L1DataLoads), l1Misses(PerfEvent::L1DataLoadMisses);
+    PerfCounter llLoads(PerfEvent::LastLevelLoads), llMisses(PerfEvent::LastLevelLoadMisses);
+    PerfCounter* counters[] = { &l1Loads, &l1Misses, &llLoads, &llMisses };
+
+    std::cout << "Node layout benchmark, " << spheresAmount << " spheres, " << built.nodes.size() << " nodes, "
+              << primaryRays.size() << " primary and " << secondaryRays.size() << " secondary rays\n";
+    for (PerfCounter const* counter : counters)
+    {
+        if (!counter->Available())
+        {
+            std::cout << "some cache counters not available, they are reported as n/a\n";
+            break;
+        }
+    }
+    printf(" %-12s %10s | %-9s %9s %9s %9s %9s %9s | %s\n",
+           "", "reorder ms", "rays", "MR/s", "L1 miss/r", "L1 miss%", "LL miss/r", "LL miss%", "mismatches");
+
+    TraceResult referencePrimary;
+    TraceResult referenceSecondary;
+    bool haveReference = false;
+
+    for (BVHLayout layout : { BVHLayout::BuildOrder, BVHLayout::DepthFirst, BVHLayout::Treelet })
+    {
+        // the scene stays the same, so reordering a copy of the first build gives the same tree every time
+        BVH reordered = built;
+        auto reorderStart = std::chrono::high_resolution_clock::now();
+        reordered.Reorder(layout);
+        auto reorderEnd = std::chrono::high_resolution_clock::now();
+        double reorderMs = std::chrono::duration<double, std::milli>(reorderEnd - reorderStart).count();
+
+        rt.bvhLayout = layout;
+        rt.BuildAccelerationStructure();
+
+        uint64_t counts[2][4];
+        TraceResult results[2];
+        std::vector<Ray> const* rays[2] = { &primaryRays, &secondaryRays };
+        for (int pass = 0; pass < 2; pass++)
+        {
+            for (PerfCounter* counter : counters)
+                counter->Start();
+            results[pass] = TraceRays(rt, *rays[pass]);
+            for (int c = 0; c < 4; c++)
+                counts[pass][c] = counters[c]->Stop();
+        }
+
+        if (!haveReference)
+        {
+            referencePrimary = results[0];
+            referenceSecondary = results[1];
+            haveReference = true;
+        }
+        size_t mismatches = CountMismatches(results[0].distances, referencePrimary.distances)
+                          + CountMismatches(results[1].distances, referenceSecondary.distances);
+
+        for (int pass = 0; pass < 2; pass++)
+        {
+            double numRays = double(std::max<size_t>(rays[pass]->size(), 1));
+            char text[4][16] = { "n/a", "n/a", "n/a", "n/a" };
+            if (l1Loads.Available() && l1Misses.Available())
+            {
+                snprintf(text[0], sizeof(text[0]), "%.2f", counts[pass][1] / numRays);
+                snprintf(text[1], sizeof(text[1]), "%.2f", 100.0 * counts[pass][1] / std::max<uint64_t>(counts[pass][0], 1));
+            }
+            if (llLoads.Available() && llMisses.Available())
+            {
+                snprintf(text[2], sizeof(text[2]), "%.3f", counts[pass][3] / numRays);
+                snprintf(text[3], sizeof(text[3]), "%.2f", 100.0 * counts[pass][3] / std::max<uint64_t>(counts[pass][2], 1));
+            }
+
+            char reorderText[16] = "";
+            if (pass == 0)
+                snprintf(reorderText, sizeof(reorderText), "%.2f", reorderMs);
+            char mismatchText[24] = "";
+            if (pass == 0)
+                snprintf(mismatchText, sizeof(mismatchText), "%zu", mismatches);
+            printf(" %-12s %10s | %-9s %9.3f %9s %9s %9s %9s | %s\n",
+                   pass == 0 ? BVHLayoutName(layout) : "", reorderText, pass == 0 ? "primary" : "secondary",
+                   numRays / results[pass].seconds / 1'000'000.0, text[0], text[1], text[2], text[3], mismatchText);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BenchmarkGrid(unsigned w, unsigned h)
+{
+    std::cout << "Grid benchmark, build on all threads, trace on one\n";
+    printf(" %8s %-6s %10s %10s %9s | %9s %9s %9s | %9s %9s %9s | %s\n",
+           "spheres", "", "build ms", "cells", "MB", "prim MR/s", "nodes/ray", "tests/ray", "sec MR/s", "nodes/ray", "tests/ray", "mismatches");
+
+    for (int spheresAmount : { 36, 1000, 10000, 100000, 1000000 })
+    {
+        std::vector<Color> framebuffer(size_t(w) * h);
+        Raytracer rt = Raytracer(w, h, framebuffer, 1, 1);
+        CreateRandomSphereScene(rt, spheresAmount);
+
+        rt.accelerator = Accelerator::BVH;
+        rt.BuildAccelerationStructure();
+        std::vector<Ray> primaryRays = PrimaryRays(rt, w, h);
+        std::vector<Ray> secondaryRays = SecondaryRays(rt, primaryRays);
+
+        TraceResult referencePrimary;
+        TraceResult referenceSecondary;
+        bool haveReference = false;
+
+        for (Accelerator accelerator : { Accelerator::BVH, Accelerator::Grid, Accelerator::Grid2 })
+        {
+            rt.accelerator = accelerator;
+            auto buildStart = std::chrono::high_resolution_clock::now();
+            rt.BuildAccelerationStructure();
+            auto buildEnd = std::chrono::high_resolution_clock::now();
+            double buildMs = std::chrono::duration<double, std::milli>(buildEnd - buildStart).count();
+
+            TraceResult primary = TraceRays(rt, primaryRays);
+            TraceResult secondary = TraceRays(rt, secondaryRays);
+            if (!haveReference)
+            {
+                referencePrimary = primary;
+                referenceSecondary = secondary;
+                haveReference = true;
+            }
+            size_t mismatches = CountMismatches(primary.distances, referencePrimary.distances)
+                              + CountMismatches(secondary.distances, referenceSecondary.distances);
+
+            double numPrimary = double(primaryRays.size());
+            double numSecondary = double(std::max<size_t>(secondaryRays.size(), 1));
+            printf(" %8d %-6s %10.2f %10zu %9.2f | %9.3f %9.2f %9.2f | %9.3f %9.2f %9.2f | %zu\n",
+                   spheresAmount, AcceleratorName(accelerator), buildMs, rt.NodeCount(), rt.NodeBytes() / (1024.0 * 1024.0),
+                   numPrimary / primary.seconds / 1'000'000.0, primary.stats.nodeVisits / numPrimary, primary.stats.primitiveTests / numPrimary,
+                   numSecondary / secondary.seconds / 1'000'000.0, secondary.stats.nodeVisits / numSecondary, secondary.stats.primitiveTests / numSecondary,
+                   mismatches);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Visibility of every ray up to its own tMax, either with the closest hit
+    Raycast finds or with Occluded. distances holds 1 for occluded rays and 0
+    for the others so the two can be compared with CountMismatches.
+*/
+static TraceResult
+TraceVisibility(Raytracer& rt, std::vector<Ray> const& rays, std::vector<float> const& tMax, bool anyHit)
+{
+    TraceResult result;
+    result.distances.resize(rays.size());
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        bool occluded;
+        if (anyHit)
+        {
+            occluded = rt.Occluded(rays[i], tMax[i], &result.stats);
+        }
+        else
+        {
+            vec3 hitPoint;
+            vec3 hitNormal;
+            Object* hitObject = nullptr;
+            float distance = FLT_MAX;
+            occluded = rt.Raycast(rays[i], hitPoint, hitNormal, hitObject, distance, &result.stats) && distance < tMax[i];
+        }
+        result.distances[i] = occluded ? 1.0f : 0.0f;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    return result;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BenchmarkOcclusion(unsigned w, unsigned h, int spheresAmount)
+{
+    std::vector<Color> framebuffer(size_t(w) * h);
+    Raytracer rt = Raytracer(w, h, framebuffer, 1, 1);
+    CreateRandomSphereScene(rt, spheresAmount);
+
+    rt.accelerator = Accelerator::BVH;
+    rt.BuildAccelerationStructure();
+    std::vector<Ray> primaryRays = PrimaryRays(rt, w, h);
+
+    // shadow rays from every primary hit to a point light above the scene, and ambient occlusion
+    // rays a short way along the scattered direction
+    vec3 const light = { 0.0f, 40.0f, 0.0f };
+    float const occlusionRadius = 1.0f;
+    std::vector<Ray> shadowRays;
+    std::vector<float> shadowMax;
+    std::vector<Ray> occlusionRays;
+    std::vector<float> occlusionMax;
+    for (unsigned i = 0; i < primaryRays.size(); i++)
+    {
+        RandomStream rng(i, 0, 0);
+        vec3 hitPoint;
+        vec3 hitNormal;
+        Object* hitObject = nullptr;
+        float distance = FLT_MAX;
+        if (!rt.Raycast(primaryRays[i], hitPoint, hitNormal, hitObject, distance))
+            continue;
+
+        vec3 toLight = light - hitPoint;
+        shadowRays.push_back(Ray(hitPoint, normalize(toLight)));
+        shadowMax.push_back(float(len(toLight)));
+
+        Ray scattered = BSDF(rt.GetMaterial(hitObject->GetMaterial()), primaryRays[i], hitPoint, hitNormal, rng);
+        occlusionRays.push_back(Ray(scattered.b, normalize(scattered.m)));
+        occlusionMax.push_back(occlusionRadius);
+    }
+
+    std::cout << "Occlusion benchmark, " << spheresAmount << " spheres, " << shadowRays.size() << " shadow and "
+              << occlusionRays.size() << " ambient occlusion rays, closest hit with Raycast against any hit with Occluded\n";
+    printf(" %-8s %-7s %9s | %9s %9s %9s | %9s %9s %9s | %s\n",
+           "", "rays", "occluded", "ray MR/s", "nodes/ray", "tests/ray", "any MR/s", "nodes/ray", "tests/ray", "mismatches");
+
+    for (Accelerator accelerator : { Accelerator::Linear, Accelerator::BVH, Accelerator::BVH4, Accelerator::BVH8, Accelerator::BVH4Q, Accelerator::Grid, Accelerator::Grid2 })
+    {
+        if (accelerator == Accelerator::Linear && spheresAmount > MaxLinearSpheres)
+            continue;
+
+        rt.accelerator = accelerator;
+        rt.BuildAccelerationStructure();
+
+        for (int kind = 0; kind < 2; kind++)
+        {
+            std::vector<Ray> const& rays = kind == 0 ? shadowRays : occlusionRays;
+            std::vector<float> const& tMax = kind == 0 ? shadowMax : occlusionMax;
+            TraceResult closest = TraceVisibility(rt, rays, tMax, false);
+            TraceResult any = TraceVisibility(rt, rays, tMax, true);
+
+            double numRays = double(std::max<size_t>(rays.size(), 1));
+            double occluded = 0.0;
+            for (float visibility : any.distances)
+                occluded += visibility;
+            printf(" %-8s %-7s %8.1f%% | %9.3f %9.2f %9.2f | %9.3f %9.2f %9.2f | %zu\n",
+                   AcceleratorName(accelerator), kind == 0 ? "shadow" : "ao", occluded / numRays * 100.0,
+                   numRays / closest.seconds / 1'000'000.0, closest.stats.nodeVisits / numRays, closest.stats.primitiveTests / numRays,
+                   numRays / any.seconds / 1'000'000.0, any.stats.nodeVisits / numRays, any.stats.primitiveTests / numRays,
+                   CountMismatches(closest.distances, any.distances));
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Averages rpp samples of every pixel from frame frameIndex on, the
+    framebuffer accumulates one frame at a time like the interactive loop
+*/
+static std::vector<Color>
+RenderFrames(Raytracer& rt, unsigned frames, unsigned firstFrame)
+{
+    rt.Clear();
+    rt.frameIndex = firstFrame;
+    for (unsigned frame = 0; frame < frames; frame++)
+        rt.Raytrace();
+
+    std::vector<Color> image = rt.frameBuffer;
+    for (Color& color : image)
+        color = color * (1.0f / frames);
+    return image;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Compared after clamping to [0, 1] like the written image is, otherwise
+    the few pixels that look straight at a light would be all that counts
+*/
+static double
+RMSError(std::vector<Color> const& image, std::vector<Color> const& reference)
+{
+    auto clamp = [](float value) { return std::min(std::max(double(value), 0.0), 1.0); };
+    double sum = 0.0;
+    for (size_t i = 0; i < image.size(); i++)
+    {
+        double r = clamp(image[i].r) - clamp(reference[i].r);
+        double g = clamp(image[i].g) - clamp(reference[i].g);
+        double b = clamp(image[i].b) - clamp(reference[i].b);
+        sum += (r * r + g * g + b * b) / 3.0;
+    }
+    return sqrt(sum / std::max<size_t>(image.size(), 1));
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static double
+MeanBrightness(std::vector<Color> const& image)
+{
+    double sum = 0.0;
+    for (Color const& color : image)
+        sum += (color.r + color.g + color.b) / 3.0;
+    return sum / std::max<size_t>(image.size(), 1);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BenchmarkNextEventEstimation(unsigned w, unsigned h, int maxBounces, int spheresAmount, int lights)
+{
+    std::vector<Color> framebuffer(size_t(w) * h);
+    Raytracer rt = Raytracer(w, h, framebuffer, 1, maxBounces);
+    CreateRandomSphereScene(rt, spheresAmount);
+    AddSphereLights(rt, lights);
+
+    mat4 cameraTransform = multiply(rotationy(0), rotationx(0));
+    cameraTransform.m30 = 0.0f;
+    cameraTransform.m31 = 1.0f;
+    cameraTransform.m32 = 10.0f;
+    rt.SetViewMatrix(cameraTransform);
+    rt.BuildAccelerationStructure();
+
+    // the references start at a frame none of the measured renders use, so their noise is independent
+    constexpr unsigned ReferenceFrames = 1024;
+    constexpr unsigned ReferenceFirstFrame = 1u << 20;
+    auto referenceStart = std::chrono::high_resolution_clock::now();
+    rt.nextEventEstimation = true;
+    std::vector<Color> reference = RenderFrames(rt, ReferenceFrames, ReferenceFirstFrame);
+    rt.nextEventEstimation = false;
+    std::vector<Color> referenceWithout = RenderFrames(rt, ReferenceFrames, ReferenceFirstFrame);
+    auto referenceEnd = std::chrono::high_resolution_clock::now();
+
+    std::cout << "Next event estimation benchmark, " << w << "x" << h << ", " << maxBounces << " bounces, " << spheresAmount << " spheres, "
+              << rt.LightCount() << " lights, single thread\n";
+    printf(" references of %u spp took %.1f s, mean brightness %.4f with and %.4f without, RMS difference %.4f\n",
+           ReferenceFrames, std::chrono::duration<double>(referenceEnd - referenceStart).count(),
+           MeanBrightness(reference), MeanBrightness(referenceWithout), RMSError(reference, referenceWithout));
+    printf(" %5s | %10s %10s | %10s %10s | %s\n", "spp", "ms", "RMS error", "NEE ms", "RMS error", "error ratio");
+
+    for (unsigned spp : { 1u, 2u, 4u, 8u, 16u, 32u })
+    {
+        double seconds[2];
+        double error[2];
+        for (int nee = 0; nee < 2; nee++)
+        {
+            rt.nextEventEstimation = nee == 1;
+            auto start = std::chrono::high_resolution_clock::now();
+            std::vector<Color> image = RenderFrames(rt, spp, 0);
+            auto end = std::chrono::high_resolution_clock::now();
+            seconds[nee] = std::chrono::duration<double>(end - start).count();
+            error[nee] = RMSError(image, reference);
+        }
+        printf(" %5u | %10.1f %10.4f | %10.1f %10.4f | %.2f\n", spp,
+               seconds[0] * 1000.0, error[0], seconds[1] * 1000.0, error[1], error[0] / std::max(error[1], 1e-12));
+    }
+}
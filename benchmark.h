@@ -0,0 +1,108 @@
+#pragma once
+
+//------------------------------------------------------------------------------
+/**
+    Builds the random sphere scene from main.cc once and traces the same set of
+    primary and secondary rays through every acceleration structure on a single
+    thread. Prints build time, node count, MRays/s and node visits per ray.
+    Then does the same for the BVH from every builder, with the SAH cost of
+    the tree and the time to build it and trace all the rays once.
+*/
+void BenchmarkAccelerators(unsigned w, unsigned h, int spheresAmount);
+
+//------------------------------------------------------------------------------
+/**
+    Renders the same scene frames times with RaytraceMultithreaded, like the
+    interactive loop does, and prints percentiles of the time per frame.
+*/
+void BenchmarkFrameLatency(unsigned w, unsigned h, int raysPerPixel, int maxBounces, int spheresAmount, unsigned NumberOfJobs, int frames);
+
+//------------------------------------------------------------------------------
+/**
+    Traces an empty scene with one sample per pixel on a single thread, so the
+    time is dominated by framebuffer access. Compares the old column by column
+    loop with the row major loop and the tiled framebuffer.
+*/
+void BenchmarkFrameBufferLayout(unsigned w, unsigned h);
+
+//------------------------------------------------------------------------------
+/**
+    Renders one frame on a single thread with the path at a time tracer and
+    with the wavefront tracer, for a range of bounce depths. Prints MRays/s of
+    both and checks that they produce the same image.
+*/
+void BenchmarkWavefront(unsigned w, unsigned h, int raysPerPixel, int spheresAmount);
+
+//------------------------------------------------------------------------------
+/**
+    Casts the camera rays one at a time and as 4x2 packets with the linear and
+    BVH accelerators, then renders whole frames with and without packets for a
+    range of bounce depths. Prints MRays/s and checks that the hits agree.
+*/
+void BenchmarkPackets(unsigned w, unsigned h, int spheresAmount);
+
+//------------------------------------------------------------------------------
+/**
+    Renders one frame on a single thread with the wavefront tracer, with and
+    without sorting the secondary rays, for a range of bounce depths. Prints
+    MRays/s, last level cache misses per ray where the OS lets us count them,
+    and checks that both produce the same image.
+*/
+void BenchmarkRaySorting(unsigned w, unsigned h, int raysPerPixel, int spheresAmount);
+
+//------------------------------------------------------------------------------
+/**
+    Animates the random spheres like -animate does and updates the sphere BVH
+    every frame, with a refit and with a full build for comparison. Prints the
+    time of both, the SAH cost of the refit tree against a fresh one, how often
+    the refit fell back to a rebuild, and the time to render each frame.
+*/
+void BenchmarkRefit(unsigned w, unsigned h, int raysPerPixel, int maxBounces, int spheresAmount, unsigned NumberOfJobs, int frames);
+
+//------------------------------------------------------------------------------
+/**
+    Builds the sphere BVH with and without spatial splits, for the random
+    sphere scene and for the overlapping sphere scene, and traces the same
+    primary and secondary rays through both. Prints the references the splits
+    added, memory, SAH cost, node visits and tests per ray and MRays/s, and
+    checks that both trees find the same hits.
+*/
+void BenchmarkSpatialSplits(unsigned w, unsigned h, int spheresAmount);
+
+//------------------------------------------------------------------------------
+/**
+    Builds the sphere BVH once and traces the same primary and secondary rays
+    with the nodes in every layout, on a single thread. Prints MRays/s and,
+    where the OS lets us count them, L1 data and last level cache load misses
+    per ray and as a rate of all loads. Checks that all layouts find the same hits.
+*/
+void BenchmarkNodeLayout(unsigned w, unsigned h, int spheresAmount);
+
+//------------------------------------------------------------------------------
+/**
+    Builds the random sphere scene for a range of sphere counts from 36 to a
+    million and traces the same rays through the BVH and both grids. Prints
+    build time, cells or nodes, memory, MRays/s and node visits and tests per
+    ray, and checks that the grids find the same hits as the BVH.
+*/
+void BenchmarkGrid(unsigned w, unsigned h);
+
+//------------------------------------------------------------------------------
+/**
+    Casts shadow rays from the camera hits to a point light and short ambient
+    occlusion rays, through every acceleration structure on a single thread.
+    Compares finding the closest hit with Raycast to stopping at any hit with
+    Occluded, prints MRays/s and node visits and tests per ray of both, and
+    checks that they agree on which rays are occluded.
+*/
+void BenchmarkOcclusion(unsigned w, unsigned h, int spheresAmount);
+
+//------------------------------------------------------------------------------
+/**
+    Adds lights emissive spheres to the random sphere scene and renders it on
+    a single thread with and without next event estimation, for a range of
+    samples per pixel. Prints the time and the RMS error against a reference
+    rendered with many samples, and the mean brightness of a reference made
+    each way so a bias in either would show.
+*/
+void BenchmarkNextEventEstimation(unsigned w, unsigned h, int maxBounces, int spheresAmount, int lights);
@@ -0,0 +1,99 @@
+#pragma once
+#include "object.h"
+#include "ray.h"
+#include <math.h>
+#include <algorithm>
+
+// an axis aligned box
+class Box : public Object
+{
+public:
+    vec3 min;
+    vec3 max;
+    uint32_t material;
+
+    Box(vec3 min, vec3 max, uint32_t material) :
+        min(min),
+        max(max),
+        material(material)
+    {
+
+    }
+
+    ~Box() override
+    {
+
+    }
+
+    uint32_t GetMaterial() override
+    {
+        return this->material;
+    }
+
+    AABB GetBounds() override
+    {
+        AABB bounds;
+        bounds.min = this->min;
+        bounds.max = this->max;
+        return bounds;
+    }
+
+    // slab test, the normal is the axis of the slab the hit point lies on
+    HitResult Intersect(Ray ray, float maxDist) override
+    {
+        constexpr float minDist = 0.001f;
+        float const o[3] = { float(ray.b.x), float(ray.b.y), float(ray.b.z) };
+        float const d[3] = { float(ray.m.x), float(ray.m.y), float(ray.m.z) };
+        float const lo[3] = { float(this->min.x), float(this->min.y), float(this->min.z) };
+        float const hi[3] = { float(this->max.x), float(this->max.y), float(this->max.z) };
+
+        float tNear = -INFINITY, tFar = INFINITY;
+        int nearAxis = 0, farAxis = 0;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float inv = 1.0f / d[axis];
+            float t1 = (lo[axis] - o[axis]) * inv;
+            float t2 = (hi[axis] - o[axis]) * inv;
+            if (t1 > t2)
+                std::swap(t1, t2);
+            if (t1 > tNear)
+            {
+                tNear = t1;
+                nearAxis = axis;
+            }
+            if (t2 < tFar)
+            {
+                tFar = t2;
+                farAxis = axis;
+            }
+        }
+
+        if (tNear > tFar)
+            return HitResult();
+
+        // from inside the box the ray leaves through the far side
+        float t = tNear;
+        int axis = nearAxis;
+        bool exiting = false;
+        if (!(t < maxDist && t > minDist))
+        {
+            t = tFar;
+            axis = farAxis;
+            exiting = true;
+        }
+        if (!(t < maxDist && t > minDist))
+            return HitResult();
+
+        HitResult hit;
+        hit.p = ray.PointAt(t);
+        // outward normal of the face on that axis, whichever side of the box it is on
+        float side[3] = { 0, 0, 0 };
+        side[axis] = d[axis] < 0 ? 1.0f : -1.0f;
+        if (exiting)
+            side[axis] = -side[axis];
+        hit.normal = vec3(side[0], side[1], side[2]);
+        hit.t = t;
+        hit.object = this;
+        return hit;
+    }
+};
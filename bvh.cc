@@ -0,0 +1,1234 @@
+#include "bvh.h"
+#include <numeric>
+#include "morton.h"
+
+// relative costs used by the surface area heuristic
+static constexpr float TraversalCost = 1.0f;
+static constexpr float IntersectionCost = 1.0f;
+
+//------------------------------------------------------------------------------
+/**
+    Data shared by all the Subdivide calls of a build.
+    Every subtree works on its own range of indices so they can run in parallel.
+*/
+struct BVH::BuildContext
+{
+    std::vector<AABB> const& primitiveBounds;
+    std::vector<vec3> centroids;
+    uint32_t* indices;
+    // area of the boxes to the right of every candidate split position, only used by the sweep builder
+    std::vector<float> rightAreas;
+    // Morton code of every entry in indices, in the same order. Only used by the linear builder, which needs no centroids
+    std::vector<uint32_t> mortonCodes;
+};
+
+//------------------------------------------------------------------------------
+/**
+    A node left as a leaf by the top of the binned build, finished later as a separate task
+*/
+struct BVH::BuildTask
+{
+    uint32_t nodeIndex;
+    uint32_t depth;
+};
+
+//------------------------------------------------------------------------------
+/**
+    A primitive, or the part of one, that a node of the spatial split build
+    holds. A primitive starts out as one reference and gets one more every
+    time a spatial split cuts through it, each with the bounds of its piece.
+*/
+struct BVH::SpatialReference
+{
+    AABB bounds;
+    uint32_t primitive;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Data shared by all the SubdivideSpatial calls of a build
+*/
+struct BVH::SpatialContext
+{
+    // leaves append their references here, this becomes primitiveIndices
+    std::vector<uint32_t> indices;
+    float rootArea;
+    // how many more references spatial splits may still add
+    size_t splitBudget;
+    PrimitiveClipper const& clipPrimitive;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Run the tasks with the runner if there is one, otherwise one after another
+*/
+static void
+RunAll(std::vector<std::function<void()>>& tasks, TaskRunner const& runTasks)
+{
+    if (runTasks)
+        runTasks(tasks);
+    else
+        for (auto& task : tasks)
+            task();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static float
+Axis(vec3 const& v, int axis)
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static void
+SetAxis(vec3& v, int axis, float value)
+{
+    if (axis == 0)
+        v.x = value;
+    else if (axis == 1)
+        v.y = value;
+    else
+        v.z = value;
+}
+
+//------------------------------------------------------------------------------
+/**
+    The part of bounds between lo and hi on one axis. Never empty, a box
+    that only touches the slab because of rounding comes back flat.
+*/
+static AABB
+ClipToSlab(AABB const& bounds, int axis, float lo, float hi)
+{
+    AABB clipped = bounds;
+    float bmin = Axis(bounds.min, axis);
+    float bmax = Axis(bounds.max, axis);
+    SetAxis(clipped.min, axis, std::min(std::max(bmin, lo), bmax));
+    SetAxis(clipped.max, axis, std::max(std::min(bmax, hi), bmin));
+    return clipped;
+}
+
+//------------------------------------------------------------------------------
+/**
+    The part of a spatial split reference between lo and hi, clipped to the
+    primitive itself if there is a clipper. Can be empty then.
+*/
+static AABB
+ClipReference(AABB const& bounds, uint32_t primitive, int axis, float lo, float hi, PrimitiveClipper const& clipPrimitive)
+{
+    AABB clipped = ClipToSlab(bounds, axis, lo, hi);
+    return clipPrimitive ? clipPrimitive(primitive, clipped) : clipped;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static AABB
+NodeBounds(BVHNode const& node)
+{
+    AABB bounds;
+    bounds.min = { node.bmin[0], node.bmin[1], node.bmin[2] };
+    bounds.max = { node.bmax[0], node.bmax[1], node.bmax[2] };
+    return bounds;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static void
+UpdateNodeBounds(BVHNode& node, std::vector<AABB> const& primitiveBounds, uint32_t const* indices)
+{
+    AABB bounds;
+    for (uint32_t i = 0; i < node.count; i++)
+        bounds.Grow(primitiveBounds[indices[node.leftFirst + i]]);
+
+    node.bmin[0] = bounds.min.x; node.bmin[1] = bounds.min.y; node.bmin[2] = bounds.min.z;
+    node.bmax[0] = bounds.max.x; node.bmax[1] = bounds.max.y; node.bmax[2] = bounds.max.z;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Sort indices by the Morton code of the primitive centroids, codes gets the
+    sorted codes. Every step works on chunks of the primitives that run as
+    tasks: centroid bounds, codes, and three passes of a radix sort of 10 bits
+    each. The passes are stable, so the result doesn't depend on the chunks.
+*/
+static void
+SortByMortonCode(std::vector<AABB> const& primitiveBounds, std::vector<uint32_t>& indices, std::vector<uint32_t>& codes, TaskRunner const& runTasks)
+{
+    constexpr uint32_t RadixBits = 10;
+    constexpr uint32_t NumBuckets = 1 << RadixBits;
+    constexpr uint32_t MinChunkSize = 16384;
+
+    uint32_t count = uint32_t(primitiveBounds.size());
+    uint32_t numChunks = runTasks ? std::min(std::max(count / MinChunkSize, 1u), 64u) : 1;
+    uint32_t chunkSize = (count + numChunks - 1) / numChunks;
+    auto forEachChunk = [&](auto&& function)
+    {
+        std::vector<std::function<void()>> tasks;
+        for (uint32_t chunk = 0; chunk < numChunks; chunk++)
+        {
+            uint32_t begin = std::min(chunk * chunkSize, count), end = std::min(begin + chunkSize, count);
+            tasks.push_back([&function, chunk, begin, end]() { function(chunk, begin, end); });
+        }
+        RunAll(tasks, runTasks);
+    };
+
+    std::vector<AABB> chunkBounds(numChunks);
+    forEachChunk([&](uint32_t chunk, uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; i++)
+            chunkBounds[chunk].Grow(primitiveBounds[i].Centroid());
+    });
+    AABB centroidBounds;
+    for (AABB const& bounds : chunkBounds)
+        centroidBounds.Grow(bounds);
+
+    codes.resize(count);
+    forEachChunk([&](uint32_t, uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; i++)
+            codes[i] = MortonCode(primitiveBounds[i].Centroid(), centroidBounds);
+    });
+
+    std::vector<uint32_t> codesOut(count), indicesOut(count);
+    std::vector<uint32_t> offsets(size_t(numChunks) * NumBuckets);
+    for (uint32_t shift = 0; shift < 30; shift += RadixBits)
+    {
+        forEachChunk([&](uint32_t chunk, uint32_t begin, uint32_t end)
+        {
+            uint32_t* histogram = &offsets[size_t(chunk) * NumBuckets];
+            std::fill(histogram, histogram + NumBuckets, 0u);
+            for (uint32_t i = begin; i < end; i++)
+                histogram[(codes[i] >> shift) & (NumBuckets - 1)]++;
+        });
+
+        // bucket by bucket, and within a bucket chunk by chunk, keeps the order of equal digits
+        uint32_t sum = 0;
+        for (uint32_t bucket = 0; bucket < NumBuckets; bucket++)
+        {
+            for (uint32_t chunk = 0; chunk < numChunks; chunk++)
+            {
+                uint32_t& offset = offsets[size_t(chunk) * NumBuckets + bucket];
+                uint32_t bucketCount = offset;
+                offset = sum;
+                sum += bucketCount;
+            }
+        }
+
+        forEachChunk([&](uint32_t chunk, uint32_t begin, uint32_t end)
+        {
+            uint32_t* offset = &offsets[size_t(chunk) * NumBuckets];
+            for (uint32_t i = begin; i < end; i++)
+            {
+                uint32_t destination = offset[(codes[i] >> shift) & (NumBuckets - 1)]++;
+                codesOut[destination] = codes[i];
+                indicesOut[destination] = indices[i];
+            }
+        });
+        codes.swap(codesOut);
+        indices.swap(indicesOut);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BVH::Build(std::vector<AABB> const& primitiveBounds, BVHBuilder builder, TaskRunner const& runTasks, PrimitiveClipper const& clipPrimitive)
+{
+    this->Clear();
+
+    uint32_t count = uint32_t(primitiveBounds.size());
+    if (count == 0)
+        return;
+
+    if (builder == BVHBuilder::SpatialSAH)
+    {
+        // splitting references changes how many there are all the time, which doesn't fit
+        // the index ranges the other builders share between tasks, so this one runs on its own
+        std::vector<SpatialReference> references(count);
+        for (uint32_t i = 0; i < count; i++)
+            references[i] = { primitiveBounds[i], i };
+
+        AABB rootBounds;
+        for (AABB const& bounds : primitiveBounds)
+            rootBounds.Grow(bounds);
+
+        SpatialContext context = { {}, rootBounds.HalfArea(), size_t(count * SpatialSplitBudget), clipPrimitive };
+        context.indices.reserve(count + context.splitBudget);
+
+        std::vector<BVHNode> nodes;
+        nodes.reserve(size_t(count) * 2);
+        nodes.emplace_back();
+        SubdivideSpatial(nodes, 0, references, 0, context);
+        this->nodes.Assign(std::move(nodes));
+        this->primitiveIndices.Assign(std::move(context.indices));
+        return;
+    }
+
+    // built in vectors of our own, the members might be pointing into a mapped cache file
+    std::vector<uint32_t> indices(count);
+    std::iota(indices.begin(), indices.end(), 0);
+    std::vector<BVHNode> nodes;
+
+    BuildContext context = { primitiveBounds, {}, nullptr, {}, {} };
+    if (builder == BVHBuilder::Linear)
+    {
+        SortByMortonCode(primitiveBounds, indices, context.mortonCodes, runTasks);
+    }
+    else
+    {
+        context.centroids.reserve(count);
+        for (AABB const& bounds : primitiveBounds)
+            context.centroids.push_back(bounds.Centroid());
+    }
+    context.indices = indices.data();
+
+    // a binary tree with n leaves never has more than 2n - 1 nodes
+    nodes.reserve(size_t(count) * 2);
+
+    BVHNode root;
+    root.leftFirst = 0;
+    root.count = count;
+    UpdateNodeBounds(root, primitiveBounds, context.indices);
+    nodes.push_back(root);
+
+    if (builder == BVHBuilder::SweepSAH)
+    {
+        context.rightAreas.resize(count);
+        Subdivide(nodes, 0, 0, context);
+        this->nodes.Assign(std::move(nodes));
+        this->primitiveIndices.Assign(std::move(indices));
+        return;
+    }
+
+    // split the top of the tree here until the subtrees are small enough to hand out as tasks
+    auto subdivide = builder == BVHBuilder::Linear ? &BVH::SubdivideLinear : &BVH::SubdivideBinned;
+    uint32_t taskSize = runTasks ? std::max(count / 64, MinTaskSize) : UINT32_MAX;
+    std::vector<BuildTask> pending;
+    subdivide(nodes, 0, 0, context, taskSize, &pending);
+
+    // every task builds into its own node list, so there is no shared state to lock
+    std::vector<std::vector<BVHNode>> subtrees(pending.size());
+    std::vector<std::function<void()>> tasks;
+    tasks.reserve(pending.size());
+    for (size_t i = 0; i < pending.size(); i++)
+    {
+        tasks.push_back([i, subdivide, &nodes, &pending, &subtrees, &context]()
+        {
+            std::vector<BVHNode>& subtree = subtrees[i];
+            subtree.reserve(size_t(nodes[pending[i].nodeIndex].count) * 2);
+            subtree.push_back(nodes[pending[i].nodeIndex]);
+            subdivide(subtree, 0, pending[i].depth, context, UINT32_MAX, nullptr);
+        });
+    }
+    RunAll(tasks, runTasks);
+
+    // stitch the subtrees in, the local root replaces the placeholder leaf and the rest is appended
+    for (size_t i = 0; i < pending.size(); i++)
+    {
+        std::vector<BVHNode> const& subtree = subtrees[i];
+        uint32_t offset = uint32_t(nodes.size()) - 1;
+
+        BVHNode root = subtree[0];
+        if (!root.IsLeaf())
+            root.leftFirst += offset;
+        nodes[pending[i].nodeIndex] = root;
+
+        for (size_t k = 1; k < subtree.size(); k++)
+        {
+            BVHNode node = subtree[k];
+            if (!node.IsLeaf())
+                node.leftFirst += offset;
+            nodes.push_back(node);
+        }
+    }
+
+    this->nodes.Assign(std::move(nodes));
+    this->primitiveIndices.Assign(std::move(indices));
+
+    // the linear builder only decides the shape of the tree, the boxes are filled in bottom up in one go
+    if (builder == BVHBuilder::Linear)
+        this->Refit(primitiveBounds, runTasks);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BVH::Clear()
+{
+    this->nodes.clear();
+    this->primitiveIndices.clear();
+}
+
+//------------------------------------------------------------------------------
+/**
+    Leaves take the bounds of their primitives, interior nodes the union of
+    their children, which have to be up to date already.
+*/
+void
+BVH::RefitNode(uint32_t nodeIndex, std::vector<AABB> const& primitiveBounds)
+{
+    BVHNode& node = this->nodes[nodeIndex];
+    if (node.IsLeaf())
+    {
+        UpdateNodeBounds(node, primitiveBounds, this->primitiveIndices.data());
+        return;
+    }
+
+    BVHNode const& left = this->nodes[node.leftFirst];
+    BVHNode const& right = this->nodes[node.leftFirst + 1];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        node.bmin[axis] = std::min(left.bmin[axis], right.bmin[axis]);
+        node.bmax[axis] = std::max(left.bmax[axis], right.bmax[axis]);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BVH::RefitSubtree(uint32_t nodeIndex, std::vector<AABB> const& primitiveBounds)
+{
+    BVHNode const& node = this->nodes[nodeIndex];
+    if (!node.IsLeaf())
+    {
+        this->RefitSubtree(node.leftFirst, primitiveBounds);
+        this->RefitSubtree(node.leftFirst + 1, primitiveBounds);
+    }
+    this->RefitNode(nodeIndex, primitiveBounds);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Both builders only ever append children after their parent, so walking
+    the node list backwards visits every child before its parent. With a task
+    runner the top levels are cut off instead, the subtrees below them are
+    refit as tasks and the few nodes on top afterwards.
+*/
+void
+BVH::Refit(std::vector<AABB> const& primitiveBounds, TaskRunner const& runTasks)
+{
+    if (this->nodes.empty())
+        return;
+
+    if (!runTasks || this->primitiveIndices.size() < MinTaskSize)
+    {
+        for (size_t i = this->nodes.size(); i-- > 0;)
+            this->RefitNode(uint32_t(i), primitiveBounds);
+        return;
+    }
+
+    // breadth first, so going through top backwards later is bottom up as well
+    std::vector<uint32_t> top;
+    std::vector<uint32_t> subtrees = { 0 };
+    while (subtrees.size() < 64)
+    {
+        std::vector<uint32_t> next;
+        for (uint32_t index : subtrees)
+        {
+            BVHNode const& node = this->nodes[index];
+            if (node.IsLeaf())
+            {
+                next.push_back(index);
+                continue;
+            }
+            top.push_back(index);
+            next.push_back(node.leftFirst);
+            next.push_back(node.leftFirst + 1);
+        }
+        if (next.size() == subtrees.size())
+            break;
+        subtrees.swap(next);
+    }
+
+    std::vector<std::function<void()>> tasks;
+    tasks.reserve(subtrees.size());
+    for (uint32_t index : subtrees)
+        tasks.push_back([this, index, &primitiveBounds]() { this->RefitSubtree(index, primitiveBounds); });
+    runTasks(tasks);
+
+    for (size_t i = top.size(); i-- > 0;)
+        this->RefitNode(top[i], primitiveBounds);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Sum of the node costs weighted by the chance of a ray through the root
+    also hitting the node, which is the ratio of their surface areas.
+*/
+float
+BVH::SAHCost() const
+{
+    if (this->nodes.empty())
+        return 0.0f;
+
+    float rootArea = NodeBounds(this->nodes[0]).HalfArea();
+    if (rootArea <= 0.0f)
+        return 0.0f;
+
+    double cost = 0.0;
+    for (BVHNode const& node : this->nodes)
+    {
+        float area = NodeBounds(node).HalfArea();
+        cost += area * (node.IsLeaf() ? IntersectionCost * node.count : TraversalCost);
+    }
+    return float(cost / rootArea);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Children always go in as a pair, since the right one is found at
+    leftFirst + 1. Either way the children end up after their parent, which
+    Refit relies on. Leaves are pointed at their primitives afterwards, in the
+    order they are in now, so the sphere and triangle packs that are filled
+    from primitiveIndices follow the node order too.
+*/
+void
+BVH::Reorder(BVHLayout layout)
+{
+    if (this->nodes.empty() || layout == BVHLayout::BuildOrder)
+        return;
+
+    std::vector<BVHNode> nodes;
+    nodes.reserve(this->nodes.size());
+    nodes.push_back(this->nodes[0]);
+
+    if (layout == BVHLayout::DepthFirst)
+    {
+        this->AppendDepthFirst(nodes, 0, 0);
+    }
+    else
+    {
+        // a ray that hits a node hits a child with a probability proportional to its area,
+        // so the largest nodes are the ones most worth having in the same page as their parent
+        struct Candidate
+        {
+            float area;
+            uint32_t oldIndex;
+            uint32_t newIndex;
+            bool operator<(Candidate const& other) const { return area < other.area; }
+        };
+
+        std::vector<Candidate> treeletRoots;
+        if (!this->nodes[0].IsLeaf())
+            treeletRoots.push_back({ 0.0f, 0, 0 });
+
+        std::vector<Candidate> candidates;
+        while (!treeletRoots.empty())
+        {
+            candidates.assign(1, treeletRoots.back());
+            treeletRoots.pop_back();
+
+            for (uint32_t pairs = 0; pairs < TreeletPairs && !candidates.empty(); pairs++)
+            {
+                std::pop_heap(candidates.begin(), candidates.end());
+                Candidate node = candidates.back();
+                candidates.pop_back();
+
+                uint32_t oldLeft = this->nodes[node.oldIndex].leftFirst;
+                uint32_t newLeft = uint32_t(nodes.size());
+                nodes[node.newIndex].leftFirst = newLeft;
+                for (uint32_t child = 0; child < 2; child++)
+                {
+                    nodes.push_back(this->nodes[oldLeft + child]);
+                    if (nodes.back().IsLeaf())
+                        continue;
+                    candidates.push_back({ NodeBounds(nodes.back()).HalfArea(), oldLeft + child, newLeft + child });
+                    std::push_heap(candidates.begin(), candidates.end());
+                }
+            }
+
+            // whatever didn't fit starts a treelet of its own, the largest one first so it lands closest
+            std::sort(candidates.begin(), candidates.end());
+            treeletRoots.insert(treeletRoots.end(), candidates.begin(), candidates.end());
+        }
+    }
+
+    std::vector<uint32_t> indices;
+    indices.reserve(this->primitiveIndices.size());
+    for (BVHNode& node : nodes)
+    {
+        if (!node.IsLeaf())
+            continue;
+        uint32_t first = uint32_t(indices.size());
+        indices.insert(indices.end(), this->primitiveIndices.begin() + node.leftFirst, this->primitiveIndices.begin() + node.leftFirst + node.count);
+        node.leftFirst = first;
+    }
+
+    this->nodes.Assign(std::move(nodes));
+    this->primitiveIndices.Assign(std::move(indices));
+}
+
+//------------------------------------------------------------------------------
+/**
+    Append the children of the node at oldIndex, which is already in nodes at
+    newIndex, and then their subtrees. The child with the larger area is more
+    likely to be visited, so it goes left and its subtree comes first.
+*/
+void
+BVH::AppendDepthFirst(std::vector<BVHNode>& nodes, uint32_t oldIndex, uint32_t newIndex) const
+{
+    BVHNode const& node = this->nodes[oldIndex];
+    if (node.IsLeaf())
+        return;
+
+    uint32_t first = node.leftFirst;
+    uint32_t second = node.leftFirst + 1;
+    if (NodeBounds(this->nodes[second]).HalfArea() > NodeBounds(this->nodes[first]).HalfArea())
+        std::swap(first, second);
+
+    uint32_t newLeft = uint32_t(nodes.size());
+    nodes[newIndex].leftFirst = newLeft;
+    nodes.push_back(this->nodes[first]);
+    nodes.push_back(this->nodes[second]);
+    this->AppendDepthFirst(nodes, first, newLeft);
+    this->AppendDepthFirst(nodes, second, newLeft + 1);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Turn a leaf into an interior node with two children, the first split
+    primitives in its range go to the left child.
+*/
+void
+BVH::SplitNode(std::vector<BVHNode>& nodes, uint32_t nodeIndex, uint32_t split, BuildContext& context)
+{
+    uint32_t first = nodes[nodeIndex].leftFirst;
+    uint32_t count = nodes[nodeIndex].count;
+
+    BVHNode left;
+    left.leftFirst = first;
+    left.count = split;
+    UpdateNodeBounds(left, context.primitiveBounds, context.indices);
+    BVHNode right;
+    right.leftFirst = first + split;
+    right.count = count - split;
+    UpdateNodeBounds(right, context.primitiveBounds, context.indices);
+
+    nodes[nodeIndex].leftFirst = uint32_t(nodes.size());
+    nodes[nodeIndex].count = 0;
+    nodes.push_back(left);
+    nodes.push_back(right);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Halve the range along the widest centroid axis, used when the SAH can't help.
+    Returns the split position.
+*/
+static uint32_t
+MedianSplit(uint32_t* indices, uint32_t count, AABB const& centroidBounds, std::vector<vec3> const& centroids)
+{
+    vec3 extent = { centroidBounds.max.x - centroidBounds.min.x,
+                    centroidBounds.max.y - centroidBounds.min.y,
+                    centroidBounds.max.z - centroidBounds.min.z };
+    int axis = extent.x > extent.y && extent.x > extent.z ? 0 : (extent.y > extent.z ? 1 : 2);
+    uint32_t split = count / 2;
+    std::nth_element(indices, indices + split, indices + count, [&centroids, axis](uint32_t a, uint32_t b)
+    {
+        return Axis(centroids[a], axis) < Axis(centroids[b], axis);
+    });
+    return split;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Sweep every sorted split position along all three axes and pick the one
+    with the lowest SAH cost. Falls back to a median split when the centroids
+    are degenerate or the tree is getting too deep.
+*/
+void
+BVH::Subdivide(std::vector<BVHNode>& nodes, uint32_t nodeIndex, uint32_t depth, BuildContext& context)
+{
+    uint32_t first = nodes[nodeIndex].leftFirst;
+    uint32_t count = nodes[nodeIndex].count;
+    if (count <= 1)
+        return;
+
+    uint32_t* indices = context.indices + first;
+    std::vector<vec3> const& centroids = context.centroids;
+
+    AABB centroidBounds;
+    for (uint32_t i = 0; i < count; i++)
+        centroidBounds.Grow(centroids[indices[i]]);
+
+    float parentArea = NodeBounds(nodes[nodeIndex]).HalfArea();
+
+    int bestAxis = -1;
+    uint32_t bestSplit = 0;
+    float bestCost = FLT_MAX;
+    int sortedAxis = -1;
+
+    for (int axis = 0; axis < 3 && depth < MaxSAHDepth; axis++)
+    {
+        if (Axis(centroidBounds.min, axis) == Axis(centroidBounds.max, axis))
+            continue;
+
+        std::sort(indices, indices + count, [&centroids, axis](uint32_t a, uint32_t b)
+        {
+            return Axis(centroids[a], axis) < Axis(centroids[b], axis);
+        });
+        sortedAxis = axis;
+
+        AABB right;
+        for (uint32_t i = count - 1; i > 0; i--)
+        {
+            right.Grow(context.primitiveBounds[indices[i]]);
+            context.rightAreas[i] = right.HalfArea();
+        }
+
+        AABB left;
+        for (uint32_t i = 1; i < count; i++)
+        {
+            left.Grow(context.primitiveBounds[indices[i - 1]]);
+            float cost = left.HalfArea() * i + context.rightAreas[i] * (count - i);
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i;
+            }
+        }
+    }
+
+    if (bestAxis != -1)
+    {
+        float splitCost = TraversalCost + IntersectionCost * bestCost / parentArea;
+        float leafCost = IntersectionCost * count;
+        if (splitCost >= leafCost && count <= MaxLeafSize)
+            return;
+
+        // the range is still sorted along the last swept axis, resort if another axis won
+        if (bestAxis != sortedAxis)
+        {
+            std::sort(indices, indices + count, [&centroids, bestAxis](uint32_t a, uint32_t b)
+            {
+                return Axis(centroids[a], bestAxis) < Axis(centroids[b], bestAxis);
+            });
+        }
+    }
+    else
+    {
+        if (count <= MaxLeafSize)
+            return;
+        bestSplit = MedianSplit(indices, count, centroidBounds, centroids);
+    }
+
+    SplitNode(nodes, nodeIndex, bestSplit, context);
+    uint32_t leftIndex = nodes[nodeIndex].leftFirst;
+    Subdivide(nodes, leftIndex, depth + 1, context);
+    Subdivide(nodes, leftIndex + 1, depth + 1, context);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Evaluate the SAH at NumBins evenly spaced planes per axis instead of at
+    every primitive, which only needs a single pass over the range.
+    Nodes with at most taskSize primitives are pushed to tasks instead of being
+    split further, when tasks is null everything is built here.
+*/
+void
+BVH::SubdivideBinned(std::vector<BVHNode>& nodes, uint32_t nodeIndex, uint32_t depth, BuildContext& context, uint32_t taskSize, std::vector<BuildTask>* tasks)
+{
+    uint32_t first = nodes[nodeIndex].leftFirst;
+    uint32_t count = nodes[nodeIndex].count;
+    if (count <= 1)
+        return;
+
+    if (tasks && count <= taskSize)
+    {
+        tasks->push_back({ nodeIndex, depth });
+        return;
+    }
+
+    uint32_t* indices = context.indices + first;
+    std::vector<vec3> const& centroids = context.centroids;
+
+    AABB centroidBounds;
+    for (uint32_t i = 0; i < count; i++)
+        centroidBounds.Grow(centroids[indices[i]]);
+
+    float parentArea = NodeBounds(nodes[nodeIndex]).HalfArea();
+
+    int bestAxis = -1;
+    uint32_t bestBin = 0;
+    float bestCost = FLT_MAX;
+
+    struct Bin
+    {
+        AABB bounds;
+        uint32_t count = 0;
+    } bins[3][NumBins];
+
+    // bin along all three axes in a single pass over the primitives
+    float axisMin[3], scale[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        axisMin[axis] = Axis(centroidBounds.min, axis);
+        float extent = Axis(centroidBounds.max, axis) - axisMin[axis];
+        scale[axis] = extent > 0 ? NumBins / extent : 0.0f;
+    }
+
+    if (depth < MaxSAHDepth)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            vec3 const& centroid = centroids[indices[i]];
+            AABB const& bounds = context.primitiveBounds[indices[i]];
+            for (int axis = 0; axis < 3; axis++)
+            {
+                uint32_t b = std::min(NumBins - 1, uint32_t((Axis(centroid, axis) - axisMin[axis]) * scale[axis]));
+                bins[axis][b].count++;
+                bins[axis][b].bounds.Grow(bounds);
+            }
+        }
+    }
+
+    for (int axis = 0; axis < 3 && depth < MaxSAHDepth; axis++)
+    {
+        if (scale[axis] == 0.0f)
+            continue;
+
+        float rightAreas[NumBins];
+        uint32_t rightCounts[NumBins];
+        AABB right;
+        uint32_t rightCount = 0;
+        for (uint32_t b = NumBins - 1; b > 0; b--)
+        {
+            right.Grow(bins[axis][b].bounds);
+            rightCount += bins[axis][b].count;
+            rightAreas[b] = right.HalfArea();
+            rightCounts[b] = rightCount;
+        }
+
+        AABB left;
+        uint32_t leftCount = 0;
+        for (uint32_t b = 1; b < NumBins; b++)
+        {
+            left.Grow(bins[axis][b - 1].bounds);
+            leftCount += bins[axis][b - 1].count;
+            if (leftCount == 0 || rightCounts[b] == 0)
+                continue;
+
+            float cost = left.HalfArea() * leftCount + rightAreas[b] * rightCounts[b];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = b;
+            }
+        }
+    }
+
+    uint32_t split = 0;
+    if (bestAxis != -1)
+    {
+        float splitCost = TraversalCost + IntersectionCost * bestCost / parentArea;
+        float leafCost = IntersectionCost * count;
+        if (splitCost >= leafCost && count <= MaxLeafSize)
+            return;
+
+        float binMin = axisMin[bestAxis];
+        float binScale = scale[bestAxis];
+        uint32_t* mid = std::partition(indices, indices + count, [&centroids, bestAxis, bestBin, binMin, binScale](uint32_t i)
+        {
+            return std::min(NumBins - 1, uint32_t((Axis(centroids[i], bestAxis) - binMin) * binScale)) < bestBin;
+        });
+        split = uint32_t(mid - indices);
+    }
+    else if (count <= MaxLeafSize)
+    {
+        return;
+    }
+
+    if (bestAxis == -1 || split == 0 || split == count)
+        split = MedianSplit(indices, count, centroidBounds, centroids);
+
+    SplitNode(nodes, nodeIndex, split, context);
+    uint32_t leftIndex = nodes[nodeIndex].leftFirst;
+    SubdivideBinned(nodes, leftIndex, depth + 1, context, taskSize, tasks);
+    SubdivideBinned(nodes, leftIndex + 1, depth + 1, context, taskSize, tasks);
+}
+
+//------------------------------------------------------------------------------
+/**
+    The codes in the range are sorted, so they all share the bits above the
+    highest one where the first and the last code differ. The left child gets
+    everything before the first code with that bit set. Only the shape of the
+    tree is built here, Build fills in the bounds afterwards.
+*/
+void
+BVH::SubdivideLinear(std::vector<BVHNode>& nodes, uint32_t nodeIndex, uint32_t depth, BuildContext& context, uint32_t taskSize, std::vector<BuildTask>* tasks)
+{
+    uint32_t first = nodes[nodeIndex].leftFirst;
+    uint32_t count = nodes[nodeIndex].count;
+    if (count <= MaxLeafSize)
+        return;
+
+    if (tasks && count <= taskSize)
+    {
+        tasks->push_back({ nodeIndex, depth });
+        return;
+    }
+
+    uint32_t const* codes = context.mortonCodes.data() + first;
+    uint32_t differing = codes[0] ^ codes[count - 1];
+    uint32_t split = count / 2;
+    if (differing != 0)
+    {
+        uint32_t bit = 1u << 31;
+        while (!(differing & bit))
+            bit >>= 1;
+        split = uint32_t(std::partition_point(codes, codes + count, [bit](uint32_t code) { return (code & bit) == 0; }) - codes);
+    }
+
+    BVHNode left;
+    left.leftFirst = first;
+    left.count = split;
+    BVHNode right;
+    right.leftFirst = first + split;
+    right.count = count - split;
+
+    uint32_t leftIndex = uint32_t(nodes.size());
+    nodes[nodeIndex].leftFirst = leftIndex;
+    nodes[nodeIndex].count = 0;
+    nodes.push_back(left);
+    nodes.push_back(right);
+
+    SubdivideLinear(nodes, leftIndex, depth + 1, context, taskSize, tasks);
+    SubdivideLinear(nodes, leftIndex + 1, depth + 1, context, taskSize, tasks);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Binned SAH over the reference centroids like SubdivideBinned, plus the
+    spatial splits of Stich et al., which cut the node's box with a plane and
+    clip the references that straddle it into both children. Spatial splits
+    are only tried where the children of the best object split overlap
+    noticeably, since that is the only place they can win, and only while the
+    reference budget lasts. A straddling reference still goes to just one
+    side when that is cheaper than splitting it.
+*/
+void
+BVH::SubdivideSpatial(std::vector<BVHNode>& nodes, uint32_t nodeIndex, std::vector<SpatialReference>& references, uint32_t depth, SpatialContext& context)
+{
+    uint32_t count = uint32_t(references.size());
+
+    AABB nodeBounds, centroidBounds;
+    for (SpatialReference const& reference : references)
+    {
+        nodeBounds.Grow(reference.bounds);
+        centroidBounds.Grow(reference.bounds.Centroid());
+    }
+    BVHNode& node = nodes[nodeIndex];
+    node.bmin[0] = nodeBounds.min.x; node.bmin[1] = nodeBounds.min.y; node.bmin[2] = nodeBounds.min.z;
+    node.bmax[0] = nodeBounds.max.x; node.bmax[1] = nodeBounds.max.y; node.bmax[2] = nodeBounds.max.z;
+
+    auto makeLeaf = [&nodes, nodeIndex, count, &references, &context]()
+    {
+        nodes[nodeIndex].leftFirst = uint32_t(context.indices.size());
+        nodes[nodeIndex].count = count;
+        for (SpatialReference const& reference : references)
+            context.indices.push_back(reference.primitive);
+    };
+
+    if (count <= 1)
+    {
+        makeLeaf();
+        return;
+    }
+
+    float parentArea = nodeBounds.HalfArea();
+
+    // object split, the same binning as SubdivideBinned but keeping the boxes of the best split
+    int objectAxis = -1;
+    uint32_t objectBin = 0;
+    float objectCost = FLT_MAX;
+    AABB objectLeft, objectRight;
+
+    float axisMin[3], scale[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        axisMin[axis] = Axis(centroidBounds.min, axis);
+        float extent = Axis(centroidBounds.max, axis) - axisMin[axis];
+        scale[axis] = extent > 0 ? NumBins / extent : 0.0f;
+    }
+    auto centroidBin = [&axisMin, &scale](SpatialReference const& reference, int axis)
+    {
+        return std::min(NumBins - 1, uint32_t((Axis(reference.bounds.Centroid(), axis) - axisMin[axis]) * scale[axis]));
+    };
+
+    for (int axis = 0; axis < 3 && depth < MaxSAHDepth; axis++)
+    {
+        if (scale[axis] == 0.0f)
+            continue;
+
+        struct Bin
+        {
+            AABB bounds;
+            uint32_t count = 0;
+        } bins[NumBins];
+        for (SpatialReference const& reference : references)
+        {
+            Bin& bin = bins[centroidBin(reference, axis)];
+            bin.count++;
+            bin.bounds.Grow(reference.bounds);
+        }
+
+        AABB rightBounds[NumBins];
+        uint32_t rightCounts[NumBins];
+        AABB right;
+        uint32_t rightCount = 0;
+        for (uint32_t b = NumBins - 1; b > 0; b--)
+        {
+            right.Grow(bins[b].bounds);
+            rightCount += bins[b].count;
+            rightBounds[b] = right;
+            rightCounts[b] = rightCount;
+        }
+
+        AABB left;
+        uint32_t leftCount = 0;
+        for (uint32_t b = 1; b < NumBins; b++)
+        {
+            left.Grow(bins[b - 1].bounds);
+            leftCount += bins[b - 1].count;
+            if (leftCount == 0 || rightCounts[b] == 0)
+                continue;
+
+            float cost = left.HalfArea() * leftCount + rightBounds[b].HalfArea() * rightCounts[b];
+            if (cost < objectCost)
+            {
+                objectCost = cost;
+                objectAxis = axis;
+                objectBin = b;
+                objectLeft = left;
+                objectRight = rightBounds[b];
+            }
+        }
+    }
+
+    // spatial split, planes at NumBins even steps over the node's box. A reference counts
+    // as entering the bin its minimum is in and leaving the one its maximum is in
+    int spatialAxis = -1;
+    uint32_t spatialBin = 0;
+    float spatialCost = FLT_MAX;
+    AABB spatialLeft, spatialRight;
+    uint32_t spatialLeftCount = 0, spatialRightCount = 0;
+
+    float nodeMin[3], binWidth[3], binScale[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        nodeMin[axis] = Axis(nodeBounds.min, axis);
+        float extent = Axis(nodeBounds.max, axis) - nodeMin[axis];
+        binWidth[axis] = extent / NumBins;
+        binScale[axis] = extent > 0 ? NumBins / extent : 0.0f;
+    }
+    auto spatialBinOf = [&nodeMin, &binScale](float value, int axis)
+    {
+        return std::min(NumBins - 1, uint32_t(std::max(value - nodeMin[axis], 0.0f) * binScale[axis]));
+    };
+
+    AABB overlap;
+    overlap.min = { std::max(objectLeft.min.x, objectRight.min.x), std::max(objectLeft.min.y, objectRight.min.y), std::max(objectLeft.min.z, objectRight.min.z) };
+    overlap.max = { std::min(objectLeft.max.x, objectRight.max.x), std::min(objectLeft.max.y, objectRight.max.y), std::min(objectLeft.max.z, objectRight.max.z) };
+    bool trySpatial = objectAxis != -1 && context.splitBudget > 0 && overlap.HalfArea() > SpatialSplitOverlap * context.rootArea;
+
+    for (int axis = 0; axis < 3 && trySpatial; axis++)
+    {
+        if (binScale[axis] == 0.0f)
+            continue;
+
+        struct Bin
+        {
+            AABB bounds;
+            uint32_t entries = 0;
+            uint32_t exits = 0;
+        } bins[NumBins];
+        for (SpatialReference const& reference : references)
+        {
+            uint32_t firstBin = spatialBinOf(Axis(reference.bounds.min, axis), axis);
+            uint32_t lastBin = spatialBinOf(Axis(reference.bounds.max, axis), axis);
+            bins[firstBin].entries++;
+            bins[lastBin].exits++;
+            for (uint32_t b = firstBin; b <= lastBin; b++)
+            {
+                float lo = b == firstBin ? -FLT_MAX : nodeMin[axis] + binWidth[axis] * b;
+                float hi = b == lastBin ? FLT_MAX : nodeMin[axis] + binWidth[axis] * (b + 1);
+                AABB clipped = ClipReference(reference.bounds, reference.primitive, axis, lo, hi, context.clipPrimitive);
+                if (!clipped.IsEmpty())
+                    bins[b].bounds.Grow(clipped);
+            }
+        }
+
+        AABB rightBounds[NumBins];
+        uint32_t rightCounts[NumBins];
+        AABB right;
+        uint32_t rightCount = 0;
+        for (uint32_t b = NumBins - 1; b > 0; b--)
+        {
+            right.Grow(bins[b].bounds);
+            rightCount += bins[b].exits;
+            rightBounds[b] = right;
+            rightCounts[b] = rightCount;
+        }
+
+        AABB left;
+        uint32_t leftCount = 0;
+        for (uint32_t b = 1; b < NumBins; b++)
+        {
+            left.Grow(bins[b - 1].bounds);
+            leftCount += bins[b - 1].entries;
+            // a side with everything in it wouldn't get any smaller
+            if (leftCount == 0 || rightCounts[b] == 0 || leftCount == count || rightCounts[b] == count)
+                continue;
+
+            float cost = left.HalfArea() * leftCount + rightBounds[b].HalfArea() * rightCounts[b];
+            if (cost < spatialCost)
+            {
+                spatialCost = cost;
+                spatialAxis = axis;
+                spatialBin = b;
+                spatialLeft = left;
+                spatialRight = rightBounds[b];
+                spatialLeftCount = leftCount;
+                spatialRightCount = rightCounts[b];
+            }
+        }
+    }
+
+    // the budget has to cover every straddling reference, even if some of them end up unsplit
+    bool useSpatial = spatialAxis != -1 && spatialCost < objectCost &&
+                      spatialLeftCount + spatialRightCount - count <= context.splitBudget;
+    float bestCost = useSpatial ? spatialCost : objectCost;
+
+    if (objectAxis != -1)
+    {
+        float splitCost = TraversalCost + IntersectionCost * bestCost / parentArea;
+        float leafCost = IntersectionCost * count;
+        if (splitCost >= leafCost && count <= MaxLeafSize)
+        {
+            makeLeaf();
+            return;
+        }
+    }
+    else if (count <= MaxLeafSize)
+    {
+        makeLeaf();
+        return;
+    }
+
+    std::vector<SpatialReference> leftReferences, rightReferences;
+    if (useSpatial)
+    {
+        int axis = spatialAxis;
+        float plane = nodeMin[axis] + binWidth[axis] * spatialBin;
+        float leftArea = spatialLeft.HalfArea(), rightArea = spatialRight.HalfArea();
+        uint32_t leftCount = spatialLeftCount, rightCount = spatialRightCount;
+        for (SpatialReference const& reference : references)
+        {
+            uint32_t firstBin = spatialBinOf(Axis(reference.bounds.min, axis), axis);
+            uint32_t lastBin = spatialBinOf(Axis(reference.bounds.max, axis), axis);
+            if (lastBin < spatialBin)
+            {
+                leftReferences.push_back(reference);
+                continue;
+            }
+            if (firstBin >= spatialBin)
+            {
+                rightReferences.push_back(reference);
+                continue;
+            }
+
+            // the primitive may not reach across the plane even though its box does
+            AABB leftPiece = ClipReference(reference.bounds, reference.primitive, axis, -FLT_MAX, plane, context.clipPrimitive);
+            AABB rightPiece = ClipReference(reference.bounds, reference.primitive, axis, plane, FLT_MAX, context.clipPrimitive);
+            if (rightPiece.IsEmpty() && !leftPiece.IsEmpty())
+            {
+                leftReferences.push_back({ leftPiece, reference.primitive });
+                rightCount--;
+                continue;
+            }
+            if (leftPiece.IsEmpty() && !rightPiece.IsEmpty())
+            {
+                rightReferences.push_back({ rightPiece, reference.primitive });
+                leftCount--;
+                continue;
+            }
+
+            // compare splitting it with keeping all of it on either side
+            AABB grownLeft = spatialLeft, grownRight = spatialRight;
+            grownLeft.Grow(reference.bounds);
+            grownRight.Grow(reference.bounds);
+            float splitCost = leftArea * leftCount + rightArea * rightCount;
+            float leftOnlyCost = grownLeft.HalfArea() * leftCount + rightArea * (rightCount - 1);
+            float rightOnlyCost = leftArea * (leftCount - 1) + grownRight.HalfArea() * rightCount;
+            if (leftOnlyCost < splitCost && leftOnlyCost <= rightOnlyCost && rightCount > 1)
+            {
+                leftReferences.push_back(reference);
+                spatialLeft = grownLeft;
+                leftArea = grownLeft.HalfArea();
+                rightCount--;
+            }
+            else if (rightOnlyCost < splitCost && leftCount > 1)
+            {
+                rightReferences.push_back(reference);
+                spatialRight = grownRight;
+                rightArea = grownRight.HalfArea();
+                leftCount--;
+            }
+            else
+            {
+                leftReferences.push_back({ leftPiece, reference.primitive });
+                rightReferences.push_back({ rightPiece, reference.primitive });
+                context.splitBudget--;
+            }
+        }
+    }
+    else if (objectAxis != -1)
+    {
+        for (SpatialReference const& reference : references)
+        {
+            if (centroidBin(reference, objectAxis) < objectBin)
+                leftReferences.push_back(reference);
+            else
+                rightReferences.push_back(reference);
+        }
+    }
+
+    if (leftReferences.empty() || rightReferences.empty())
+    {
+        // same as MedianSplit, on the widest axis of the reference centroids
+        leftReferences.clear();
+        rightReferences.clear();
+        vec3 extent = { centroidBounds.max.x - centroidBounds.min.x,
+                        centroidBounds.max.y - centroidBounds.min.y,
+                        centroidBounds.max.z - centroidBounds.min.z };
+        int axis = extent.x > extent.y && extent.x > extent.z ? 0 : (extent.y > extent.z ? 1 : 2);
+        uint32_t split = count / 2;
+        std::nth_element(references.begin(), references.begin() + split, references.end(), [axis](SpatialReference const& a, SpatialReference const& b)
+        {
+            return Axis(a.bounds.Centroid(), axis) < Axis(b.bounds.Centroid(), axis);
+        });
+        leftReferences.assign(references.begin(), references.begin() + split);
+        rightReferences.assign(references.begin() + split, references.end());
+    }
+
+    // the children have their own copies, don't keep this level's around while they recurse
+    std::vector<SpatialReference>().swap(references);
+
+    uint32_t leftIndex = uint32_t(nodes.size());
+    nodes[nodeIndex].leftFirst = leftIndex;
+    nodes[nodeIndex].count = 0;
+    nodes.emplace_back();
+    nodes.emplace_back();
+    SubdivideSpatial(nodes, leftIndex, leftReferences, depth + 1, context);
+    SubdivideSpatial(nodes, leftIndex + 1, rightReferences, depth + 1, context);
+}
@@ -0,0 +1,361 @@
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include <algorithm>
+#include <functional>
+#include "aabb.h"
+#include "ray.h"
+#include "raypacket.h"
+#include "mappedfile.h"
+
+//------------------------------------------------------------------------------
+/**
+    A single node in the flattened BVH, 32 bytes.
+    Interior nodes store the index of their left child, the right child always
+    follows it directly. Leaves store the first index into the primitive list.
+*/
+struct BVHNode
+{
+    float bmin[3];
+    // left child for interior nodes, first primitive for leaves
+    uint32_t leftFirst;
+    float bmax[3];
+    // number of primitives, 0 for interior nodes
+    uint32_t count;
+
+    bool IsLeaf() const { return count > 0; }
+};
+
+//------------------------------------------------------------------------------
+/**
+    Counters filled in by the traversal functions when they are given one,
+    used by the benchmarks to compare acceleration structures
+*/
+struct TraversalStats
+{
+    // nodes fetched from memory, interior nodes and leaves
+    uint64_t nodeVisits = 0;
+    // primitive intersection calls
+    uint64_t primitiveTests = 0;
+};
+
+// How the BVH chooses its splits
+enum class BVHBuilder
+{
+    // sort along every axis and evaluate every split position, best trees but slow
+    SweepSAH,
+    // evaluate the SAH at a fixed number of bins per axis, subtrees are built in parallel
+    BinnedSAH,
+    // sort the primitives along a Morton curve and split where the codes change, meant for rebuilding
+    // every frame. Builds many times faster than the SAH builders but the trees are slower to trace
+    Linear,
+    // binned SAH that may also split space and put a primitive in both children, for primitives
+    // that overlap a lot. Leaves can refer to the same primitive, so primitiveIndices grows
+    SpatialSAH,
+};
+
+inline char const*
+BVHBuilderName(BVHBuilder builder)
+{
+    switch (builder)
+    {
+    case BVHBuilder::SweepSAH: return "Sweep SAH";
+    case BVHBuilder::BinnedSAH: return "Binned SAH";
+    case BVHBuilder::Linear: return "Linear";
+    case BVHBuilder::SpatialSAH: return "Spatial SAH";
+    }
+    return "Unknown";
+}
+
+// Order of the nodes in memory, see BVH::Reorder. Traversal works the same with all of them
+enum class BVHLayout
+{
+    // whatever order the builder appended the nodes in
+    BuildOrder,
+    // depth first, with the subtree of the larger child right after the pair of children
+    DepthFirst,
+    // the hottest part of a subtree, by surface area, packed together in blocks of TreeletPairs pairs
+    Treelet,
+};
+
+inline char const*
+BVHLayoutName(BVHLayout layout)
+{
+    switch (layout)
+    {
+    case BVHLayout::BuildOrder: return "Build order";
+    case BVHLayout::DepthFirst: return "Depth first";
+    case BVHLayout::Treelet: return "Treelet";
+    }
+    return "Unknown";
+}
+
+// Runs every task in the list, possibly in parallel, and returns once all of them are done
+using TaskRunner = std::function<void(std::vector<std::function<void()>>& tasks)>;
+
+// Shrinks box, which bounds a part of the given primitive, to that part of the primitive. Returns an
+// empty box if the primitive doesn't reach into it. Lets spatial splits cut tighter than the primitive bounds
+using PrimitiveClipper = std::function<AABB(uint32_t primitive, AABB const& box)>;
+
+//------------------------------------------------------------------------------
+/**
+    Bounding volume hierarchy built with the surface area heuristic.
+    The tree only knows about primitive bounds, intersecting the actual
+    primitives is left to the caller when traversing.
+*/
+class BVH
+{
+public:
+    // build the tree from the bounds of every primitive.
+    // without a task runner everything is built on the calling thread.
+    // SpatialSAH clips the pieces of split primitives with clipPrimitive if there is one, otherwise only their boxes
+    void Build(std::vector<AABB> const& primitiveBounds, BVHBuilder builder = BVHBuilder::BinnedSAH, TaskRunner const& runTasks = nullptr,
+               PrimitiveClipper const& clipPrimitive = nullptr);
+
+    // remove all nodes
+    void Clear();
+
+    // recompute the node bounds bottom up after primitives moved, the tree itself is kept as it is.
+    // primitiveBounds is indexed like in Build. Much faster than a rebuild but the tree gets worse
+    // the further the primitives move from where they were built, see SAHCost
+    void Refit(std::vector<AABB> const& primitiveBounds, TaskRunner const& runTasks = nullptr);
+
+    // move the nodes into the given order after a build, and the primitive indices into the order of the
+    // leaves that point to them. The tree itself stays the same, only left and right children may swap
+    void Reorder(BVHLayout layout);
+
+    // expected cost of tracing a ray that hits the root, by the same measure the builders minimize.
+    // comparing it to the cost right after a build tells how much refitting has degraded the tree
+    float SAHCost() const;
+
+    // true if there is nothing to traverse
+    bool Empty() const { return nodes.empty(); }
+
+    // find the closest hit along the ray.
+    // intersectLeaf(first, count, tMax) is called for every visited leaf with its range in primitiveIndices
+    // and must return true and shrink tMax when it finds a hit closer than tMax.
+    template<typename IntersectFunc>
+    bool Intersect(Ray const& ray, float tMax, IntersectFunc&& intersectLeaf, TraversalStats* stats = nullptr) const;
+
+    // true as soon as anything closer than tMax is hit, without looking for the closest hit.
+    // occludedLeaf(first, count, tMax) is called for every visited leaf and returns true if anything in it is hit
+    template<typename OccludedFunc>
+    bool Occluded(Ray const& ray, float tMax, OccludedFunc&& occludedLeaf, TraversalStats* stats = nullptr) const;
+
+    // find the closest hit of every active lane in the packet, walking the tree once for all of them.
+    // intersectLeaf(first, count, laneMask) is called for every visited leaf with the lanes that hit its box
+    // and must shrink packet.tMax of the lanes it finds closer hits for.
+    template<typename IntersectFunc>
+    void IntersectPacket(RayPacket& packet, IntersectFunc&& intersectLeaf, TraversalStats* stats = nullptr) const;
+
+    // flattened tree, root is at index 0. Points into the file if the tree was loaded from a cache
+    MappedArray<BVHNode> nodes;
+    // primitive indices, leaves point into this list. A primitive can be in here more than once with SpatialSAH
+    MappedArray<uint32_t> primitiveIndices;
+
+    // primitives per leaf before we always try to split
+    static constexpr uint32_t MaxLeafSize = 4;
+    // below this depth we stop trusting the SAH and split at the median, keeps the traversal stack bounded
+    static constexpr uint32_t MaxSAHDepth = 32;
+    // number of bins per axis for the binned builder
+    static constexpr uint32_t NumBins = 16;
+    // subtrees with fewer primitives than this are never split into more tasks
+    static constexpr uint32_t MinTaskSize = 4096;
+    // SpatialSAH adds at most this many references per primitive, caps the memory of the index list
+    static constexpr float SpatialSplitBudget = 0.5f;
+    // and only tries spatial splits where the children of the best object split overlap by more than this much of the root area
+    static constexpr float SpatialSplitOverlap = 1e-5f;
+    // sibling pairs per treelet of the Treelet layout, a pair is 64 bytes so this fills a 4 KB page
+    static constexpr uint32_t TreeletPairs = 64;
+
+private:
+    struct BuildContext;
+    struct BuildTask;
+    struct SpatialReference;
+    struct SpatialContext;
+    static void Subdivide(std::vector<BVHNode>& nodes, uint32_t nodeIndex, uint32_t depth, BuildContext& context);
+    static void SubdivideBinned(std::vector<BVHNode>& nodes, uint32_t nodeIndex, uint32_t depth, BuildContext& context, uint32_t taskSize, std::vector<BuildTask>* tasks);
+    static void SubdivideLinear(std::vector<BVHNode>& nodes, uint32_t nodeIndex, uint32_t depth, BuildContext& context, uint32_t taskSize, std::vector<BuildTask>* tasks);
+    static void SubdivideSpatial(std::vector<BVHNode>& nodes, uint32_t nodeIndex, std::vector<SpatialReference>& references, uint32_t depth, SpatialContext& context);
+    static void SplitNode(std::vector<BVHNode>& nodes, uint32_t nodeIndex, uint32_t split, BuildContext& context);
+    void RefitSubtree(uint32_t nodeIndex, std::vector<AABB> const& primitiveBounds);
+    void RefitNode(uint32_t nodeIndex, std::vector<AABB> const& primitiveBounds);
+    void AppendDepthFirst(std::vector<BVHNode>& nodes, uint32_t oldIndex, uint32_t newIndex) const;
+    // walk shared by Intersect and Occluded, with AnyHit the walk ends at the first leaf that reports a hit
+    template<bool AnyHit, typename IntersectFunc>
+    bool Traverse(Ray const& ray, float tMax, IntersectFunc&& intersectLeaf, TraversalStats* stats) const;
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<typename IntersectFunc>
+inline bool
+BVH::Intersect(Ray const& ray, float tMax, IntersectFunc&& intersectLeaf, TraversalStats* stats) const
+{
+    return this->Traverse<false>(ray, tMax, intersectLeaf, stats);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<typename OccludedFunc>
+inline bool
+BVH::Occluded(Ray const& ray, float tMax, OccludedFunc&& occludedLeaf, TraversalStats* stats) const
+{
+    return this->Traverse<true>(ray, tMax, occludedLeaf, stats);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<bool AnyHit, typename IntersectFunc>
+inline bool
+BVH::Traverse(Ray const& ray, float tMax, IntersectFunc&& intersectLeaf, TraversalStats* stats) const
+{
+    if (this->nodes.empty())
+        return false;
+
+    RayInv rayInv(ray);
+    BVHNode const* node = &this->nodes[0];
+    if (IntersectAABB(rayInv, node->bmin, node->bmax, tMax) == FLT_MAX)
+        return false;
+
+    bool isHit = false;
+    BVHNode const* stack[64];
+    uint32_t stackPtr = 0;
+
+    while (true)
+    {
+        if (stats)
+            stats->nodeVisits++;
+
+        if (node->IsLeaf())
+        {
+            if (stats)
+                stats->primitiveTests += node->count;
+
+            if (intersectLeaf(node->leftFirst, node->count, tMax))
+            {
+                if (AnyHit)
+                    return true;
+                isHit = true;
+            }
+
+            if (stackPtr == 0)
+                break;
+            node = stack[--stackPtr];
+            continue;
+        }
+
+        // visit the closest child first so the far one can be pruned by tMax
+        BVHNode const* child1 = &this->nodes[node->leftFirst];
+        BVHNode const* child2 = &this->nodes[node->leftFirst + 1];
+        float dist1 = IntersectAABB(rayInv, child1->bmin, child1->bmax, tMax);
+        float dist2 = IntersectAABB(rayInv, child2->bmin, child2->bmax, tMax);
+        if (dist1 > dist2)
+        {
+            std::swap(dist1, dist2);
+            std::swap(child1, child2);
+        }
+
+        if (dist1 == FLT_MAX)
+        {
+            if (stackPtr == 0)
+                break;
+            node = stack[--stackPtr];
+        }
+        else
+        {
+            node = child1;
+            if (dist2 != FLT_MAX)
+                stack[stackPtr++] = child2;
+        }
+    }
+
+    return isHit;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Same walk as Intersect, but a node is entered if any lane hits it.
+    Every stack entry remembers which lanes hit its box, so lanes that left
+    the subtree are not tested further down. Children are first culled with
+    the interval test against the whole packet, which is a lot cheaper than
+    testing 8 lanes when the packet misses the box entirely.
+*/
+template<typename IntersectFunc>
+inline void
+BVH::IntersectPacket(RayPacket& packet, IntersectFunc&& intersectLeaf, TraversalStats* stats) const
+{
+    if (this->nodes.empty() || packet.activeMask == 0)
+        return;
+
+    float nearest;
+    BVHNode const* node = &this->nodes[0];
+    uint32_t mask = IntersectPacketAABB(packet, node->bmin, node->bmax, nearest);
+    if (mask == 0)
+        return;
+
+    struct Entry
+    {
+        BVHNode const* node;
+        uint32_t mask;
+    };
+    Entry stack[64];
+    uint32_t stackPtr = 0;
+
+    while (true)
+    {
+        if (stats)
+            stats->nodeVisits++;
+
+        if (node->IsLeaf())
+        {
+            if (stats)
+                stats->primitiveTests += node->count;
+
+            intersectLeaf(node->leftFirst, node->count, mask);
+
+            if (stackPtr == 0)
+                break;
+            stackPtr--;
+            node = stack[stackPtr].node;
+            mask = stack[stackPtr].mask;
+            continue;
+        }
+
+        // visit the child closest to any lane first, for coherent packets that is the closest one for all of them
+        BVHNode const* child1 = &this->nodes[node->leftFirst];
+        BVHNode const* child2 = &this->nodes[node->leftFirst + 1];
+        float dist1 = FLT_MAX, dist2 = FLT_MAX;
+        uint32_t mask1 = PacketMissesAABB(packet, child1->bmin, child1->bmax) ? 0 : IntersectPacketAABB(packet, child1->bmin, child1->bmax, dist1) & mask;
+        uint32_t mask2 = PacketMissesAABB(packet, child2->bmin, child2->bmax) ? 0 : IntersectPacketAABB(packet, child2->bmin, child2->bmax, dist2) & mask;
+        if (mask1 == 0)
+            dist1 = FLT_MAX;
+        if (mask2 == 0)
+            dist2 = FLT_MAX;
+        if (dist1 > dist2)
+        {
+            std::swap(dist1, dist2);
+            std::swap(child1, child2);
+            std::swap(mask1, mask2);
+        }
+
+        if (mask1 == 0)
+        {
+            if (stackPtr == 0)
+                break;
+            stackPtr--;
+            node = stack[stackPtr].node;
+            mask = stack[stackPtr].mask;
+        }
+        else
+        {
+            node = child1;
+            mask = mask1;
+            if (mask2 != 0)
+                stack[stackPtr++] = { child2, mask2 };
+        }
+    }
+}
@@ -0,0 +1,230 @@
+#include "bvhcache.h"
+#include <stdio.h>
+#include <string.h>
+#include <filesystem>
+#include <iostream>
+
+// bump when the file layout or anything about how trees are built changes
+static constexpr uint32_t CacheVersion = 2;
+static constexpr char CacheMagic[8] = { 'T', 'R', 'A', 'Y', 'B', 'V', 'H', '\0' };
+// reads back differently on a machine with the other byte order
+static constexpr uint32_t ByteOrderMark = 0x01020304;
+
+//------------------------------------------------------------------------------
+/**
+    Start of every cache file. The nodes follow at nodeOffset and the
+    primitive indices at indexOffset, both counted from the start of the file,
+    so the file can be mapped anywhere. There are more indices than
+    primitives when spatial splits put a primitive in several leaves.
+*/
+struct BVHCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t nodeSize;
+    uint32_t reserved;
+    uint64_t key;
+    uint64_t primitiveCount;
+    uint64_t indexCount;
+    uint64_t nodeCount;
+    uint64_t nodeOffset;
+    uint64_t indexOffset;
+};
+static_assert(sizeof(BVHCacheHeader) % alignof(BVHNode) == 0, "nodes directly after the header have to be aligned");
+
+//------------------------------------------------------------------------------
+/**
+    Eight bytes at a time, this runs over every primitive bound on every
+    startup so it has to be a lot cheaper than building.
+*/
+static uint64_t
+HashBytes(void const* data, size_t size, uint64_t hash)
+{
+    constexpr uint64_t Multiplier = 0x9e3779b97f4a7c15ull;
+    unsigned char const* bytes = static_cast<unsigned char const*>(data);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * Multiplier;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * Multiplier;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+uint64_t
+BVHCacheKey(std::vector<AABB> const& primitiveBounds, BVHBuilder builder, BVHLayout layout)
+{
+    // the size of AABB tells float and double builds apart
+    uint32_t const settings[] = { CacheVersion, uint32_t(builder), uint32_t(layout), uint32_t(sizeof(AABB)),
+                                  BVH::MaxLeafSize, BVH::MaxSAHDepth, BVH::NumBins, BVH::TreeletPairs };
+    uint64_t hash = HashBytes(settings, sizeof(settings), 0xcbf29ce484222325ull);
+    return HashBytes(primitiveBounds.data(), primitiveBounds.size() * sizeof(AABB), hash);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Written to a temporary file first and renamed, so a run that dies halfway
+    or another run reading at the same time never sees half a file.
+*/
+bool
+SaveBVH(std::string const& path, BVH const& bvh, uint64_t key, uint32_t primitiveCount)
+{
+    BVHCacheHeader header = {};
+    memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+    header.version = CacheVersion;
+    header.byteOrder = ByteOrderMark;
+    header.nodeSize = sizeof(BVHNode);
+    header.key = key;
+    header.primitiveCount = primitiveCount;
+    header.indexCount = bvh.primitiveIndices.size();
+    header.nodeCount = bvh.nodes.size();
+    header.nodeOffset = sizeof(BVHCacheHeader);
+    header.indexOffset = header.nodeOffset + header.nodeCount * sizeof(BVHNode);
+
+    std::string temporaryPath = path + ".tmp";
+    FILE* file = fopen(temporaryPath.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(bvh.nodes.data(), sizeof(BVHNode), bvh.nodes.size(), file) == bvh.nodes.size();
+    ok = ok && fwrite(bvh.primitiveIndices.data(), sizeof(uint32_t), bvh.primitiveIndices.size(), file) == bvh.primitiveIndices.size();
+    ok = fclose(file) == 0 && ok;
+
+    std::error_code error;
+    if (ok)
+        std::filesystem::rename(temporaryPath, path, error);
+    if (!ok || error)
+    {
+        std::filesystem::remove(temporaryPath, error);
+        return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Traversal trusts the tree completely, so anything that could send it out
+    of bounds is checked before the file is used: ranges of the leaves,
+    children that have to come after their parent, which also rules out
+    cycles, and a depth that fits the traversal stacks.
+*/
+static bool
+ValidateTree(BVHNode const* nodes, uint64_t nodeCount, uint32_t const* indices, uint64_t indexCount, uint64_t primitiveCount)
+{
+    for (uint64_t i = 0; i < indexCount; i++)
+    {
+        if (indices[i] >= primitiveCount)
+            return false;
+    }
+
+    // traversal pushes at most one node per level
+    constexpr uint8_t MaxDepth = 64;
+    std::vector<uint8_t> depth(nodeCount, 0);
+    for (uint64_t i = 0; i < nodeCount; i++)
+    {
+        BVHNode const& node = nodes[i];
+        if (node.IsLeaf())
+        {
+            if (uint64_t(node.leftFirst) + node.count > indexCount)
+                return false;
+            continue;
+        }
+
+        if (node.leftFirst <= i || uint64_t(node.leftFirst) + 1 >= nodeCount || depth[i] + 1 >= MaxDepth)
+            return false;
+        depth[node.leftFirst] = depth[node.leftFirst + 1] = uint8_t(depth[i] + 1);
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+LoadBVH(std::string const& path, BVH& bvh, uint64_t key, uint32_t primitiveCount)
+{
+    std::shared_ptr<MappedFile> file = MappedFile::Open(path);
+    if (!file)
+        return false;
+
+    auto reject = [&path](char const* reason)
+    {
+        std::cerr << path << ": " << reason << ", rebuilding\n";
+        return false;
+    };
+
+    if (file->Size() < sizeof(BVHCacheHeader))
+        return reject("too small for a BVH cache file");
+
+    BVHCacheHeader header;
+    memcpy(&header, file->Data(), sizeof(header));
+    if (memcmp(header.magic, CacheMagic, sizeof(CacheMagic)) != 0)
+        return reject("not a BVH cache file");
+    if (header.version != CacheVersion || header.byteOrder != ByteOrderMark || header.nodeSize != sizeof(BVHNode))
+        return reject("written by a different version or machine");
+    if (header.key != key || header.primitiveCount != primitiveCount)
+        return reject("stale, the scene changed");
+
+    // a tree over n references has between 1 and 2n - 1 nodes, and every primitive is referenced at least once
+    uint64_t nodeBytes = header.nodeCount * sizeof(BVHNode);
+    uint64_t indexBytes = header.indexCount * sizeof(uint32_t);
+    if (header.indexCount < header.primitiveCount || header.indexCount > uint64_t(UINT32_MAX) ||
+        header.nodeCount == 0 || header.nodeCount > header.indexCount * 2 ||
+        header.nodeOffset % alignof(BVHNode) != 0 || header.indexOffset % alignof(uint32_t) != 0 ||
+        header.nodeOffset > file->Size() || nodeBytes > file->Size() - header.nodeOffset ||
+        header.indexOffset > file->Size() || indexBytes > file->Size() - header.indexOffset)
+        return reject("truncated or corrupt");
+
+    BVHNode const* nodes = reinterpret_cast<BVHNode const*>(file->Data() + header.nodeOffset);
+    uint32_t const* indices = reinterpret_cast<uint32_t const*>(file->Data() + header.indexOffset);
+    if (!ValidateTree(nodes, header.nodeCount, indices, header.indexCount, header.primitiveCount))
+        return reject("corrupt tree");
+
+    bvh.nodes.Map(file, size_t(header.nodeOffset), size_t(header.nodeCount));
+    bvh.primitiveIndices.Map(file, size_t(header.indexOffset), size_t(header.indexCount));
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+BuildCachedBVH(BVH& bvh, std::vector<AABB> const& primitiveBounds, BVHBuilder builder, TaskRunner const& runTasks, std::string const& directory,
+               PrimitiveClipper const& clipPrimitive, BVHLayout layout)
+{
+    if (directory.empty() || primitiveBounds.empty())
+    {
+        bvh.Build(primitiveBounds, builder, runTasks, clipPrimitive);
+        bvh.Reorder(layout);
+        return false;
+    }
+
+    uint64_t key = BVHCacheKey(primitiveBounds, builder, layout);
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bvh", (unsigned long long)key);
+    std::string path = (std::filesystem::path(directory) / name).string();
+
+    if (LoadBVH(path, bvh, key, uint32_t(primitiveBounds.size())))
+        return true;
+
+    bvh.Build(primitiveBounds, builder, runTasks, clipPrimitive);
+    bvh.Reorder(layout);
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (!SaveBVH(path, bvh, key, uint32_t(primitiveBounds.size())))
+        std::cerr << "Could not write BVH cache " << path << "\n";
+    return false;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "bvh.h"
+
+//------------------------------------------------------------------------------
+/**
+    Builds bvh like BVH::Build and puts it in the given layout, but first
+    looks in directory for a tree that was built from the same primitive
+    bounds with the same builder and layout. A cached
+    tree is used straight from the mapped file without copying it. A file that
+    doesn't pass validation is rebuilt and replaced, new trees are written to
+    directory for the next run. With an empty directory it just builds.
+    Returns true if the tree came from the cache.
+*/
+bool BuildCachedBVH(BVH& bvh, std::vector<AABB> const& primitiveBounds, BVHBuilder builder, TaskRunner const& runTasks, std::string const& directory,
+                    PrimitiveClipper const& clipPrimitive = nullptr, BVHLayout layout = BVHLayout::BuildOrder);
+
+// hash of the primitive bounds, the builder, the layout and the build settings, cache files are named after it
+uint64_t BVHCacheKey(std::vector<AABB> const& primitiveBounds, BVHBuilder builder, BVHLayout layout = BVHLayout::BuildOrder);
+
+// write bvh over primitiveCount primitives to path with the key it was built for. Returns false if the file can't be written
+bool SaveBVH(std::string const& path, BVH const& bvh, uint64_t key, uint32_t primitiveCount);
+
+// map a tree saved with SaveBVH. Returns false and leaves bvh alone if the file is missing,
+// was saved with a different key or format, or doesn't describe a valid tree over primitiveCount primitives
+bool LoadBVH(std::string const& path, BVH& bvh, uint64_t key, uint32_t primitiveCount);
@@ -13,17 +13,24 @@ struct Color
         this->b += rhs.b;
     }
 
-    Color operator+(Color const& rhs)
+    Color operator+(Color const& rhs) const
     {
         return {this->r + rhs.r,
                 this->g + rhs.g,
                 this->b + rhs.b};
     }
 
-    Color operator*(Color const& rhs)
+    Color operator*(Color const& rhs) const
     {
         return {this->r * rhs.r,
                 this->g * rhs.g,
                 this->b * rhs.b};
     }
+
+    Color operator*(float rhs) const
+    {
+        return {this->r * rhs,
+                this->g * rhs,
+                this->b * rhs};
+    }
 };
@@ -0,0 +1,340 @@
+#include "grid.h"
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+
+// primitives are inserted with their box grown by this much of a cell, so rounding
+// in the walk can't step past a cell a primitive only just reaches into
+static constexpr float InsertPadding = 1e-3f;
+// primitives per task when inserting in parallel
+static constexpr uint32_t MinChunkSize = 16384;
+
+//------------------------------------------------------------------------------
+/**
+    Run the tasks with the runner if there is one, otherwise one after another
+*/
+static void
+RunAll(std::vector<std::function<void()>>& tasks, TaskRunner const& runTasks)
+{
+    if (runTasks)
+        runTasks(tasks);
+    else
+        for (auto& task : tasks)
+            task();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static float
+Axis(vec3 const& v, int axis)
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Average of the largest side of the primitive boxes
+*/
+static float
+PrimitiveSize(std::vector<AABB> const& primitiveBounds, uint32_t const* primitives, uint32_t begin, uint32_t end)
+{
+    double sum = 0.0;
+    for (uint32_t i = begin; i < end; i++)
+    {
+        AABB const& bounds = primitiveBounds[primitives ? primitives[i] : i];
+        sum += std::max(std::max(bounds.max.x - bounds.min.x, bounds.max.y - bounds.min.y), bounds.max.z - bounds.min.z);
+    }
+    return end > begin ? float(sum / (end - begin)) : 0.0f;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Cells along every axis so there are about density cells per primitive,
+    as close to cubes as the box allows. Cells are never made smaller than
+    minCellSize, smaller cells than the primitives only multiply the references
+    of every primitive without making the cells much emptier.
+*/
+static GridLevel
+MakeLevel(AABB const& bounds, uint32_t count, float density, float minCellSize)
+{
+    float extent[3];
+    float largest = 0.0f;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        extent[axis] = Axis(bounds.max, axis) - Axis(bounds.min, axis);
+        largest = std::max(largest, extent[axis]);
+    }
+    // flat boxes still need a volume, and the walk a cell size it can divide by
+    largest = std::max(largest, 1e-6f);
+    for (int axis = 0; axis < 3; axis++)
+        extent[axis] = std::max(extent[axis], largest * 1e-3f);
+
+    float volume = extent[0] * extent[1] * extent[2];
+    float cellsPerLength = cbrtf(std::max(density * count, 1.0f) / volume);
+    if (minCellSize > 0.0f)
+        cellsPerLength = std::min(cellsPerLength, 1.0f / minCellSize);
+
+    GridLevel level;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float cells = ceilf(extent[axis] * cellsPerLength);
+        level.dims[axis] = uint32_t(std::min(std::max(cells, 1.0f), float(Grid::MaxResolution)));
+        level.origin[axis] = Axis(bounds.min, axis);
+        level.cellSize[axis] = extent[axis] / level.dims[axis];
+        level.invCellSize[axis] = 1.0f / level.cellSize[axis];
+    }
+    level.firstCell = 0;
+    return level;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Range of cells of the level a box overlaps, inclusive on both ends
+*/
+static void
+CellRange(GridLevel const& level, AABB const& bounds, uint32_t lo[3], uint32_t hi[3])
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float padding = level.cellSize[axis] * InsertPadding;
+        float bmin = (Axis(bounds.min, axis) - padding - level.origin[axis]) * level.invCellSize[axis];
+        float bmax = (Axis(bounds.max, axis) + padding - level.origin[axis]) * level.invCellSize[axis];
+        int last = int(level.dims[axis]) - 1;
+        lo[axis] = uint32_t(std::min(std::max(int(floorf(bmin)), 0), last));
+        hi[axis] = uint32_t(std::min(std::max(int(floorf(bmax)), 0), last));
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Call func(cellIndex) for every cell of the level a box overlaps,
+    cell indices relative to the level
+*/
+template<typename Func>
+static void
+ForEachCell(GridLevel const& level, AABB const& bounds, Func&& func)
+{
+    uint32_t lo[3], hi[3];
+    CellRange(level, bounds, lo, hi);
+    for (uint32_t z = lo[2]; z <= hi[2]; z++)
+        for (uint32_t y = lo[1]; y <= hi[1]; y++)
+            for (uint32_t x = lo[0]; x <= hi[0]; x++)
+                func(x + y * level.dims[0] + z * level.dims[0] * level.dims[1]);
+}
+
+//------------------------------------------------------------------------------
+/**
+    The grid of one dense top level cell, built on a single thread with the
+    same counting sort as the top level. References are relative to the
+    subgrid, the caller moves them into place.
+*/
+struct Subgrid
+{
+    GridLevel level;
+    std::vector<GridCell> cells;
+    std::vector<uint32_t> indices;
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+static void
+BuildSubgrid(Subgrid& subgrid, AABB const& cellBounds, std::vector<AABB> const& primitiveBounds, uint32_t const* primitives, uint32_t count)
+{
+    // no need to cover the parts of the cell the primitives don't reach
+    AABB bounds;
+    for (uint32_t i = 0; i < count; i++)
+        bounds.Grow(primitiveBounds[primitives[i]]);
+    bounds.min = { std::max(bounds.min.x, cellBounds.min.x), std::max(bounds.min.y, cellBounds.min.y), std::max(bounds.min.z, cellBounds.min.z) };
+    bounds.max = { std::min(bounds.max.x, cellBounds.max.x), std::min(bounds.max.y, cellBounds.max.y), std::min(bounds.max.z, cellBounds.max.z) };
+    // only happens when every primitive just reaches in through the insert padding
+    if (bounds.IsEmpty())
+        bounds = cellBounds;
+
+    subgrid.level = MakeLevel(bounds, count, Grid::SubgridCellsPerPrimitive, PrimitiveSize(primitiveBounds, primitives, 0, count));
+    uint32_t numCells = subgrid.level.dims[0] * subgrid.level.dims[1] * subgrid.level.dims[2];
+    subgrid.cells.assign(numCells, { 0, 0 });
+
+    for (uint32_t i = 0; i < count; i++)
+        ForEachCell(subgrid.level, primitiveBounds[primitives[i]], [&subgrid](uint32_t cell) { subgrid.cells[cell].count++; });
+
+    uint32_t offset = 0;
+    for (GridCell& cell : subgrid.cells)
+    {
+        cell.first = offset;
+        offset += cell.count;
+        cell.count = 0;
+    }
+
+    // the primitives come sorted, so every cell ends up sorted too
+    subgrid.indices.resize(offset);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t primitive = primitives[i];
+        ForEachCell(subgrid.level, primitiveBounds[primitive], [&subgrid, primitive](uint32_t cell)
+        {
+            GridCell& target = subgrid.cells[cell];
+            subgrid.indices[target.first + target.count++] = primitive;
+        });
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    A counting sort: one pass counts the references of every cell, a prefix
+    sum turns the counts into ranges and a second pass writes the references.
+    Both passes run on chunks of the primitives in parallel with atomic
+    counters, so the order within a cell is sorted afterwards to make the
+    grid the same on every run.
+*/
+void
+Grid::Build(std::vector<AABB> const& primitiveBounds, bool twoLevel, TaskRunner const& runTasks)
+{
+    this->Clear();
+
+    uint32_t count = uint32_t(primitiveBounds.size());
+    if (count == 0)
+        return;
+
+    uint32_t numChunks = runTasks ? std::min(std::max(count / MinChunkSize, 1u), 64u) : 1;
+    uint32_t chunkSize = (count + numChunks - 1) / numChunks;
+    std::vector<std::function<void()>> tasks;
+    auto forEachChunk = [&tasks, &runTasks, numChunks, chunkSize, count](std::function<void(uint32_t, uint32_t)> const& func)
+    {
+        tasks.clear();
+        for (uint32_t chunk = 0; chunk < numChunks; chunk++)
+        {
+            uint32_t begin = chunk * chunkSize;
+            uint32_t end = std::min(begin + chunkSize, count);
+            tasks.push_back([&func, begin, end]() { func(begin, end); });
+        }
+        RunAll(tasks, runTasks);
+    };
+
+    std::vector<AABB> chunkBounds(numChunks);
+    std::vector<float> chunkSizes(numChunks);
+    forEachChunk([&chunkBounds, &chunkSizes, &primitiveBounds, chunkSize](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; i++)
+            chunkBounds[begin / chunkSize].Grow(primitiveBounds[i]);
+        chunkSizes[begin / chunkSize] = PrimitiveSize(primitiveBounds, nullptr, begin, end) * (end - begin);
+    });
+    AABB bounds;
+    float primitiveSize = 0.0f;
+    for (uint32_t chunk = 0; chunk < numChunks; chunk++)
+    {
+        bounds.Grow(chunkBounds[chunk]);
+        primitiveSize += chunkSizes[chunk] / count;
+    }
+
+    GridLevel top = MakeLevel(bounds, count, twoLevel ? TopCellsPerPrimitive : CellsPerPrimitive, primitiveSize);
+    uint32_t numCells = top.dims[0] * top.dims[1] * top.dims[2];
+
+    std::vector<std::atomic<uint32_t>> counts(numCells);
+    for (auto& c : counts)
+        c.store(0, std::memory_order_relaxed);
+    forEachChunk([&counts, &primitiveBounds, &top](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; i++)
+            ForEachCell(top, primitiveBounds[i], [&counts](uint32_t cell) { counts[cell].fetch_add(1, std::memory_order_relaxed); });
+    });
+
+    std::vector<GridCell> cells(numCells);
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < numCells; i++)
+    {
+        cells[i].first = offset;
+        cells[i].count = counts[i].load(std::memory_order_relaxed);
+        offset += cells[i].count;
+        counts[i].store(cells[i].first, std::memory_order_relaxed);
+    }
+
+    std::vector<uint32_t> indices(offset);
+    forEachChunk([&counts, &indices, &primitiveBounds, &top](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; i++)
+            ForEachCell(top, primitiveBounds[i], [&counts, &indices, i](uint32_t cell) { indices[counts[cell].fetch_add(1, std::memory_order_relaxed)] = i; });
+    });
+
+    // split the cells into as many ranges as there are chunks and sort those
+    tasks.clear();
+    uint32_t cellsPerTask = (numCells + numChunks - 1) / numChunks;
+    for (uint32_t begin = 0; begin < numCells; begin += cellsPerTask)
+    {
+        uint32_t end = std::min(begin + cellsPerTask, numCells);
+        tasks.push_back([&cells, &indices, begin, end]()
+        {
+            for (uint32_t i = begin; i < end; i++)
+                std::sort(indices.begin() + cells[i].first, indices.begin() + cells[i].first + cells[i].count);
+        });
+    }
+    RunAll(tasks, runTasks);
+
+    this->levels.push_back(top);
+    if (!twoLevel)
+    {
+        this->cells = std::move(cells);
+        this->primitiveIndices = std::move(indices);
+        return;
+    }
+
+    // give every dense cell a grid of its own, each one is a task
+    std::vector<uint32_t> denseCells;
+    for (uint32_t i = 0; i < numCells; i++)
+    {
+        if (cells[i].count > MaxCellSize)
+            denseCells.push_back(i);
+    }
+
+    std::vector<Subgrid> subgrids(denseCells.size());
+    tasks.clear();
+    for (size_t s = 0; s < denseCells.size(); s++)
+    {
+        tasks.push_back([s, &subgrids, &denseCells, &cells, &indices, &primitiveBounds, &top]()
+        {
+            uint32_t cell = denseCells[s];
+            uint32_t xyz[3] = { cell % top.dims[0], (cell / top.dims[0]) % top.dims[1], cell / (top.dims[0] * top.dims[1]) };
+            AABB cellBounds;
+            cellBounds.min = { top.origin[0] + xyz[0] * top.cellSize[0], top.origin[1] + xyz[1] * top.cellSize[1], top.origin[2] + xyz[2] * top.cellSize[2] };
+            cellBounds.max = { top.origin[0] + (xyz[0] + 1) * top.cellSize[0], top.origin[1] + (xyz[1] + 1) * top.cellSize[1], top.origin[2] + (xyz[2] + 1) * top.cellSize[2] };
+            BuildSubgrid(subgrids[s], cellBounds, primitiveBounds, indices.data() + cells[cell].first, cells[cell].count);
+        });
+    }
+    RunAll(tasks, runTasks);
+
+    // the top cells keep their references, the subgrids go after them
+    this->primitiveIndices.reserve(indices.size());
+    this->cells.reserve(numCells);
+    for (uint32_t i = 0; i < numCells; i++)
+    {
+        uint32_t first = uint32_t(this->primitiveIndices.size());
+        if (cells[i].count <= MaxCellSize)
+            this->primitiveIndices.insert(this->primitiveIndices.end(), indices.begin() + cells[i].first, indices.begin() + cells[i].first + cells[i].count);
+        this->cells.push_back({ first, cells[i].count });
+    }
+    for (size_t s = 0; s < subgrids.size(); s++)
+    {
+        Subgrid& subgrid = subgrids[s];
+        subgrid.level.firstCell = uint32_t(this->cells.size());
+        this->cells[denseCells[s]] = { uint32_t(this->levels.size()), SubgridCell };
+        this->levels.push_back(subgrid.level);
+
+        uint32_t first = uint32_t(this->primitiveIndices.size());
+        for (GridCell const& cell : subgrid.cells)
+            this->cells.push_back({ first + cell.first, cell.count });
+        this->primitiveIndices.insert(this->primitiveIndices.end(), subgrid.indices.begin(), subgrid.indices.end());
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Grid::Clear()
+{
+    this->levels.clear();
+    this->cells.clear();
+    this->primitiveIndices.clear();
+}
@@ -0,0 +1,243 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "aabb.h"
+#include "bvh.h"
+
+//------------------------------------------------------------------------------
+/**
+    One level of a grid, cells are stored x fastest starting at firstCell
+*/
+struct GridLevel
+{
+    float origin[3];
+    float cellSize[3];
+    float invCellSize[3];
+    uint32_t dims[3];
+    uint32_t firstCell;
+};
+
+//------------------------------------------------------------------------------
+/**
+    References of a cell, a range in Grid::primitiveIndices. Cells of the top
+    level that got a grid of their own have count SubgridCell and first set
+    to the index of that level instead.
+*/
+struct GridCell
+{
+    uint32_t first;
+    uint32_t count;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Uniform grid over the primitive bounds, walked with a 3D DDA. Every cell
+    refers to all primitives whose box overlaps it, so a primitive can be in
+    many cells. Much cheaper to build than a BVH and fast for primitives that
+    are spread evenly, slow for scenes with big empty regions.
+    With twoLevel the top grid is coarse and every cell with more than
+    MaxCellSize primitives gets a finer grid of its own, which adapts the
+    resolution to the density of the scene.
+*/
+class Grid
+{
+public:
+    // insert the primitives with a counting sort, in parallel if a task runner is given
+    void Build(std::vector<AABB> const& primitiveBounds, bool twoLevel = false, TaskRunner const& runTasks = nullptr);
+
+    // remove all cells
+    void Clear();
+
+    // true if there is nothing to traverse
+    bool Empty() const { return levels.empty(); }
+
+    // same contract as BVH::Intersect, with cells instead of leaves. A hit found in a cell may be
+    // outside of it, the walk only stops once tMax is before the end of the current cell
+    template<typename IntersectFunc>
+    bool Intersect(Ray const& ray, float tMax, IntersectFunc&& intersectLeaf, TraversalStats* stats = nullptr) const;
+
+    // same contract as BVH::Occluded, stops in the first cell with a hit
+    template<typename OccludedFunc>
+    bool Occluded(Ray const& ray, float tMax, OccludedFunc&& occludedLeaf, TraversalStats* stats = nullptr) const;
+
+    // level 0 is the top grid, the rest are the grids of its dense cells
+    std::vector<GridLevel> levels;
+    // cells of all levels
+    std::vector<GridCell> cells;
+    // primitive indices, cells point into this list
+    std::vector<uint32_t> primitiveIndices;
+
+    static constexpr uint32_t SubgridCell = UINT32_MAX;
+    // cells per primitive of the single level grid
+    static constexpr float CellsPerPrimitive = 2.0f;
+    // cells per primitive of the top level of the two level grid, and of the grids in its cells
+    static constexpr float TopCellsPerPrimitive = 1.0f / 8.0f;
+    static constexpr float SubgridCellsPerPrimitive = 2.0f;
+    // cells of the top level with more primitives than this get a grid of their own
+    static constexpr uint32_t MaxCellSize = 8;
+    // limit on the cells of one level along any axis
+    static constexpr uint32_t MaxResolution = 1024;
+
+private:
+    template<bool AnyHit, typename IntersectFunc>
+    bool Traverse(Ray const& ray, float tMax, IntersectFunc&& intersectLeaf, TraversalStats* stats) const;
+    template<typename VisitFunc>
+    static bool Walk(GridLevel const& level, RayInv const& ray, float tEnter, float tExit, VisitFunc&& visit);
+    static bool Clip(GridLevel const& level, RayInv const& ray, float& tEnter, float& tExit);
+};
+
+//------------------------------------------------------------------------------
+/**
+    Cut [tEnter, tExit] down to where the ray is inside the level's box.
+    Returns false if nothing is left.
+*/
+inline bool
+Grid::Clip(GridLevel const& level, RayInv const& ray, float& tEnter, float& tExit)
+{
+    float o[3] = { ray.ox, ray.oy, ray.oz };
+    float inv[3] = { ray.ix, ray.iy, ray.iz };
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float lo = level.origin[axis];
+        float hi = level.origin[axis] + level.cellSize[axis] * level.dims[axis];
+        float t1 = (lo - o[axis]) * inv[axis];
+        float t2 = (hi - o[axis]) * inv[axis];
+        // a ray parallel to the slab gives NaN when it starts on its edge, which min and max ignore here
+        tEnter = std::max(tEnter, std::min(t1, t2));
+        tExit = std::min(tExit, std::max(t1, t2));
+    }
+    return tEnter <= tExit;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Visit the cells of a level the ray passes between tEnter and tExit, in
+    order. visit(cellIndex, tCellExit) returns true to stop the walk, which
+    then returns true as well.
+*/
+template<typename VisitFunc>
+inline bool
+Grid::Walk(GridLevel const& level, RayInv const& ray, float tEnter, float tExit, VisitFunc&& visit)
+{
+    float o[3] = { ray.ox, ray.oy, ray.oz };
+    float inv[3] = { ray.ix, ray.iy, ray.iz };
+
+    int cell[3], step[3], end[3];
+    float tNext[3], tDelta[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float p = o[axis] + tEnter / inv[axis];
+        int dim = int(level.dims[axis]);
+        cell[axis] = std::min(std::max(int((p - level.origin[axis]) * level.invCellSize[axis]), 0), dim - 1);
+
+        if (inv[axis] >= 0.0f)
+        {
+            step[axis] = 1;
+            end[axis] = dim;
+            tNext[axis] = (level.origin[axis] + (cell[axis] + 1) * level.cellSize[axis] - o[axis]) * inv[axis];
+            tDelta[axis] = level.cellSize[axis] * inv[axis];
+        }
+        else
+        {
+            step[axis] = -1;
+            end[axis] = -1;
+            tNext[axis] = (level.origin[axis] + cell[axis] * level.cellSize[axis] - o[axis]) * inv[axis];
+            tDelta[axis] = -level.cellSize[axis] * inv[axis];
+        }
+        // a zero direction gives an infinite inverse, and NaN when the ray starts on a cell edge
+        if (!(tNext[axis] == tNext[axis]) || std::isinf(inv[axis]))
+            tNext[axis] = INFINITY;
+    }
+
+    uint32_t const rowSize = level.dims[0];
+    uint32_t const sliceSize = level.dims[0] * level.dims[1];
+    for (;;)
+    {
+        int axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+        float tCellExit = std::min(tNext[axis], tExit);
+
+        uint32_t index = level.firstCell + uint32_t(cell[0]) + uint32_t(cell[1]) * rowSize + uint32_t(cell[2]) * sliceSize;
+        if (visit(index, tCellExit))
+            return true;
+
+        if (tNext[axis] >= tExit)
+            return false;
+        cell[axis] += step[axis];
+        if (cell[axis] == end[axis])
+            return false;
+        tNext[axis] += tDelta[axis];
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<typename IntersectFunc>
+inline bool
+Grid::Intersect(Ray const& ray, float tMax, IntersectFunc&& intersectLeaf, TraversalStats* stats) const
+{
+    return this->Traverse<false>(ray, tMax, intersectLeaf, stats);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<typename OccludedFunc>
+inline bool
+Grid::Occluded(Ray const& ray, float tMax, OccludedFunc&& occludedLeaf, TraversalStats* stats) const
+{
+    return this->Traverse<true>(ray, tMax, occludedLeaf, stats);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<bool AnyHit, typename IntersectFunc>
+inline bool
+Grid::Traverse(Ray const& ray, float tMax, IntersectFunc&& intersectLeaf, TraversalStats* stats) const
+{
+    if (this->levels.empty())
+        return false;
+
+    RayInv rayInv(ray);
+    float tEnter = 0.0f, tExit = tMax;
+    if (!Clip(this->levels[0], rayInv, tEnter, tExit))
+        return false;
+
+    bool isHit = false;
+    auto visitLeaf = [this, &intersectLeaf, &tMax, &isHit, stats](uint32_t index, float tCellExit)
+    {
+        GridCell const& cell = this->cells[index];
+        if (stats)
+            stats->nodeVisits++;
+        if (cell.count > 0)
+        {
+            if (stats)
+                stats->primitiveTests += cell.count;
+            if (intersectLeaf(cell.first, cell.count, tMax))
+            {
+                isHit = true;
+                if (AnyHit)
+                    return true;
+            }
+        }
+        return tMax <= tCellExit;
+    };
+
+    Walk(this->levels[0], rayInv, tEnter, tExit, [this, &rayInv, &visitLeaf, &tMax, stats](uint32_t index, float tCellExit)
+    {
+        GridCell const& cell = this->cells[index];
+        if (cell.count != SubgridCell)
+            return visitLeaf(index, tCellExit);
+
+        if (stats)
+            stats->nodeVisits++;
+        GridLevel const& subgrid = this->levels[cell.first];
+        float subEnter = 0.0f, subExit = std::min(tMax, tCellExit);
+        if (Clip(subgrid, rayInv, subEnter, subExit) && Walk(subgrid, rayInv, subEnter, subExit, visitLeaf))
+            return true;
+        return tMax <= tCellExit;
+    });
+
+    return isHit;
+}
@@ -0,0 +1,61 @@
+#include "instance.h"
+
+//------------------------------------------------------------------------------
+/**
+    Transform a point, unlike transform() this includes the translation
+*/
+static vec3
+TransformPoint(vec3 const& p, mat4 const& m)
+{
+    return transform(p, m) + get_position(m);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+Instance::Instance(Object* prototype, mat4 const& transform, uint32_t material) :
+    prototype(prototype),
+    transform(transform),
+    inverseTransform(inverse(transform)),
+    material(material)
+{
+    this->normalTransform = transpose(this->inverseTransform);
+
+    // bounds of the transformed corners of the prototype's bounds
+    AABB local = prototype->GetBounds();
+    for (int corner = 0; corner < 8; corner++)
+    {
+        vec3 p((corner & 1) ? local.max.x : local.min.x, (corner & 2) ? local.max.y : local.min.y, (corner & 4) ? local.max.z : local.min.z);
+        this->bounds.Grow(TransformPoint(p, transform));
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    The direction is transformed without normalizing it, so distances along
+    the ray are the same in both spaces and maxDist and the hit distance need
+    no conversion.
+*/
+HitResult
+Instance::Intersect(Ray ray, float maxDist)
+{
+    Ray local(TransformPoint(ray.b, this->inverseTransform), ::transform(ray.m, this->inverseTransform));
+    HitResult hit = this->prototype->Intersect(local, maxDist);
+    if (!hit.object)
+        return HitResult();
+
+    hit.p = ray.PointAt(hit.t);
+    hit.normal = normalize(::transform(hit.normal, this->normalTransform));
+    hit.object = this;
+    return hit;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+Instance::Occluded(Ray ray, float maxDist)
+{
+    Ray local(TransformPoint(ray.b, this->inverseTransform), ::transform(ray.m, this->inverseTransform));
+    return this->prototype->Occluded(local, maxDist);
+}
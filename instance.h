@@ -0,0 +1,48 @@
+#pragma once
+#include "object.h"
+#include "mat4.h"
+
+//------------------------------------------------------------------------------
+/**
+    A placed copy of another object. The prototype, typically a TriangleMesh
+    with its own BVH, is shared by every instance of it and is not added to the
+    raytracer itself. Rays are moved into the prototype's space instead of the
+    prototype being moved, so an instance costs the same few bytes whatever
+    the size of the prototype. Instances are bounded objects, so the object
+    BVH of the raytracer is the top level over all of them.
+*/
+class Instance : public Object
+{
+public:
+    // transform goes from the prototype's space to world space. The prototype has to outlive the instance
+    Instance(Object* prototype, mat4 const& transform, uint32_t material);
+
+    ~Instance() override
+    {
+
+    }
+
+    uint32_t GetMaterial() override
+    {
+        return this->material;
+    }
+
+    AABB GetBounds() override
+    {
+        return this->bounds;
+    }
+
+    HitResult Intersect(Ray ray, float maxDist) override;
+    bool Occluded(Ray ray, float maxDist) override;
+
+    Object* prototype;
+    mat4 transform;
+    // world to prototype space
+    mat4 inverseTransform;
+    // transposed inverse, takes normals back to world space
+    mat4 normalTransform;
+    uint32_t material;
+
+private:
+    AABB bounds;
+};
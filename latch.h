@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+//------------------------------------------------------------------------------
+/**
+    Countdown that Wait blocks on until CountDown has been called count times,
+    like std::latch (C++20) but reusable through Reset.
+    Waiting spins for a little while first, since the workers usually finish
+    right after the waiting thread runs out of work itself, and only then
+    sleeps on the condition variable.
+
+    The last CountDown may still be touching the latch after Wait returned, so
+    keep it alive longer than one round of work, e.g. as a member.
+*/
+class Latch
+{
+public:
+    // start a new round, nobody may be waiting on or counting down the previous one
+    void Reset(int count)
+    {
+        this->remaining.store(count, std::memory_order_relaxed);
+    }
+
+    void CountDown()
+    {
+        if (this->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            // taking the lock makes sure a waiter can't miss the notify between its check and its sleep
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->condition.notify_all();
+        }
+    }
+
+    void Wait()
+    {
+        for (int i = 0; i < SpinCount; i++)
+        {
+            if (this->remaining.load(std::memory_order_acquire) <= 0)
+                return;
+            std::this_thread::yield();
+        }
+
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->condition.wait(lock, [this] { return this->remaining.load(std::memory_order_acquire) <= 0; });
+    }
+
+private:
+    static constexpr int SpinCount = 64;
+
+    std::atomic<int> remaining{ 0 };
+    std::mutex mutex;
+    std::condition_variable condition;
+};
@@ -8,6 +8,8 @@
 #include "vec3.h"
 #include "raytracer.h"
 #include "sphere.h"
+#include "scene.h"
+#include "benchmark.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 
@@ -32,8 +34,66 @@ static void PrintAsBox(int BoxSize, std::vector<std::string> PrintStrings)
 	std::cout << " +" + std::string(BoxSize, '-') + "+\n";
 }
 
-void InteractiveLoop(unsigned w, unsigned h, int raysPerPixel, int maxBounces, int spheresAmount, bool multithread, unsigned int NumberOfJobs)
+/// Loads the mesh given with -obj, if any, and adds it or instances of it to the scene
+static TriangleMesh* AddMesh(Raytracer& rt, std::string const& objPath, int instances, double* loadSeconds = nullptr, double* buildSeconds = nullptr)
 {
+	if (objPath.empty())
+		return nullptr;
+
+	TriangleMesh* mesh = LoadMeshFromOBJ(rt, objPath, loadSeconds, buildSeconds);
+	if (!mesh)
+		return nullptr;
+
+	if (instances > 0)
+		AddInstanceGrid(rt, mesh, instances);
+	else
+		rt.AddObject(mesh);
+	return mesh;
+}
+
+/// Commandline options and their defaults, main fills them in and passes them on by reference
+struct Options
+{
+	unsigned w = 300;
+	unsigned h = 300;
+	int raysPerPixel = 1;
+	int maxBounces = 5;
+	int spheresAmount = 36;
+	bool multithread = false;
+	unsigned int NumberOfJobs = 50;
+	bool interactive = false;
+	Accelerator accelerator = Accelerator::BVH;
+	BVHBuilder builder = BVHBuilder::BinnedSAH;
+	BVHLayout layout = BVHLayout::BuildOrder;
+	bool benchmark = false;
+	int latencyFrames = 0;
+	bool tiledFrameBuffer = false;
+	bool framebufferBenchmark = false;
+	bool wavefront = false;
+	bool wavefrontBenchmark = false;
+	bool sortRays = false;
+	bool sortBenchmark = false;
+	bool packets = false;
+	bool packetBenchmark = false;
+	bool spatialSplitBenchmark = false;
+	bool layoutBenchmark = false;
+	bool gridBenchmark = false;
+	bool occlusionBenchmark = false;
+	int lights = 0;
+	bool nextEventEstimation = true;
+	bool nextEventBenchmark = false;
+	bool animate = false;
+	int refitFrames = 0;
+	std::string objPath;
+	int instances = 0;
+	std::string bvhCacheDirectory;
+};
+
+void InteractiveLoop(Options const& options)
+{
+	unsigned w = options.w;
+	unsigned h = options.h;
+
 	Display::Window wnd;
 
 	wnd.SetTitle("TrayRacer");
@@ -45,41 +105,25 @@ void InteractiveLoop(unsigned w, unsigned h, int raysPerPixel, int maxBounces, i
 
     framebuffer.resize(size_t(w * h));
 
-    Raytracer rt = Raytracer(w, h, framebuffer, raysPerPixel, maxBounces);
+    Raytracer rt = Raytracer(w, h, framebuffer, options.raysPerPixel, options.maxBounces);
+    rt.accelerator = options.accelerator;
+    rt.bvhBuilder = options.builder;
+    rt.bvhLayout = options.layout;
+    rt.tiledFrameBuffer = options.tiledFrameBuffer;
+    rt.wavefront = options.wavefront;
+    rt.sortRays = options.sortRays;
+    rt.packets = options.packets;
+    rt.bvhCacheDirectory = options.bvhCacheDirectory;
+    rt.nextEventEstimation = options.nextEventEstimation;
 
     // Create some objects
-	Material* mat = new Material();
-	mat->type = "Lambertian";
-	mat->color = { 0.5,0.5,0.5 };
-	mat->roughness = 0.3;
-	Sphere* ground = new Sphere(1000, { 0,-1000, -1 }, mat);
-	rt.AddObject(ground);
-
-	std::vector<std::string> Types = {"Lambertian", "Dielectric", "Conductor"};
-	std::vector<float> Spans = {10, 30, 25};
+	std::vector<Sphere*> spheres = CreateRandomSphereScene(rt, options.spheresAmount);
+	AddSphereLights(rt, options.lights);
+	AddMesh(rt, options.objPath, options.instances);
 
-    for (int it = 0; it < spheresAmount; it++)
-    {
-		Material* mat = new Material();
-		mat->type = Types[it % 3];
-		if (it % 3 == 1)
-			mat->refractionIndex = 1.65;
-		float r = RandomFloat();
-		float g = RandomFloat();
-		float b = RandomFloat();
-		mat->color = { r,g,b };
-		mat->roughness = RandomFloat();
-		const float span = Spans[it % 3];
-		Sphere* ground = new Sphere(
-			RandomFloat() * 0.7f + 0.2f,
-			{
-				RandomFloatNTP() * span,
-				RandomFloat() * span + 0.2f,
-				RandomFloatNTP() * span
-			},
-			mat);
-		rt.AddObject(ground);
-	}
+	std::vector<vec3> startPositions;
+	for (Sphere const* sphere : spheres)
+		startPositions.push_back(sphere->center);
 
 	bool exit = false;
 
@@ -149,6 +193,7 @@ void InteractiveLoop(unsigned w, unsigned h, int raysPerPixel, int maxBounces, i
 	framebufferCopy.resize(w * h);
 
 	auto end = std::chrono::high_resolution_clock::now();
+	auto animationStart = end;
 	while (wnd.IsOpen() && !exit)
     {
 		auto start = std::chrono::high_resolution_clock::now();
@@ -180,6 +225,21 @@ void InteractiveLoop(unsigned w, unsigned h, int raysPerPixel, int maxBounces, i
 
         rt.SetViewMatrix(cameraTransform);
 
+		if (options.animate)
+		{
+			AnimateSpheres(spheres, startPositions, std::chrono::duration<float>(start - animationStart).count());
+			rt.ObjectsMoved();
+
+			// done here instead of in the raytracer so the cost can be shown
+			auto refitStart = std::chrono::high_resolution_clock::now();
+			bool rebuilt = rt.RefitAccelerationStructure();
+			auto refitEnd = std::chrono::high_resolution_clock::now();
+			std::cout << (rebuilt ? "Rebuild: " : "Refit: ") << std::chrono::duration<double, std::milli>(refitEnd - refitStart).count() << " ms\n";
+
+			// accumulating frames of moving spheres would only smear them
+			resetFramebuffer = true;
+		}
+
 		if (resetFramebuffer)
 		{
 			rt.Clear();
@@ -187,8 +247,8 @@ void InteractiveLoop(unsigned w, unsigned h, int raysPerPixel, int maxBounces, i
 		}
 
 
-		if (multithread)
-			rt.RaytraceMultithreaded(NumberOfJobs);
+		if (options.multithread)
+			rt.RaytraceMultithreaded(options.NumberOfJobs);
 		else
 			rt.Raytrace();
 		frameIndex++;
@@ -217,47 +277,31 @@ void InteractiveLoop(unsigned w, unsigned h, int raysPerPixel, int maxBounces, i
 		wnd.Close();
 }
 
-void RenderOneFrame(unsigned w, unsigned h, int raysPerPixel, int maxBounces, int spheresAmount, bool multithread, unsigned int NumberOfJobs)
+void RenderOneFrame(Options const& options)
 {
+	unsigned w = options.w;
+	unsigned h = options.h;
+
 	std::vector<Color> framebuffer;
 
     framebuffer.resize(size_t(w * h));
 
-    Raytracer rt = Raytracer(w, h, framebuffer, raysPerPixel, maxBounces);
+    Raytracer rt = Raytracer(w, h, framebuffer, options.raysPerPixel, options.maxBounces);
+    rt.accelerator = options.accelerator;
+    rt.bvhBuilder = options.builder;
+    rt.bvhLayout = options.layout;
+    rt.tiledFrameBuffer = options.tiledFrameBuffer;
+    rt.wavefront = options.wavefront;
+    rt.sortRays = options.sortRays;
+    rt.packets = options.packets;
+    rt.bvhCacheDirectory = options.bvhCacheDirectory;
+    rt.nextEventEstimation = options.nextEventEstimation;
 
     // Create some objects
-	Material* mat = new Material();
-	mat->type = "Lambertian";
-	mat->color = { 0.5,0.5,0.5 };
-	mat->roughness = 0.3;
-	Sphere* ground = new Sphere(1000, { 0,-1000, -1 }, mat);
-	rt.AddObject(ground);
-
-	std::vector<std::string> Types = {"Lambertian", "Dielectric", "Conductor"};
-	std::vector<float> Spans = {10, 30, 25};
-
-    for (int it = 0; it < spheresAmount; it++)
-    {
-		Material* mat = new Material();
-		mat->type = Types[it % 3];
-		if (it % 3 == 1)
-			mat->refractionIndex = 1.65;
-		float r = RandomFloat();
-		float g = RandomFloat();
-		float b = RandomFloat();
-		mat->color = { r,g,b };
-		mat->roughness = RandomFloat();
-		const float span = Spans[it % 3];
-		Sphere* ground = new Sphere(
-			RandomFloat() * 0.7f + 0.2f,
-			{
-				RandomFloatNTP() * span,
-				RandomFloat() * span + 0.2f,
-				RandomFloatNTP() * span
-			},
-			mat);
-		rt.AddObject(ground);
-	}
+	CreateRandomSphereScene(rt, options.spheresAmount);
+	AddSphereLights(rt, options.lights);
+	double meshLoadSeconds = 0, meshBuildSeconds = 0;
+	TriangleMesh* mesh = AddMesh(rt, options.objPath, options.instances, &meshLoadSeconds, &meshBuildSeconds);
     
     // camera
     vec3 camPos = { 0,1.0f,10.0f };
@@ -276,12 +320,17 @@ void RenderOneFrame(unsigned w, unsigned h, int raysPerPixel, int maxBounces, in
         cameraTransform.m32 = camPos.z;
 
         rt.SetViewMatrix(cameraTransform);
+
+		auto buildStart = std::chrono::high_resolution_clock::now();
+		rt.BuildAccelerationStructure();
+		auto buildEnd = std::chrono::high_resolution_clock::now();
+		auto buildDuration = std::chrono::duration_cast<std::chrono::milliseconds>(buildEnd - buildStart);
         
 		int NumberOfRays;
 		auto start = std::chrono::high_resolution_clock::now();
 
-		if (multithread)
-			NumberOfRays = rt.RaytraceMultithreaded(NumberOfJobs);
+		if (options.multithread)
+			NumberOfRays = rt.RaytraceMultithreaded(options.NumberOfJobs);
 		else
 			NumberOfRays = rt.Raytrace();
 
@@ -290,14 +339,33 @@ void RenderOneFrame(unsigned w, unsigned h, int raysPerPixel, int maxBounces, in
 
 		PrintAsBox(40, {
 			"TRAYRACER INFO", "",
-			std::string("Multithreaded: ").append(multithread ? "True" : "False"),
+			std::string("Multithreaded: ").append(options.multithread ? "True" : "False"),
+			std::string("Framebuffer: ").append(options.tiledFrameBuffer ? "Tiled" : "Linear"),
+			std::string("Wavefront: ").append(options.wavefront ? "True" : "False"),
+			std::string("Ray Sorting: ").append(options.wavefront && options.sortRays ? "True" : "False"),
+			std::string("Packets: ").append(options.packets && !options.wavefront && rt.SupportsPackets() ? "True" : "False"),
+			std::string("Precision: ").append(sizeof(Real) == sizeof(double) ? "Double" : "Float"),
+			std::string("Accelerator: ").append(AcceleratorName(options.accelerator)),
+			std::string("BVH Builder: ").append(BVHBuilderName(options.builder)),
+			std::string("BVH Layout: ").append(BVHLayoutName(options.layout)),
+			"BVH Build Time: " + std::to_string(buildDuration.count()/1000.0f),
+			"BVH Cache: " + (options.bvhCacheDirectory.empty() ? std::string("Off") : options.bvhCacheDirectory),
+			std::string("BVH From Cache: ").append(rt.BVHFromCache() ? "True" : "False"),
+			"BVH Nodes: " + std::to_string(rt.GetBVH().nodes.size()),
 			"Time " + std::to_string(duration.count()/1000.0f),
 			"Number of Rays: " + std::to_string(NumberOfRays),
 			"MRays/s: " + std::to_string((NumberOfRays/1'000'000.0f)/(duration.count()/1000.0f)),
 			"Resolution: " + std::to_string(w) + "x" + std::to_string(h),
-			"Rays Per Pixel: " + std::to_string(raysPerPixel),
-			"Max Bounces: " + std::to_string(maxBounces),
-			"Number of Sphere: " + std::to_string(spheresAmount),
+			"Rays Per Pixel: " + std::to_string(options.raysPerPixel),
+			"Max Bounces: " + std::to_string(options.maxBounces),
+			"Number of Sphere: " + std::to_string(options.spheresAmount),
+			"Lights: " + std::to_string(rt.LightCount()),
+			std::string("Next Event Estimation: ").append(rt.SamplesLights() ? "True" : "False"),
+			"Mesh Triangles: " + std::to_string(mesh ? mesh->TriangleCount() : 0),
+			"Mesh Load Time: " + std::to_string(meshLoadSeconds),
+			"Mesh BVH Build Time: " + std::to_string(meshBuildSeconds),
+			std::string("Mesh BVH From Cache: ").append(mesh && mesh->BVHFromCache() ? "True" : "False"),
+			"Mesh Instances: " + std::to_string(mesh ? std::max(options.instances, 1) : 0),
 		});
 
 		std::vector<uint8_t> framebufferInt;
@@ -318,67 +386,214 @@ void RenderOneFrame(unsigned w, unsigned h, int raysPerPixel, int maxBounces, in
 
 int main(int argc, char *argv[])
 { 
-	// Default values that can be overriden by commandline arguments
-	unsigned w = 300;
-	unsigned h = 300;
-    int raysPerPixel = 1;
-    int maxBounces = 5;
-	int spheresAmount = 36;
-	bool multithread = false;
-	unsigned int NumberOfJobs = 50;
-	bool interactive = false;
+	Options options;
 
 	for (int i = 0; i < argc; i++)
 	{
 		if (std::string(argv[i]).compare("-w") == 0)
 		{
 			i++;
-			w = std::stoi(argv[i]);
+			options.w = std::stoi(argv[i]);
 		}
 		else if (std::string(argv[i]).compare("-h") == 0)
 		{
 			i++;
-			h = std::stoi(argv[i]);
+			options.h = std::stoi(argv[i]);
 		}
 		else if (std::string(argv[i]).compare("-wh") == 0)
 		{
 			i++;
-			w = h = std::stoi(argv[i]);
+			options.w = options.h = std::stoi(argv[i]);
 		}
 		else if (std::string(argv[i]).compare("-rpp") == 0)
 		{
 			i++;
-			raysPerPixel = std::stoi(argv[i]);
+			options.raysPerPixel = std::stoi(argv[i]);
 		}
 		else if (std::string(argv[i]).compare("-b") == 0)
 		{
 			i++;
-			maxBounces = std::stoi(argv[i]);
+			options.maxBounces = std::stoi(argv[i]);
 		}
 		else if (std::string(argv[i]).compare("-s") == 0)
 		{
 			i++;
-			spheresAmount = std::stoi(argv[i]);
+			options.spheresAmount = std::stoi(argv[i]);
 		}
 		else if (std::string(argv[i]).compare("-m") == 0)
 		{
-			multithread = true;
+			options.multithread = true;
 		}
 		else if (std::string(argv[i]).compare("-i") == 0)
 		{
-			interactive = true;
+			options.interactive = true;
 		}
 		else if (std::string(argv[i]).compare("-j") == 0)
 		{
 			i++;
-			NumberOfJobs = std::stoi(argv[i]);
+			options.NumberOfJobs = std::stoi(argv[i]);
+		}
+		else if (std::string(argv[i]).compare("-linear") == 0)
+		{
+			options.accelerator = Accelerator::Linear;
+		}
+		else if (std::string(argv[i]).compare("-accel") == 0)
+		{
+			i++;
+			if (!AcceleratorFromName(argv[i], options.accelerator))
+				std::cout << "Unknown accelerator " << argv[i] << ", using " << AcceleratorName(options.accelerator) << "\n";
+		}
+		else if (std::string(argv[i]).compare("-sweep") == 0)
+		{
+			options.builder = BVHBuilder::SweepSAH;
+		}
+		else if (std::string(argv[i]).compare("-lbvh") == 0)
+		{
+			options.builder = BVHBuilder::Linear;
+		}
+		else if (std::string(argv[i]).compare("-sbvh") == 0)
+		{
+			options.builder = BVHBuilder::SpatialSAH;
+		}
+		else if (std::string(argv[i]).compare("-layout") == 0)
+		{
+			i++;
+			std::string name = argv[i];
+			if (name == "build")
+				options.layout = BVHLayout::BuildOrder;
+			else if (name == "dfs")
+				options.layout = BVHLayout::DepthFirst;
+			else if (name == "treelet")
+				options.layout = BVHLayout::Treelet;
+			else
+				std::cout << "Unknown BVH layout " << name << ", using " << BVHLayoutName(options.layout) << "\n";
+		}
+		else if (std::string(argv[i]).compare("-sbvhbench") == 0)
+		{
+			options.spatialSplitBenchmark = true;
+		}
+		else if (std::string(argv[i]).compare("-gridbench") == 0)
+		{
+			options.gridBenchmark = true;
+		}
+		else if (std::string(argv[i]).compare("-occlusionbench") == 0)
+		{
+			options.occlusionBenchmark = true;
+		}
+		else if (std::string(argv[i]).compare("-lights") == 0)
+		{
+			i++;
+			options.lights = std::stoi(argv[i]);
+		}
+		else if (std::string(argv[i]).compare("-nonee") == 0)
+		{
+			options.nextEventEstimation = false;
+		}
+		else if (std::string(argv[i]).compare("-neebench") == 0)
+		{
+			options.nextEventBenchmark = true;
+		}
+		else if (std::string(argv[i]).compare("-layoutbench") == 0)
+		{
+			options.layoutBenchmark = true;
+		}
+		else if (std::string(argv[i]).compare("-bench") == 0)
+		{
+			options.benchmark = true;
+		}
+		else if (std::string(argv[i]).compare("-tiledfb") == 0)
+		{
+			options.tiledFrameBuffer = true;
+		}
+		else if (std::string(argv[i]).compare("-wavefront") == 0)
+		{
+			options.wavefront = true;
+		}
+		else if (std::string(argv[i]).compare("-sortrays") == 0)
+		{
+			// only the wavefront tracer has batches of rays to sort
+			options.wavefront = true;
+			options.sortRays = true;
+		}
+		else if (std::string(argv[i]).compare("-sortbench") == 0)
+		{
+			options.sortBenchmark = true;
+		}
+		else if (std::string(argv[i]).compare("-wavefrontbench") == 0)
+		{
+			options.wavefrontBenchmark = true;
+		}
+		else if (std::string(argv[i]).compare("-obj") == 0)
+		{
+			i++;
+			options.objPath = argv[i];
+		}
+		else if (std::string(argv[i]).compare("-instances") == 0)
+		{
+			i++;
+			options.instances = std::stoi(argv[i]);
+		}
+		else if (std::string(argv[i]).compare("-bvhcache") == 0)
+		{
+			i++;
+			options.bvhCacheDirectory = argv[i];
+		}
+		else if (std::string(argv[i]).compare("-packets") == 0)
+		{
+			options.packets = true;
+		}
+		else if (std::string(argv[i]).compare("-packetbench") == 0)
+		{
+			options.packetBenchmark = true;
+		}
+		else if (std::string(argv[i]).compare("-animate") == 0)
+		{
+			options.animate = true;
+		}
+		else if (std::string(argv[i]).compare("-animbench") == 0)
+		{
+			i++;
+			options.refitFrames = std::stoi(argv[i]);
+		}
+		else if (std::string(argv[i]).compare("-fbbench") == 0)
+		{
+			options.framebufferBenchmark = true;
+		}
+		else if (std::string(argv[i]).compare("-latency") == 0)
+		{
+			i++;
+			options.latencyFrames = std::stoi(argv[i]);
 		}
 	}
 
-	if (interactive)
-		InteractiveLoop(w, h, raysPerPixel, maxBounces, spheresAmount, multithread, NumberOfJobs);
+	if (options.benchmark)
+		BenchmarkAccelerators(options.w, options.h, options.spheresAmount);
+	else if (options.wavefrontBenchmark)
+		BenchmarkWavefront(options.w, options.h, options.raysPerPixel, options.spheresAmount);
+	else if (options.sortBenchmark)
+		BenchmarkRaySorting(options.w, options.h, options.raysPerPixel, options.spheresAmount);
+	else if (options.packetBenchmark)
+		BenchmarkPackets(options.w, options.h, options.spheresAmount);
+	else if (options.spatialSplitBenchmark)
+		BenchmarkSpatialSplits(options.w, options.h, options.spheresAmount);
+	else if (options.layoutBenchmark)
+		BenchmarkNodeLayout(options.w, options.h, options.spheresAmount);
+	else if (options.gridBenchmark)
+		BenchmarkGrid(options.w, options.h);
+	else if (options.occlusionBenchmark)
+		BenchmarkOcclusion(options.w, options.h, options.spheresAmount);
+	else if (options.nextEventBenchmark)
+		BenchmarkNextEventEstimation(options.w, options.h, options.maxBounces, options.spheresAmount, std::max(options.lights, 1));
+	else if (options.framebufferBenchmark)
+		BenchmarkFrameBufferLayout(3840, 2160);
+	else if (options.latencyFrames > 0)
+		BenchmarkFrameLatency(options.w, options.h, options.raysPerPixel, options.maxBounces, options.spheresAmount, options.NumberOfJobs, options.latencyFrames);
+	else if (options.refitFrames > 0)
+		BenchmarkRefit(options.w, options.h, options.raysPerPixel, options.maxBounces, options.spheresAmount, options.NumberOfJobs, options.refitFrames);
+	else if (options.interactive)
+		InteractiveLoop(options);
 	else
-		RenderOneFrame(w, h, raysPerPixel, maxBounces, spheresAmount, multithread, NumberOfJobs);
+		RenderOneFrame(options);
 
     return 0;
 } 
@@ -0,0 +1,78 @@
+#include "mappedfile.h"
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//------------------------------------------------------------------------------
+/**
+*/
+std::shared_ptr<MappedFile>
+MappedFile::Open(std::string const& path)
+{
+    std::shared_ptr<MappedFile> mapped(new MappedFile());
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return nullptr;
+    mapped->file = file;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+        return nullptr;
+
+    mapped->mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if (!mapped->mapping)
+        return nullptr;
+
+    mapped->data = static_cast<char*>(MapViewOfFile(mapped->mapping, FILE_MAP_COPY, 0, 0, 0));
+    if (!mapped->data)
+        return nullptr;
+    mapped->size = size_t(size.QuadPart);
+#else
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0)
+        return nullptr;
+
+    struct stat status;
+    if (fstat(file, &status) != 0 || status.st_size <= 0)
+    {
+        close(file);
+        return nullptr;
+    }
+
+    // the mapping keeps its own reference to the file
+    void* data = mmap(nullptr, size_t(status.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+    close(file);
+    if (data == MAP_FAILED)
+        return nullptr;
+
+    mapped->data = static_cast<char*>(data);
+    mapped->size = size_t(status.st_size);
+#endif
+    return mapped;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+MappedFile::~MappedFile()
+{
+#if defined(_WIN32)
+    if (this->data)
+        UnmapViewOfFile(this->data);
+    if (this->mapping)
+        CloseHandle(this->mapping);
+    if (this->file)
+        CloseHandle(this->file);
+#else
+    if (this->data)
+        munmap(this->data, this->size);
+#endif
+}
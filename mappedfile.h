@@ -0,0 +1,138 @@
+#pragma once
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------
+/**
+    A whole file mapped into memory copy on write. Writes go to private pages
+    of this process and never reach the file, so whatever lives in the mapping
+    can be modified in place like any other memory.
+*/
+class MappedFile
+{
+public:
+    // returns nullptr if the file can't be opened or is empty
+    static std::shared_ptr<MappedFile> Open(std::string const& path);
+    ~MappedFile();
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    char* Data() const { return this->data; }
+    size_t Size() const { return this->size; }
+
+private:
+    MappedFile() = default;
+
+    char* data = nullptr;
+    size_t size = 0;
+#if defined(_WIN32)
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
+
+//------------------------------------------------------------------------------
+/**
+    Array whose elements are either in a vector of its own or inside a mapped
+    file, which the array keeps alive. Has the read side of std::vector, so
+    code that only looks at the elements doesn't care where they are.
+    Copies always get a vector of their own.
+*/
+template<typename T>
+class MappedArray
+{
+public:
+    MappedArray() = default;
+    MappedArray(MappedArray const& other) { *this = other; }
+    MappedArray(MappedArray&& other) noexcept { *this = std::move(other); }
+    MappedArray& operator=(MappedArray const& other);
+    MappedArray& operator=(MappedArray&& other) noexcept;
+
+    // take over the elements of a vector
+    void Assign(std::vector<T>&& values);
+    // point at count elements at offset bytes into file, which has to be aligned for T
+    void Map(std::shared_ptr<MappedFile> file, size_t offset, size_t count);
+    // true if the elements live in a mapped file
+    bool IsMapped() const { return this->file != nullptr; }
+
+    void clear() { this->Assign(std::vector<T>()); }
+    size_t size() const { return this->count; }
+    bool empty() const { return this->count == 0; }
+    T* data() { return this->elements; }
+    T const* data() const { return this->elements; }
+    T& operator[](size_t i) { return this->elements[i]; }
+    T const& operator[](size_t i) const { return this->elements[i]; }
+    T* begin() { return this->elements; }
+    T* end() { return this->elements + this->count; }
+    T const* begin() const { return this->elements; }
+    T const* end() const { return this->elements + this->count; }
+
+private:
+    std::vector<T> owned;
+    std::shared_ptr<MappedFile> file;
+    T* elements = nullptr;
+    size_t count = 0;
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<typename T>
+inline MappedArray<T>&
+MappedArray<T>::operator=(MappedArray const& other)
+{
+    if (this != &other)
+        this->Assign(std::vector<T>(other.begin(), other.end()));
+    return *this;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Moving a vector keeps its buffer, so elements stays valid either way.
+*/
+template<typename T>
+inline MappedArray<T>&
+MappedArray<T>::operator=(MappedArray&& other) noexcept
+{
+    if (this != &other)
+    {
+        this->owned = std::move(other.owned);
+        this->file = std::move(other.file);
+        this->elements = other.elements;
+        this->count = other.count;
+        other.owned.clear();
+        other.file.reset();
+        other.elements = nullptr;
+        other.count = 0;
+    }
+    return *this;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<typename T>
+inline void
+MappedArray<T>::Assign(std::vector<T>&& values)
+{
+    this->owned = std::move(values);
+    this->file.reset();
+    this->elements = this->owned.data();
+    this->count = this->owned.size();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<typename T>
+inline void
+MappedArray<T>::Map(std::shared_ptr<MappedFile> file, size_t offset, size_t count)
+{
+    this->owned = std::vector<T>();
+    this->elements = reinterpret_cast<T*>(file->Data() + offset);
+    this->count = count;
+    this->file = std::move(file);
+}
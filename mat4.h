@@ -102,7 +102,7 @@ TBN(vec3 normal)
 
         ret.m20 = b;
         ret.m21 = 1.0f - normal.y * normal.y * a;
-        ret.m22 = normal.y;
+        ret.m22 = -normal.y;
         ret.m23 = 0.0f;
     }
 
@@ -203,6 +203,19 @@ multiply(mat4 b, mat4 a)
              b.m03*a.m30 + b.m13*a.m31 + b.m23*a.m32 + b.m33*a.m33 };
 }
 
+//------------------------------------------------------------------------------
+/**
+    Uniform scale
+*/
+inline mat4
+scaling(float s)
+{
+    return { s, 0, 0, 0,
+             0, s, 0, 0,
+             0, 0, s, 0,
+             0, 0, 0, 1 };
+}
+
 //------------------------------------------------------------------------------
 /**
 */
@@ -1,5 +1,6 @@
 #include "material.h"
 #include "pbr.h"
+#include <algorithm>
 #include <time.h>
 #include "mat4.h"
 #include "sphere.h"
@@ -8,77 +9,220 @@
 //------------------------------------------------------------------------------
 /**
 */
-Ray
-BSDF(Material const* const material, Ray ray, vec3 point, vec3 normal)
+MaterialType
+MaterialTypeFromName(std::string const& name)
+{
+    if (name == "Dielectric")
+        return MaterialType::Dielectric;
+    if (name == "Conductor")
+        return MaterialType::Conductor;
+    if (name == "Emissive")
+        return MaterialType::Emissive;
+    return MaterialType::Lambertian;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+Material
+CreateMaterial(std::string const& type, Color color, float roughness, float refractionIndex)
 {
+    Material material;
+    material.type = MaterialTypeFromName(type);
+    material.color = color;
+    material.roughness = roughness;
+    material.refractionIndex = refractionIndex;
+
+    switch (material.type)
+    {
+    case MaterialType::Conductor:
+        material.F0 = 0.95f;
+        break;
+    case MaterialType::Dielectric:
+        // fresnel reflectance at 0 deg incidence angle
+        material.F0 = powf(refractionIndex - 1, 2) / powf(refractionIndex + 1, 2);
+        break;
+    case MaterialType::Emissive:
+        material.F0 = 0.0f;
+        break;
+    default:
+        material.F0 = 0.04f;
+        break;
+    }
+    return material;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Opaque surfaces are two sided, turn the normal to the side the ray came from.
+    Mesh normals follow the triangle winding, so back faces are hit all the time
+*/
+static vec3
+FaceForward(vec3 normal, Ray const& ray)
+{
+    return dot(normal, ray.m) > 0 ? -normal : normal;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Lambertian and conductor, either reflect on a microfacet or scatter diffusely
+*/
+static Ray
+ScatterMicrofacet(Material const& material, Ray const& ray, vec3 point, vec3 normal, RandomStream& rng)
+{
+    normal = FaceForward(normal, ray);
     float cosTheta = -dot(normalize(ray.m), normalize(normal));
 
-    if (material->type != "Dielectric")
+    // probability that a ray will reflect on a microfacet
+    float F = FresnelSchlick(cosTheta, material.F0, material.roughness);
+
+    float r = rng.Float();
+
+    if (r < F)
     {
-        float F0 = 0.04f;
-        if (material->type == "Conductor")
-        {
-            F0 = 0.95f;
-        }
-
-        // probability that a ray will reflect on a microfacet
-        float F = FresnelSchlick(cosTheta, F0, material->roughness);
-
-        float r = RandomFloat();
-
-        if (r < F)
-        {
-            mat4 basis = TBN(normal);
-            // importance sample with brdf specular lobe
-            vec3 H = ImportanceSampleGGX_VNDF(RandomFloat(), RandomFloat(), material->roughness, ray.m, basis);
-            vec3 reflected = reflect(ray.m, H);
-            return { point, normalize(reflected) };
-        }
-        else
-        {
-            return { point, normalize(normalize(normal) + random_point_on_unit_sphere()) };
-        }
+        mat4 basis = TBN(normal);
+        // importance sample with brdf specular lobe
+        // drawn one at a time so the order doesn't depend on argument evaluation
+        float u1 = rng.Float();
+        float u2 = rng.Float();
+        vec3 H = ImportanceSampleGGX_VNDF(u1, u2, material.roughness, ray.m, basis);
+        vec3 reflected = reflect(ray.m, H);
+        return { point, normalize(reflected) };
     }
     else
     {
-        vec3 outwardNormal;
-        float niOverNt;
-        vec3 refracted;
-        float reflect_prob;
-        float cosine;
-        vec3 rayDir = ray.m;
-
-        if (cosTheta <= 0)
-        {
-            outwardNormal = -normal;
-            niOverNt = material->refractionIndex;
-            cosine = cosTheta * niOverNt / len(rayDir);
-        }
-        else
-        {
-            outwardNormal = normal;
-            niOverNt = 1.0 / material->refractionIndex;
-            cosine = cosTheta / len(rayDir);
-        }
-
-        if (Refract(normalize(rayDir), outwardNormal, niOverNt, refracted))
-        {
-            // fresnel reflectance at 0 deg incidence angle
-            float F0 = powf(material->refractionIndex - 1, 2) / powf(material->refractionIndex + 1, 2);
-            reflect_prob = FresnelSchlick(cosine, F0, material->roughness);
-        }
-        else
-        {
-            reflect_prob = 1.0;
-        }
-        if (RandomFloat() < reflect_prob)
-        {
-            vec3 reflected = reflect(rayDir, normal);
-            return { point, reflected };
-        }
-        else
-        {
-            return { point, refracted };
-        }
+        return { point, normalize(normalize(normal) + random_point_on_unit_sphere(rng)) };
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static Ray
+ScatterDielectric(Material const& material, Ray const& ray, vec3 point, vec3 normal, RandomStream& rng)
+{
+    float cosTheta = -dot(normalize(ray.m), normalize(normal));
+
+    vec3 outwardNormal;
+    float niOverNt;
+    vec3 refracted;
+    float reflect_prob;
+    float cosine;
+    vec3 rayDir = ray.m;
+
+    if (cosTheta <= 0)
+    {
+        outwardNormal = -normal;
+        niOverNt = material.refractionIndex;
+        cosine = cosTheta * niOverNt / len(rayDir);
+    }
+    else
+    {
+        outwardNormal = normal;
+        niOverNt = 1.0 / material.refractionIndex;
+        cosine = cosTheta / len(rayDir);
+    }
+
+    if (Refract(normalize(rayDir), outwardNormal, niOverNt, refracted))
+    {
+        reflect_prob = FresnelSchlick(cosine, material.F0, material.roughness);
+    }
+    else
+    {
+        reflect_prob = 1.0;
+    }
+    if (rng.Float() < reflect_prob)
+    {
+        vec3 reflected = reflect(rayDir, normal);
+        return { point, reflected };
+    }
+    else
+    {
+        return { point, refracted };
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<>
+Ray
+Scatter<MaterialType::Lambertian>(Material const& material, Ray const& ray, vec3 point, vec3 normal, RandomStream& rng)
+{
+    return ScatterMicrofacet(material, ray, point, normal, rng);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<>
+Ray
+Scatter<MaterialType::Conductor>(Material const& material, Ray const& ray, vec3 point, vec3 normal, RandomStream& rng)
+{
+    return ScatterMicrofacet(material, ray, point, normal, rng);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<>
+Ray
+Scatter<MaterialType::Dielectric>(Material const& material, Ray const& ray, vec3 point, vec3 normal, RandomStream& rng)
+{
+    return ScatterDielectric(material, ray, point, normal, rng);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+Ray
+BSDF(Material const& material, Ray ray, vec3 point, vec3 normal, RandomStream& rng)
+{
+    switch (material.type)
+    {
+    case MaterialType::Dielectric:
+        return Scatter<MaterialType::Dielectric>(material, ray, point, normal, rng);
+    case MaterialType::Conductor:
+        return Scatter<MaterialType::Conductor>(material, ray, point, normal, rng);
+    default:
+        return Scatter<MaterialType::Lambertian>(material, ray, point, normal, rng);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Mixture of the two lobes of ScatterMicrofacet: the GGX reflection it picks
+    with probability F, sampled from the visible normals, and the cosine lobe
+    otherwise.
+*/
+float
+ScatterPdf(Material const& material, Ray const& ray, vec3 normal, vec3 direction)
+{
+    if (material.type == MaterialType::Dielectric || material.type == MaterialType::Emissive)
+        return 0.0f;
+
+    vec3 n = normalize(FaceForward(normal, ray));
+    vec3 v = -normalize(ray.m);
+    vec3 l = normalize(direction);
+    float cosTheta = float(dot(v, n));
+    float cosLight = float(dot(l, n));
+    if (cosLight <= 0.0f)
+        return 0.0f;
+
+    float F = FresnelSchlick(cosTheta, material.F0, material.roughness);
+    float diffuse = cosLight * float(1.0 / MPI);
+
+    float specular = 0.0f;
+    if (cosTheta > 0.0f)
+    {
+        // D(h) * G1(v) / (4 * n.v), the density of reflecting around a visible normal
+        float alpha = std::max(material.roughness * material.roughness, 1e-6f);
+        float alpha2 = alpha * alpha;
+        float cosHalf = float(dot(normalize(v + l), n));
+        float d = cosHalf * cosHalf * (alpha2 - 1.0f) + 1.0f;
+        float D = alpha2 / (float(MPI) * d * d);
+        float G1 = 2.0f * cosTheta / (cosTheta + sqrtf(alpha2 + (1.0f - alpha2) * cosTheta * cosTheta));
+        specular = D * G1 / (4.0f * cosTheta);
     }
-}
\ No newline at end of file
+    return F * specular + (1.0f - F) * diffuse;
+}
@@ -2,29 +2,77 @@
 #include "color.h"
 #include "ray.h"
 #include "vec3.h"
+#include "random.h"
+#include <stdint.h>
 #include <string>
 
 //------------------------------------------------------------------------------
 /**
+    Obviously, "lambertian" materials are dielectric, but we separate them here
+    just because figuring out a good IOR for ex. plastics is too much work
+*/
+enum class MaterialType : uint32_t
+{
+    Lambertian,
+    Dielectric,
+    Conductor,
+    // a light, color is the radiance it gives off. Paths end when they hit one
+    Emissive,
+};
+
+// "Lambertian", "Dielectric", "Conductor" or "Emissive". Anything else is treated as Lambertian
+MaterialType MaterialTypeFromName(std::string const& name);
+
+//------------------------------------------------------------------------------
+/**
+    Plain data, the raytracer keeps all materials in one table and objects
+    refer to them by index. Create them with CreateMaterial so F0 is filled in.
 */
 struct Material
 {
-    
-    /*
-        type can be "Lambertian", "Dielectric" or "Conductor".
-        Obviously, "lambertian" materials are dielectric, but we separate them here
-        just because figuring out a good IOR for ex. plastics is too much work
-    */
-    std::string type = "Lambertian";
+    MaterialType type = MaterialType::Lambertian;
     Color color = {0.5f,0.5f,0.5f};
     float roughness = 0.75;
 
     // this is only needed for dielectric materials.
     float refractionIndex = 1.44;
+
+    // reflectance at normal incidence. Fixed for lambertian and conductor,
+    // (ior - 1)^2 / (ior + 1)^2 for dielectrics
+    float F0 = 0.04f;
 };
 
+//------------------------------------------------------------------------------
+/**
+    Build a material from its type name and precompute its constants
+*/
+Material CreateMaterial(std::string const& type, Color color, float roughness, float refractionIndex = 1.44f);
+
 //------------------------------------------------------------------------------
 /**
     Scatter ray against material
 */
-Ray BSDF(Material const* const material, Ray ray, vec3 point, vec3 normal);
\ No newline at end of file
+Ray BSDF(Material const& material, Ray ray, vec3 point, vec3 normal, RandomStream& rng);
+
+//------------------------------------------------------------------------------
+/**
+    Probability density over solid angle of BSDF scattering the ray that hit
+    point with normal into direction. Every scattered ray is weighted by just
+    the material color, so the BSDF times the cosine is color * ScatterPdf,
+    which is what light sampling evaluates it with. Dielectrics only scatter
+    into the reflected and refracted direction, which light sampling can
+    never hit, so they give 0.
+*/
+float ScatterPdf(Material const& material, Ray const& ray, vec3 normal, vec3 direction);
+
+//------------------------------------------------------------------------------
+/**
+    Same as BSDF for a material known to be of type Type, for loops over rays
+    that have already been grouped by material type
+*/
+template<MaterialType Type>
+Ray Scatter(Material const& material, Ray const& ray, vec3 point, vec3 normal, RandomStream& rng);
+
+template<> Ray Scatter<MaterialType::Lambertian>(Material const& material, Ray const& ray, vec3 point, vec3 normal, RandomStream& rng);
+template<> Ray Scatter<MaterialType::Dielectric>(Material const& material, Ray const& ray, vec3 point, vec3 normal, RandomStream& rng);
+template<> Ray Scatter<MaterialType::Conductor>(Material const& material, Ray const& ray, vec3 point, vec3 normal, RandomStream& rng);
@@ -0,0 +1,72 @@
+#include "mesh.h"
+#include "bvhcache.h"
+
+//------------------------------------------------------------------------------
+/**
+*/
+TriangleMesh::TriangleMesh(std::vector<vec3> positions, std::vector<uint32_t> indices, uint32_t material, TaskRunner const& runTasks,
+                           std::string const& cacheDirectory) :
+    positions(std::move(positions)),
+    indices(std::move(indices)),
+    material(material)
+{
+    uint32_t numTriangles = this->TriangleCount();
+    std::vector<AABB> triangleBounds(numTriangles);
+    for (uint32_t i = 0; i < numTriangles; i++)
+    {
+        for (int vertex = 0; vertex < 3; vertex++)
+            triangleBounds[i].Grow(this->positions[this->indices[i * 3 + vertex]]);
+        this->bounds.Grow(triangleBounds[i]);
+    }
+
+    this->bvhFromCache = BuildCachedBVH(this->bvh, triangleBounds, BVHBuilder::BinnedSAH, runTasks, cacheDirectory);
+
+    // store the triangles in leaf order, so every leaf is a contiguous range in the pack
+    this->triangles.Resize(numTriangles);
+    for (uint32_t i = 0; i < numTriangles; i++)
+    {
+        uint32_t const* triangle = &this->indices[this->bvh.primitiveIndices[i] * 3];
+        this->triangles.Set(i, this->positions[triangle[0]], this->positions[triangle[1]], this->positions[triangle[2]]);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+HitResult
+TriangleMesh::Intersect(Ray ray, float maxDist)
+{
+    WatertightRay watertight(ray);
+    uint32_t hitTriangle = 0;
+    auto intersectLeaf = [this, &watertight, &hitTriangle](uint32_t first, uint32_t count, float& tMax)
+    {
+        return this->triangles.Intersect(watertight, first, count, tMax, hitTriangle);
+    };
+
+    float t = maxDist;
+    if (!this->bvh.Intersect(ray, t, intersectLeaf))
+        return HitResult();
+
+    HitResult hit;
+    hit.p = ray.PointAt(t);
+    hit.normal = normalize(this->triangles.Normal(hitTriangle));
+    hit.t = t;
+    hit.object = this;
+    return hit;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Any triangle in range will do, so the walk stops at the first leaf with a hit
+*/
+bool
+TriangleMesh::Occluded(Ray ray, float maxDist)
+{
+    WatertightRay watertight(ray);
+    auto occludedLeaf = [this, &watertight](uint32_t first, uint32_t count, float& tMax)
+    {
+        uint32_t hitTriangle;
+        return this->triangles.Intersect(watertight, first, count, tMax, hitTriangle);
+    };
+    return this->bvh.Occluded(ray, maxDist, occludedLeaf);
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include <string>
+#include "object.h"
+#include "bvh.h"
+#include "trianglepack.h"
+
+//------------------------------------------------------------------------------
+/**
+    Indexed triangle mesh with one material. Every mesh has a BVH over its own
+    triangles and the raytracer only sees its bounds, so a mesh is a single
+    primitive in the scene's object hierarchy no matter how many triangles it has.
+    Hit normals follow the winding order and are not turned towards the ray,
+    opaque materials shade both sides the same, dielectrics treat the side the
+    normal points to as outside.
+*/
+class TriangleMesh : public Object
+{
+public:
+    // three indices per triangle into positions. Builds the triangle BVH right away,
+    // in parallel if a task runner is given, or loads it from cacheDirectory if it was built before
+    TriangleMesh(std::vector<vec3> positions, std::vector<uint32_t> indices, uint32_t material, TaskRunner const& runTasks = nullptr,
+                 std::string const& cacheDirectory = std::string());
+
+    ~TriangleMesh() override
+    {
+
+    }
+
+    uint32_t GetMaterial() override
+    {
+        return this->material;
+    }
+
+    AABB GetBounds() override
+    {
+        return this->bounds;
+    }
+
+    HitResult Intersect(Ray ray, float maxDist) override;
+    bool Occluded(Ray ray, float maxDist) override;
+
+    uint32_t TriangleCount() const { return uint32_t(this->indices.size() / 3); }
+
+    // nodes in the triangle BVH
+    size_t NodeCount() const { return this->bvh.nodes.size(); }
+
+    // true if the triangle BVH came from the cache
+    bool BVHFromCache() const { return this->bvhFromCache; }
+
+    std::vector<vec3> positions;
+    std::vector<uint32_t> indices;
+    uint32_t material;
+
+private:
+    AABB bounds;
+    BVH bvh;
+    bool bvhFromCache = false;
+    // the triangles again, in the order of the BVH leaves
+    TrianglePack triangles;
+};
@@ -0,0 +1,41 @@
+#pragma once
+#include <stdint.h>
+#include <algorithm>
+#include "vec3.h"
+#include "aabb.h"
+
+//------------------------------------------------------------------------------
+/**
+    Spread the lower 10 bits of v out so there are two zero bits between each
+*/
+inline uint32_t
+ExpandBits10(uint32_t v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+//------------------------------------------------------------------------------
+/**
+    30 bit Morton code of a point inside bounds, 10 bits per axis.
+    Points that are close in space get close codes, points outside are clamped.
+*/
+inline uint32_t
+MortonCode(vec3 const& p, AABB const& bounds)
+{
+    auto quantize = [](float value, float min, float max)
+    {
+        float extent = max - min;
+        float t = extent > 0 ? (value - min) / extent : 0.0f;
+        return uint32_t(std::min(std::max(t * 1024.0f, 0.0f), 1023.0f));
+    };
+
+    uint32_t x = quantize(p.x, bounds.min.x, bounds.max.x);
+    uint32_t y = quantize(p.y, bounds.min.y, bounds.max.y);
+    uint32_t z = quantize(p.z, bounds.min.z, bounds.max.z);
+    return (ExpandBits10(x) << 2) | (ExpandBits10(y) << 1) | ExpandBits10(z);
+}
@@ -0,0 +1,246 @@
+#include "obj.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <iostream>
+#include <algorithm>
+
+// bytes read from the file at a time, lines longer than this are an error
+static constexpr size_t ChunkSize = 1 << 20;
+
+//------------------------------------------------------------------------------
+/**
+*/
+static char const*
+SkipSpaces(char const* c, char const* end)
+{
+    while (c < end && (*c == ' ' || *c == '\t'))
+        c++;
+    return c;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Decimal float with optional sign, fraction and exponent. Not as exact as
+    strtod in the last bit, but several times faster and locale independent.
+*/
+static char const*
+ParseFloat(char const* c, char const* end, float& value)
+{
+    static double const powersOf10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                                         1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    bool negative = false;
+    if (c < end && (*c == '-' || *c == '+'))
+        negative = *c++ == '-';
+
+    // digits that don't fit in the mantissa anymore only move the decimal point
+    constexpr uint64_t MaxMantissa = 1000000000000000000ull;
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    char const* start = c;
+    for (; c < end && *c >= '0' && *c <= '9'; c++)
+    {
+        if (mantissa < MaxMantissa)
+            mantissa = mantissa * 10 + uint64_t(*c - '0');
+        else
+            exponent++;
+    }
+    if (c < end && *c == '.')
+    {
+        for (c++; c < end && *c >= '0' && *c <= '9'; c++)
+        {
+            if (mantissa < MaxMantissa)
+            {
+                mantissa = mantissa * 10 + uint64_t(*c - '0');
+                exponent--;
+            }
+        }
+    }
+    if (c == start || (c == start + 1 && *start == '.'))
+        return nullptr;
+
+    if (c < end && (*c == 'e' || *c == 'E'))
+    {
+        c++;
+        bool negativeExponent = false;
+        if (c < end && (*c == '-' || *c == '+'))
+            negativeExponent = *c++ == '-';
+        int e = 0;
+        for (; c < end && *c >= '0' && *c <= '9'; c++)
+            e = std::min(e * 10 + (*c - '0'), 1000);
+        exponent += negativeExponent ? -e : e;
+    }
+
+    double result = double(mantissa);
+    if (exponent < 0)
+        result = -exponent <= 22 ? result / powersOf10[-exponent] : result * pow(10.0, exponent);
+    else if (exponent > 0)
+        result = exponent <= 22 ? result * powersOf10[exponent] : result * pow(10.0, exponent);
+
+    value = float(negative ? -result : result);
+    return c;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static char const*
+ParseInt(char const* c, char const* end, int64_t& value)
+{
+    bool negative = false;
+    if (c < end && (*c == '-' || *c == '+'))
+        negative = *c++ == '-';
+
+    char const* start = c;
+    value = 0;
+    // clamped, anything this big is out of range anyway
+    for (; c < end && *c >= '0' && *c <= '9'; c++)
+        value = std::min<int64_t>(value * 10 + (*c - '0'), INT64_C(1) << 40);
+    if (c == start)
+        return nullptr;
+
+    if (negative)
+        value = -value;
+    return c;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Parse one line without its newline. Returns false on a broken vertex or face.
+*/
+static bool
+ParseLine(char const* c, char const* end, std::vector<vec3>& positions, std::vector<uint32_t>& indices)
+{
+    // comments can follow a record on the same line
+    if (char const* comment = static_cast<char const*>(memchr(c, '#', size_t(end - c))))
+        end = comment;
+
+    c = SkipSpaces(c, end);
+    if (end - c < 2 || (c[1] != ' ' && c[1] != '\t'))
+        return true;
+
+    if (c[0] == 'v')
+    {
+        float xyz[3] = { 0, 0, 0 };
+        c += 2;
+        for (int axis = 0; axis < 3 && c; axis++)
+            c = ParseFloat(SkipSpaces(c, end), end, xyz[axis]);
+        if (!c)
+            return false;
+
+        positions.push_back(vec3(xyz[0], xyz[1], xyz[2]));
+    }
+    else if (c[0] == 'f')
+    {
+        // fan around the first vertex, v, v/vt, v//vn and v/vt/vn all work since only v is used
+        uint32_t first = 0, previous = 0;
+        int numVertices = 0;
+        c = SkipSpaces(c + 2, end);
+        while (c < end)
+        {
+            int64_t index;
+            c = ParseInt(c, end, index);
+            if (!c)
+                return false;
+
+            // negative indices count back from the last vertex
+            int64_t resolved = index < 0 ? int64_t(positions.size()) + index : index - 1;
+            if (index == 0 || resolved < 0 || resolved >= int64_t(positions.size()))
+                return false;
+
+            while (c < end && *c != ' ' && *c != '\t')
+                c++;
+            c = SkipSpaces(c, end);
+
+            uint32_t vertex = uint32_t(resolved);
+            if (numVertices == 0)
+                first = vertex;
+            else if (numVertices >= 2)
+            {
+                indices.push_back(first);
+                indices.push_back(previous);
+                indices.push_back(vertex);
+            }
+            previous = vertex;
+            numVertices++;
+        }
+        if (numVertices < 3)
+            return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+LoadOBJ(std::string const& path, std::vector<vec3>& positions, std::vector<uint32_t>& indices)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        std::cerr << "Could not open " << path << "\n";
+        return false;
+    }
+
+    positions.clear();
+    indices.clear();
+
+    // the unfinished last line of a chunk is moved to the front before reading the next one
+    std::vector<char> buffer(ChunkSize);
+    size_t carried = 0;
+    size_t lineNumber = 0;
+    bool ok = true;
+    while (ok)
+    {
+        size_t bytesRead = fread(buffer.data() + carried, 1, buffer.size() - carried, file);
+        size_t size = carried + bytesRead;
+        bool lastChunk = bytesRead == 0 || feof(file);
+        if (size == 0)
+            break;
+
+        char const* lineStart = buffer.data();
+        char const* end = buffer.data() + size;
+        while (true)
+        {
+            char const* lineEnd = lineStart;
+            while (lineEnd < end && *lineEnd != '\n')
+                lineEnd++;
+            if (lineEnd == end && !lastChunk)
+                break;
+
+            lineNumber++;
+            char const* contentEnd = lineEnd;
+            if (contentEnd > lineStart && contentEnd[-1] == '\r')
+                contentEnd--;
+            if (!ParseLine(lineStart, contentEnd, positions, indices))
+            {
+                std::cerr << path << ":" << lineNumber << ": could not parse \"" << std::string(lineStart, contentEnd) << "\"\n";
+                ok = false;
+                break;
+            }
+
+            if (lineEnd == end)
+            {
+                lineStart = end;
+                break;
+            }
+            lineStart = lineEnd + 1;
+        }
+
+        carried = size_t(end - lineStart);
+        if (lastChunk || !ok)
+            break;
+        if (carried == buffer.size())
+        {
+            std::cerr << path << ":" << lineNumber + 1 << ": line is longer than " << ChunkSize << " bytes\n";
+            ok = false;
+            break;
+        }
+        std::copy(lineStart, end, buffer.data());
+    }
+
+    fclose(file);
+    return ok;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include "vec3.h"
+
+//------------------------------------------------------------------------------
+/**
+    Read the vertex positions and faces of a Wavefront OBJ file, everything
+    else is skipped. The file is parsed in fixed size chunks straight into the
+    two output arrays, polygons are split into triangle fans. Prints what went
+    wrong and returns false if the file can't be read or a face is broken.
+*/
+bool LoadOBJ(std::string const& path, std::vector<vec3>& positions, std::vector<uint32_t>& indices);
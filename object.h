@@ -1,6 +1,8 @@
 #pragma once
 #include "ray.h"
 #include "color.h"
+#include "aabb.h"
+#include <stdint.h>
 #include <float.h>
 #include <string>
 #include <memory>
@@ -37,6 +39,10 @@ public:
     }
 
     virtual HitResult Intersect(Ray ray, float maxDist) { return {}; };
-    virtual Color GetColor() = 0;
-    virtual Ray ScatterRay(Ray ray, vec3 point, vec3 normal) { return Ray({ 0,0,0 }, {1,1,1}); };
+    // true if the ray hits the object closer than maxDist. Objects with a cheaper test than
+    // finding the closest hit and its normal should override this
+    virtual bool Occluded(Ray ray, float maxDist) { return this->Intersect(ray, maxDist).object != nullptr; }
+    virtual AABB GetBounds() = 0;
+    // index into the raytracer's material table
+    virtual uint32_t GetMaterial() = 0;
 };
\ No newline at end of file
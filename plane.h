@@ -0,0 +1,61 @@
+#pragma once
+#include "object.h"
+#include "ray.h"
+#include <math.h>
+
+// an infinite plane, all points p where dot(normal, p) == offset
+class Plane : public Object
+{
+public:
+    vec3 normal;
+    float offset;
+    uint32_t material;
+
+    Plane(vec3 normal, float offset, uint32_t material) :
+        normal(normalize(normal)),
+        offset(offset),
+        material(material)
+    {
+
+    }
+
+    ~Plane() override
+    {
+
+    }
+
+    uint32_t GetMaterial() override
+    {
+        return this->material;
+    }
+
+    // a plane has no bounds, the raytracer tests it for every ray instead of putting it in the BVH
+    AABB GetBounds() override
+    {
+        AABB bounds;
+        bounds.min = { -INFINITY, -INFINITY, -INFINITY };
+        bounds.max = { INFINITY, INFINITY, INFINITY };
+        return bounds;
+    }
+
+    HitResult Intersect(Ray ray, float maxDist) override
+    {
+        float denom = dot(this->normal, ray.m);
+
+        // parallel to the plane
+        if (denom == 0)
+            return HitResult();
+
+        constexpr float minDist = 0.001f;
+        float t = (this->offset - dot(this->normal, ray.b)) / denom;
+        if (!(t < maxDist && t > minDist))
+            return HitResult();
+
+        HitResult hit;
+        hit.p = ray.PointAt(t);
+        hit.normal = this->normal;
+        hit.t = t;
+        hit.object = this;
+        return hit;
+    }
+};
@@ -0,0 +1,101 @@
+#include "quantizedbvh.h"
+#include <assert.h>
+#include <math.h>
+#include <algorithm>
+
+//------------------------------------------------------------------------------
+/**
+    Find a grid over the union of the child boxes on one axis and round every
+    child box outwards onto it. Both are checked with the same expression the
+    decoder uses, so whatever rounding happens there is accounted for here.
+*/
+static void
+QuantizeAxis(float const bmin[4], float const bmax[4], int numChildren, float& origin, int8_t& exponent, uint8_t qmin[4], uint8_t qmax[4])
+{
+    float lo = bmin[0], hi = bmax[0];
+    for (int i = 1; i < numChildren; i++)
+    {
+        lo = std::min(lo, bmin[i]);
+        hi = std::max(hi, bmax[i]);
+    }
+
+    // smallest power of two with 255 steps covering the box, in the range of normal floats
+    int e;
+    frexpf((hi - lo) / 255.0f, &e);
+    e = std::min(std::max(e, -126), 127);
+    while (e < 127 && lo + 255.0f * QuantizationScale(int8_t(e)) < hi)
+        e++;
+
+    origin = lo;
+    exponent = int8_t(e);
+    float scale = QuantizationScale(exponent);
+    for (int i = 0; i < 4; i++)
+    {
+        if (i >= numChildren)
+        {
+            qmin[i] = qmax[i] = 0;
+            continue;
+        }
+
+        int q0 = int(std::min(std::max(floorf((bmin[i] - lo) / scale), 0.0f), 255.0f));
+        while (q0 > 0 && lo + float(q0) * scale > bmin[i])
+            q0--;
+        int q1 = int(std::min(std::max(ceilf((bmax[i] - lo) / scale), 0.0f), 255.0f));
+        while (q1 < 255 && lo + float(q1) * scale < bmax[i])
+            q1++;
+        qmin[i] = uint8_t(q0);
+        qmax[i] = uint8_t(q1);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    The wide tree already has the shape we want, so only the nodes change.
+    Node indices stay the same.
+*/
+void
+QuantizedBVH::Build(BVH const& bvh)
+{
+    this->Clear();
+    if (bvh.Empty())
+        return;
+
+    WideBVH<4> wide;
+    wide.Build(bvh);
+    this->primitiveIndices = std::move(wide.primitiveIndices);
+    this->nodes.resize(wide.nodes.size());
+
+    for (size_t n = 0; n < wide.nodes.size(); n++)
+    {
+        WideBVHNode<4> const& source = wide.nodes[n];
+        QuantizedBVHNode& node = this->nodes[n];
+
+        // used slots come first, the rest have boxes at infinity
+        int numChildren = 0;
+        while (numChildren < 4 && source.bminx[numChildren] != INFINITY)
+            numChildren++;
+        node.numChildren = uint8_t(numChildren);
+
+        QuantizeAxis(source.bminx, source.bmaxx, numChildren, node.origin[0], node.exponent[0], node.qminx, node.qmaxx);
+        QuantizeAxis(source.bminy, source.bmaxy, numChildren, node.origin[1], node.exponent[1], node.qminy, node.qmaxy);
+        QuantizeAxis(source.bminz, source.bmaxz, numChildren, node.origin[2], node.exponent[2], node.qminz, node.qmaxz);
+
+        for (int i = 0; i < 4; i++)
+        {
+            // no builder makes leaves bigger than BVH::MaxLeafSize
+            assert(source.count[i] <= 255);
+            node.child[i] = source.child[i];
+            node.count[i] = uint8_t(source.count[i]);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+QuantizedBVH::Clear()
+{
+    this->nodes.clear();
+    this->primitiveIndices.clear();
+}
@@ -0,0 +1,254 @@
+#pragma once
+#include <string.h>
+#include "widebvh.h"
+
+//------------------------------------------------------------------------------
+/**
+    A node with up to 4 children in 64 bytes, 16 per child where WideBVHNode<4>
+    needs 32. Child bounds are 8 bit coordinates on a grid over the node's own
+    box, origin + q * 2^exponent on every axis. Minimums are rounded down and
+    maximums up, so a child box can only grow and the traversal visits every
+    node the full precision tree would.
+*/
+struct alignas(64) QuantizedBVHNode
+{
+    // minimum corner of the node's box
+    float origin[3];
+    // grid spacing per axis, a power of two so q * spacing is exact
+    int8_t exponent[3];
+    uint8_t numChildren;
+    uint8_t qminx[4], qminy[4], qminz[4];
+    uint8_t qmaxx[4], qmaxy[4], qmaxz[4];
+    // node index for interior children, first primitive for leaves
+    uint32_t child[4];
+    // number of primitives for leaf children, 0 for interior children
+    uint8_t count[4];
+};
+static_assert(sizeof(QuantizedBVHNode) == 64, "a node should fill exactly one cache line");
+static_assert(BVH::MaxLeafSize <= 255, "leaf sizes have to fit the 8 bit counts");
+
+//------------------------------------------------------------------------------
+/**
+    4-way BVH with quantized child bounds, made by collapsing a binary BVH
+    like WideBVH<4> and compressing every node. Meant for scenes where the
+    nodes don't fit in the caches, the boxes are a little bigger than the
+    float ones so more of them are visited.
+*/
+class QuantizedBVH
+{
+public:
+    // collapse and quantize a built binary tree, leaves are kept as they are
+    void Build(BVH const& bvh);
+
+    // remove all nodes
+    void Clear();
+
+    // same contract as BVH::Intersect
+    template<typename IntersectFunc>
+    bool Intersect(Ray const& ray, float tMax, IntersectFunc&& intersectLeaf, TraversalStats* stats = nullptr) const;
+
+    // same contract as BVH::Occluded
+    template<typename OccludedFunc>
+    bool Occluded(Ray const& ray, float tMax, OccludedFunc&& occludedLeaf, TraversalStats* stats = nullptr) const;
+
+    // root is at index 0
+    std::vector<QuantizedBVHNode> nodes;
+    // primitive indices, leaves point into this list
+    std::vector<uint32_t> primitiveIndices;
+
+private:
+    // see BVH::Traverse
+    template<bool AnyHit, typename IntersectFunc>
+    bool Traverse(Ray const& ray, float tMax, IntersectFunc&& intersectLeaf, TraversalStats* stats) const;
+};
+
+//------------------------------------------------------------------------------
+/**
+    2^exponent, built from the bits since the exponent is always in the normal range
+*/
+inline float
+QuantizationScale(int8_t exponent)
+{
+    uint32_t bits = uint32_t(exponent + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return scale;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Turn the 8 bit child bounds back into floats. The product is exact, so
+    the only rounding is the addition, which can't cross the box it was
+    quantized from since that is a float itself.
+*/
+inline void
+DecodeChildren(QuantizedBVHNode const& node, WideBVHNode<4>& decoded)
+{
+    float const scale[3] = { QuantizationScale(node.exponent[0]), QuantizationScale(node.exponent[1]), QuantizationScale(node.exponent[2]) };
+#if defined(__SSE2__) || defined(_M_X64)
+    __m128i zero = _mm_setzero_si128();
+    auto decode = [zero](uint8_t const q[4], float origin, float scale, float* out)
+    {
+        int32_t packed;
+        memcpy(&packed, q, sizeof(packed));
+        __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+        __m128 values = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+        _mm_store_ps(out, _mm_add_ps(_mm_mul_ps(values, _mm_set1_ps(scale)), _mm_set1_ps(origin)));
+    };
+#else
+    auto decode = [](uint8_t const q[4], float origin, float scale, float* out)
+    {
+        for (int i = 0; i < 4; i++)
+            out[i] = origin + float(q[i]) * scale;
+    };
+#endif
+    decode(node.qminx, node.origin[0], scale[0], decoded.bminx);
+    decode(node.qminy, node.origin[1], scale[1], decoded.bminy);
+    decode(node.qminz, node.origin[2], scale[2], decoded.bminz);
+    decode(node.qmaxx, node.origin[0], scale[0], decoded.bmaxx);
+    decode(node.qmaxy, node.origin[1], scale[1], decoded.bmaxy);
+    decode(node.qmaxz, node.origin[2], scale[2], decoded.bmaxz);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Slab test against the decoded child boxes, the same one IntersectChildren<4>
+    does for WideBVHNode<4>. Unused child slots are masked off.
+*/
+inline uint32_t
+IntersectChildren(QuantizedBVHNode const& node, RayInv const& ray, float tMax, float dist[4])
+{
+    uint32_t used = (1u << node.numChildren) - 1;
+#if defined(__SSE2__) || defined(_M_X64)
+    // decoding in registers saves the round trip through a WideBVHNode
+    __m128i zero = _mm_setzero_si128();
+    auto decode = [zero](uint8_t const q[4], float origin, int8_t exponent)
+    {
+        int32_t packed;
+        memcpy(&packed, q, sizeof(packed));
+        __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+        __m128 values = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+        return _mm_add_ps(_mm_mul_ps(values, _mm_set1_ps(QuantizationScale(exponent))), _mm_set1_ps(origin));
+    };
+    __m128 ox = _mm_set1_ps(ray.ox), oy = _mm_set1_ps(ray.oy), oz = _mm_set1_ps(ray.oz);
+    __m128 ix = _mm_set1_ps(ray.ix), iy = _mm_set1_ps(ray.iy), iz = _mm_set1_ps(ray.iz);
+
+    __m128 tx1 = _mm_mul_ps(_mm_sub_ps(decode(node.qminx, node.origin[0], node.exponent[0]), ox), ix);
+    __m128 tx2 = _mm_mul_ps(_mm_sub_ps(decode(node.qmaxx, node.origin[0], node.exponent[0]), ox), ix);
+    __m128 ty1 = _mm_mul_ps(_mm_sub_ps(decode(node.qminy, node.origin[1], node.exponent[1]), oy), iy);
+    __m128 ty2 = _mm_mul_ps(_mm_sub_ps(decode(node.qmaxy, node.origin[1], node.exponent[1]), oy), iy);
+    __m128 tz1 = _mm_mul_ps(_mm_sub_ps(decode(node.qminz, node.origin[2], node.exponent[2]), oz), iz);
+    __m128 tz2 = _mm_mul_ps(_mm_sub_ps(decode(node.qmaxz, node.origin[2], node.exponent[2]), oz), iz);
+
+    __m128 tmin = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2)), _mm_min_ps(tz1, tz2));
+    __m128 tmax = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2)), _mm_max_ps(tz1, tz2));
+
+    __m128 hit = _mm_and_ps(_mm_cmpge_ps(tmax, tmin),
+                 _mm_and_ps(_mm_cmplt_ps(tmin, _mm_set1_ps(tMax)), _mm_cmpgt_ps(tmax, _mm_setzero_ps())));
+    _mm_storeu_ps(dist, tmin);
+    return uint32_t(_mm_movemask_ps(hit)) & used;
+#else
+    WideBVHNode<4> decoded;
+    DecodeChildren(node, decoded);
+    return IntersectChildren<4>(decoded, ray, tMax, dist) & used;
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<typename IntersectFunc>
+inline bool
+QuantizedBVH::Intersect(Ray const& ray, float tMax, IntersectFunc&& intersectLeaf, TraversalStats* stats) const
+{
+    return this->Traverse<false>(ray, tMax, intersectLeaf, stats);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<typename OccludedFunc>
+inline bool
+QuantizedBVH::Occluded(Ray const& ray, float tMax, OccludedFunc&& occludedLeaf, TraversalStats* stats) const
+{
+    return this->Traverse<true>(ray, tMax, occludedLeaf, stats);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Same walk as WideBVH<4>::Traverse, only the child test differs
+*/
+template<bool AnyHit, typename IntersectFunc>
+inline bool
+QuantizedBVH::Traverse(Ray const& ray, float tMax, IntersectFunc&& intersectLeaf, TraversalStats* stats) const
+{
+    if (this->nodes.empty())
+        return false;
+
+    struct StackEntry
+    {
+        uint32_t index;
+        // primitives for leaves, 0 for interior nodes
+        uint32_t count;
+        float dist;
+    };
+
+    RayInv rayInv(ray);
+    bool isHit = false;
+    // every level can push at most 3 entries on top of the one it pops
+    StackEntry stack[64 * 3 + 1];
+    uint32_t stackPtr = 0;
+    stack[stackPtr++] = { 0, 0, 0.0f };
+
+    while (stackPtr > 0)
+    {
+        StackEntry entry = stack[--stackPtr];
+        // a closer hit may have been found since this was pushed
+        if (entry.dist >= tMax)
+            continue;
+
+        if (stats)
+            stats->nodeVisits++;
+
+        if (entry.count > 0)
+        {
+            if (stats)
+                stats->primitiveTests += entry.count;
+
+            if (intersectLeaf(entry.index, entry.count, tMax))
+            {
+                if (AnyHit)
+                    return true;
+                isHit = true;
+            }
+            continue;
+        }
+
+        QuantizedBVHNode const& node = this->nodes[entry.index];
+        alignas(16) float dist[4];
+        uint32_t mask = IntersectChildren(node, rayInv, tMax, dist);
+        if (mask == 0)
+            continue;
+
+        // push the hit children far to near so the nearest one is popped first
+        uint32_t first = stackPtr;
+        while (mask)
+        {
+            int i = 0;
+            while (!(mask & (1u << i)))
+                i++;
+            mask &= mask - 1;
+
+            StackEntry child = { node.child[i], node.count[i], dist[i] };
+            uint32_t j = stackPtr++;
+            while (j > first && stack[j - 1].dist < child.dist)
+            {
+                stack[j] = stack[j - 1];
+                j--;
+            }
+            stack[j] = child;
+        }
+    }
+
+    return isHit;
+}
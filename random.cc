@@ -51,3 +51,32 @@ RandomFloatNTP()
     r.i = FastRandom() & 0x007fffff | 0x40000000;
     return r.f - 3.0f;
 }
+
+//------------------------------------------------------------------------------
+/**
+    splitmix64 finalizer, spreads neighbouring keys over the whole state space
+*/
+static unsigned long long
+MixBits(unsigned long long x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Seeded the way the reference pcg32_srandom does it, with the pixel and
+    frame picking the start state and the sample picking the stream.
+*/
+RandomStream::RandomStream(unsigned pixel, unsigned sample, unsigned frame) :
+    state(0),
+    increment((MixBits(sample) << 1u) | 1u)
+{
+    this->Next();
+    this->state += MixBits((unsigned long long)(frame) << 32 | pixel);
+    this->Next();
+}
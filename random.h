@@ -9,4 +9,40 @@ float RandomFloat();
 
 /// Produces an xorshift128 psuedo based floating point random number in range -1..1
 /// Note that this is not a truly random random number generator
-float RandomFloatNTP();
\ No newline at end of file
+float RandomFloatNTP();
+
+/// PCG32 generator keyed by pixel, sample and frame.
+/// Every path gets its own, so worker threads never share state and a pixel
+/// draws the same numbers no matter which thread renders it.
+class RandomStream
+{
+public:
+    RandomStream(unsigned pixel, unsigned sample, unsigned frame);
+
+    /// Next 32 random bits
+    unsigned Next()
+    {
+        unsigned long long old = this->state;
+        this->state = old * 6364136223846793005ULL + this->increment;
+        unsigned xorshifted = unsigned(((old >> 18u) ^ old) >> 27u);
+        unsigned rot = unsigned(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((0u - rot) & 31u));
+    }
+
+    /// Floating point random number in range 0..1
+    float Float()
+    {
+        return float(this->Next() >> 8) * (1.0f / 16777216.0f);
+    }
+
+    /// Floating point random number in range -1..1
+    float FloatNTP()
+    {
+        return this->Float() * 2.0f - 1.0f;
+    }
+
+private:
+    unsigned long long state;
+    // selects the stream, always odd
+    unsigned long long increment;
+};
@@ -0,0 +1,220 @@
+#pragma once
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include "aabb.h"
+#include "ray.h"
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+//------------------------------------------------------------------------------
+/**
+    Eight rays stored as structure of arrays, traced through the BVH together.
+    Meant for camera rays, which start at the same point and point in almost
+    the same direction, so the whole packet tends to visit the same nodes.
+*/
+struct alignas(32) RayPacket
+{
+    static constexpr int Size = 8;
+
+    // set the rays of the lanes in activeMask, other lanes are ignored
+    void Set(Ray const rays[Size], uint32_t activeMask);
+
+    float ox[Size], oy[Size], oz[Size];
+    float dx[Size], dy[Size], dz[Size];
+    // reciprocal direction for the slab tests
+    float ix[Size], iy[Size], iz[Size];
+    // dot(d, d), the quadratic coefficient of the sphere test
+    float a[Size];
+
+    // closest hit so far, FLT_MAX if none
+    float tMax[Size];
+    // whatever the leaf callback wants to remember about the closest hit
+    uint32_t hitIndex[Size];
+
+    uint32_t activeMask = 0;
+
+    // bounds of the origins and reciprocal directions of the active lanes, for culling whole boxes at once.
+    // only usable if every axis has the same direction sign in all lanes
+    bool coherent = false;
+    float originMin[3], originMax[3];
+    float invMin[3], invMax[3];
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+inline void
+RayPacket::Set(Ray const rays[Size], uint32_t activeMask)
+{
+    this->activeMask = activeMask;
+    this->coherent = activeMask != 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        this->originMin[axis] = this->invMin[axis] = FLT_MAX;
+        this->originMax[axis] = this->invMax[axis] = -FLT_MAX;
+    }
+
+    for (int i = 0; i < Size; i++)
+    {
+        this->tMax[i] = FLT_MAX;
+        this->hitIndex[i] = UINT32_MAX;
+
+        // inactive lanes get a ray that misses everything
+        Ray const& ray = rays[i];
+        bool active = (activeMask & (1u << i)) != 0;
+        float dx = active ? float(ray.m.x) : 1.0f, dy = active ? float(ray.m.y) : 1.0f, dz = active ? float(ray.m.z) : 1.0f;
+        this->ox[i] = active ? float(ray.b.x) : FLT_MAX;
+        this->oy[i] = active ? float(ray.b.y) : FLT_MAX;
+        this->oz[i] = active ? float(ray.b.z) : FLT_MAX;
+        this->dx[i] = dx;
+        this->dy[i] = dy;
+        this->dz[i] = dz;
+        // same expressions as RayInv and SpherePack, so every lane gets bit identical results to a single ray
+        this->ix[i] = 1.0f / dx;
+        this->iy[i] = 1.0f / dy;
+        this->iz[i] = 1.0f / dz;
+        this->a[i] = dx * dx + dy * dy + dz * dz;
+
+        if (!active)
+            continue;
+
+        float const o[3] = { this->ox[i], this->oy[i], this->oz[i] };
+        float const inv[3] = { this->ix[i], this->iy[i], this->iz[i] };
+        for (int axis = 0; axis < 3; axis++)
+        {
+            this->originMin[axis] = std::min(this->originMin[axis], o[axis]);
+            this->originMax[axis] = std::max(this->originMax[axis], o[axis]);
+            this->invMin[axis] = std::min(this->invMin[axis], inv[axis]);
+            this->invMax[axis] = std::max(this->invMax[axis], inv[axis]);
+        }
+    }
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        // mixed signs or axis aligned rays would need infinities in the interval math
+        if (!(this->invMin[axis] > 0 || this->invMax[axis] < 0) || !std::isfinite(this->invMin[axis]) || !std::isfinite(this->invMax[axis]))
+            this->coherent = false;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Slab test with interval arithmetic over the whole packet. Returns true only
+    if no ray in the packet can hit the box, so the per lane test can be skipped.
+*/
+inline bool
+PacketMissesAABB(RayPacket const& packet, float const bmin[3], float const bmax[3])
+{
+    if (!packet.coherent)
+        return false;
+
+    float enter = -FLT_MAX;
+    float exit = FLT_MAX;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float lo = packet.invMin[axis], hi = packet.invMax[axis];
+        // distance to the slab planes ranges over these intervals for all origins in the packet
+        float minLo = bmin[axis] - packet.originMax[axis], minHi = bmin[axis] - packet.originMin[axis];
+        float maxLo = bmax[axis] - packet.originMax[axis], maxHi = bmax[axis] - packet.originMin[axis];
+
+        float t1Lo = std::min(std::min(minLo * lo, minLo * hi), std::min(minHi * lo, minHi * hi));
+        float t1Hi = std::max(std::max(minLo * lo, minLo * hi), std::max(minHi * lo, minHi * hi));
+        float t2Lo = std::min(std::min(maxLo * lo, maxLo * hi), std::min(maxHi * lo, maxHi * hi));
+        float t2Hi = std::max(std::max(maxLo * lo, maxLo * hi), std::max(maxHi * lo, maxHi * hi));
+
+        // rays going in the negative direction enter through the max plane
+        if (lo > 0)
+        {
+            enter = std::max(enter, t1Lo);
+            exit = std::min(exit, t2Hi);
+        }
+        else
+        {
+            enter = std::max(enter, t2Lo);
+            exit = std::min(exit, t1Hi);
+        }
+    }
+    return enter > exit || exit <= 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Slab test of every lane against a box. Returns a mask of the lanes that
+    hit it closer than their tMax and the smallest entry distance among them.
+*/
+inline uint32_t
+IntersectPacketAABB(RayPacket const& packet, float const bmin[3], float const bmax[3], float& nearest)
+{
+#if defined(__AVX__)
+    __m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bmin[0]), _mm256_load_ps(packet.ox)), _mm256_load_ps(packet.ix));
+    __m256 tx2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bmax[0]), _mm256_load_ps(packet.ox)), _mm256_load_ps(packet.ix));
+    __m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bmin[1]), _mm256_load_ps(packet.oy)), _mm256_load_ps(packet.iy));
+    __m256 ty2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bmax[1]), _mm256_load_ps(packet.oy)), _mm256_load_ps(packet.iy));
+    __m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bmin[2]), _mm256_load_ps(packet.oz)), _mm256_load_ps(packet.iz));
+    __m256 tz2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bmax[2]), _mm256_load_ps(packet.oz)), _mm256_load_ps(packet.iz));
+
+    __m256 tmin = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx1, tx2), _mm256_min_ps(ty1, ty2)), _mm256_min_ps(tz1, tz2));
+    __m256 tmax = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx1, tx2), _mm256_max_ps(ty1, ty2)), _mm256_max_ps(tz1, tz2));
+
+    __m256 hit = _mm256_and_ps(_mm256_cmp_ps(tmax, tmin, _CMP_GE_OQ),
+                 _mm256_and_ps(_mm256_cmp_ps(tmin, _mm256_load_ps(packet.tMax), _CMP_LT_OQ), _mm256_cmp_ps(tmax, _mm256_setzero_ps(), _CMP_GT_OQ)));
+    uint32_t mask = uint32_t(_mm256_movemask_ps(hit)) & packet.activeMask;
+
+    // horizontal min of the entry distances of the lanes that hit
+    __m256 dist = _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), tmin, hit);
+    __m128 lo = _mm_min_ps(_mm256_castps256_ps128(dist), _mm256_extractf128_ps(dist, 1));
+    lo = _mm_min_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_min_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+    nearest = _mm_cvtss_f32(lo);
+    return mask;
+#elif defined(__SSE2__) || defined(_M_X64)
+    // two halves of four lanes
+    uint32_t mask = 0;
+    __m128 dist = _mm_set1_ps(FLT_MAX);
+    for (int half = 0; half < RayPacket::Size; half += 4)
+    {
+        __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmin[0]), _mm_load_ps(packet.ox + half)), _mm_load_ps(packet.ix + half));
+        __m128 tx2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmax[0]), _mm_load_ps(packet.ox + half)), _mm_load_ps(packet.ix + half));
+        __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmin[1]), _mm_load_ps(packet.oy + half)), _mm_load_ps(packet.iy + half));
+        __m128 ty2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmax[1]), _mm_load_ps(packet.oy + half)), _mm_load_ps(packet.iy + half));
+        __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmin[2]), _mm_load_ps(packet.oz + half)), _mm_load_ps(packet.iz + half));
+        __m128 tz2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmax[2]), _mm_load_ps(packet.oz + half)), _mm_load_ps(packet.iz + half));
+
+        __m128 tmin = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2)), _mm_min_ps(tz1, tz2));
+        __m128 tmax = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2)), _mm_max_ps(tz1, tz2));
+
+        __m128 hit = _mm_and_ps(_mm_cmpge_ps(tmax, tmin),
+                     _mm_and_ps(_mm_cmplt_ps(tmin, _mm_load_ps(packet.tMax + half)), _mm_cmpgt_ps(tmax, _mm_setzero_ps())));
+        // inactive lanes are masked out before their distance can count as the nearest
+        __m128i active = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(int(packet.activeMask >> half)), _mm_setr_epi32(1, 2, 4, 8)), _mm_setr_epi32(1, 2, 4, 8));
+        hit = _mm_and_ps(hit, _mm_castsi128_ps(active));
+        mask |= uint32_t(_mm_movemask_ps(hit)) << half;
+        dist = _mm_min_ps(dist, _mm_or_ps(_mm_and_ps(hit, tmin), _mm_andnot_ps(hit, _mm_set1_ps(FLT_MAX))));
+    }
+
+    dist = _mm_min_ps(dist, _mm_movehl_ps(dist, dist));
+    dist = _mm_min_ss(dist, _mm_shuffle_ps(dist, dist, 1));
+    nearest = _mm_cvtss_f32(dist);
+    return mask;
+#else
+    uint32_t mask = 0;
+    nearest = FLT_MAX;
+    for (int i = 0; i < RayPacket::Size; i++)
+    {
+        if (!(packet.activeMask & (1u << i)))
+            continue;
+
+        RayInv ray(Ray(vec3(packet.ox[i], packet.oy[i], packet.oz[i]), vec3(packet.dx[i], packet.dy[i], packet.dz[i])));
+        float dist = IntersectAABB(ray, bmin, bmax, packet.tMax[i]);
+        if (dist != FLT_MAX)
+        {
+            mask |= 1u << i;
+            nearest = std::min(nearest, dist);
+        }
+    }
+    return mask;
+#endif
+}
@@ -1,9 +1,33 @@
 #include "raytracer.h"
 #include <iostream>
-#include <random>
 #include <algorithm>
 #include <functional>
+#include <cctype>
+#include <memory>
+#include <assert.h>
 #include "random.h"
+#include "sphere.h"
+#include "bvhcache.h"
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+AcceleratorFromName(std::string name, Accelerator& accelerator)
+{
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+    for (Accelerator a : { Accelerator::Linear, Accelerator::BVH, Accelerator::BVH4, Accelerator::BVH8, Accelerator::BVH4Q, Accelerator::Grid, Accelerator::Grid2 })
+    {
+        std::string candidate = AcceleratorName(a);
+        std::transform(candidate.begin(), candidate.end(), candidate.begin(), [](unsigned char c) { return std::tolower(c); });
+        if (candidate == name)
+        {
+            accelerator = a;
+            return true;
+        }
+    }
+    return false;
+}
 
 //------------------------------------------------------------------------------
 /**
@@ -30,101 +54,295 @@ Raytracer::~Raytracer() {
 unsigned int
 Raytracer::Raytrace()
 {
-    //static int leet = 1337;
-    //std::mt19937 generator (leet++);
-    //std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+    this->UpdateAccelerationStructure();
 
-	unsigned int NumberOfTraces = 0;
-    for (int x = 0; x < this->width; ++x)
+    this->PrepareTiledBuffer();
+    if (this->tiledFrameBuffer || this->wavefront || this->packets)
     {
-        for (int y = 0; y < this->height; ++y)
+        // same order as the tile scheduler, so writes stay inside one tile at a time
+        this->PrepareWorkers(1);
+        this->RaytraceWorker(0);
+    }
+    else
+    {
+        // row major, consecutive pixels are next to each other in frameBuffer
+        for (unsigned y = 0; y < this->height; ++y)
         {
-            Color color;
-            for (int i = 0; i < this->rpp; ++i)
+            for (unsigned x = 0; x < this->width; ++x)
             {
-                float u = ((float(x + RandomFloat()) * (1.0f / this->width)) * 2.0f) - 1.0f;
-                float v = ((float(y + RandomFloat()) * (1.0f / this->height)) * 2.0f) - 1.0f;
-
-                vec3 direction = vec3(u, v, -1.0f);
-                direction = transform(direction, this->frustum);
-                
-                Ray ray = Ray(get_position(this->view), direction);
-                color += this->TracePathNoRecursion(ray, this->bounces);
-                //color += this->TracePath(ray, 0);
-
-				NumberOfTraces++;
+                this->RaytracePixel(x, y);
             }
-
-            // divide by number of samples per pixel, to get the average of the distribution
-            color.r /= this->rpp;
-            color.g /= this->rpp;
-            color.b /= this->rpp;
-
-            this->frameBuffer[y * this->width + x] += color;
         }
     }
-	return NumberOfTraces;
+
+    this->frameIndex++;
+	return this->width * this->height * this->rpp;
 }
 
 unsigned int
 Raytracer::RaytraceMultithreaded(unsigned int NumberOfJobs)
 {
-    std::mutex zLock;
-    std::atomic<int> z(0);
+    this->UpdateAccelerationStructure();
+
+    this->PrepareTiledBuffer();
 
-    DoneThreads.store(0);
+    // one worker per thread plus the calling thread, stealing takes care of the balance
+    unsigned NumberOfWorkers = std::max(1u, std::min<unsigned>(NumberOfJobs, unsigned(Threads.size()) + 1));
+    this->PrepareWorkers(NumberOfWorkers);
 
-    for (int i = 0; i < NumberOfJobs; i++)
+    FrameDone.Reset(int(NumberOfWorkers) - 1);
+    for (unsigned i = 1; i < NumberOfWorkers; i++)
     {
-        QueueJob(RayMultithreadParameters((this->width / NumberOfJobs) * i, (this->width / NumberOfJobs) * (i + 1)));
+        QueueJob([this, i]()
+        {
+            this->RaytraceWorker(i);
+            FrameDone.CountDown();
+        });
     }
 
-    while (DoneThreads < NumberOfJobs) {
-		std::this_thread::sleep_for(std::chrono::milliseconds(1));
-	}
+    // render as worker 0 instead of idling, then wait for whoever is still on their last tile
+    this->RaytraceWorker(0);
+    FrameDone.Wait();
+    this->frameIndex++;
 
 	return this->width * this->height * this->rpp;
 }
 
-void Raytracer::RaytraceChunk(RayMultithreadParameters Param)
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Raytracer::PrepareWorkers(unsigned NumberOfWorkers)
 {
-    int MinY = Param.MinY;
-    int MaxY = Param.MaxY;
+    // wavefront tiles are bigger, so every stage has plenty of paths to loop over
+    Tiles.Reset(this->width, this->height, this->wavefront ? this->wavefrontTileSize : this->tileSize, NumberOfWorkers);
+    if (this->wavefront && this->PathBatches.size() < NumberOfWorkers)
+        this->PathBatches.resize(NumberOfWorkers);
+}
 
-    static int leet = 1337;
-    std::mt19937 generator (leet++);
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Raytracer::RaytraceWorker(unsigned worker)
+{
+    Tile tile;
+    while (Tiles.Next(worker, tile))
+    {
+        if (this->wavefront)
+        {
+            TraceTileWavefront(*this, tile, this->PathBatches[worker]);
+            if (this->tiledFrameBuffer)
+                this->ResolveTile(tile);
+        }
+        else
+        {
+            this->RaytraceTile(tile);
+        }
+    }
+}
 
-    std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Raytracer::RaytraceTile(Tile const& tile)
+{
+    if (this->packets && this->SupportsPackets())
+    {
+        for (unsigned y = tile.y0; y < tile.y1; y += PacketHeight)
+        {
+            for (unsigned x = tile.x0; x < tile.x1; x += PacketWidth)
+            {
+                this->RaytraceBlock(x, y, tile.x1, tile.y1);
+            }
+        }
+    }
+    else
+    {
+        for (unsigned y = tile.y0; y < tile.y1; ++y)
+        {
+            for (unsigned x = tile.x0; x < tile.x1; ++x)
+            {
+                this->RaytracePixel(x, y);
+            }
+        }
+    }
 
-	for (int x = 0; x < this->width; ++x)
-	{
-		for (int y = MinY; y < MaxY; ++y)
-		{
-			Color color;
-			for (int i = 0; i < this->rpp; ++i)
-			{
-				float u = ((float(x + dis(generator)) * (1.0f / this->width)) * 2.0f) - 1.0f;
-				float v = ((float(y + dis(generator)) * (1.0f / this->height)) * 2.0f) - 1.0f;
-				//float u = ((float(x + RandomFloat()) * (1.0f / this->width)) * 2.0f) - 1.0f;
-				//float v = ((float(y + RandomFloat()) * (1.0f / this->height)) * 2.0f) - 1.0f;
-
-				vec3 direction = vec3(u, v, -1.0f);
-				direction = transform(direction, this->frustum);
-
-				Ray ray = Ray(get_position(this->view), direction);
-				color += this->TracePathNoRecursion(ray, this->bounces);
-				//color += this->TracePath(ray, 0);
-			}
-
-			// divide by number of samples per pixel, to get the average of the distribution
-			color.r /= this->rpp;
-			color.g /= this->rpp;
-			color.b /= this->rpp;
-
-			this->frameBuffer[y * this->width + x] += color;
-		}
-	}
-    DoneThreads.fetch_add(1);
+    if (this->tiledFrameBuffer)
+        this->ResolveTile(tile);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+size_t
+Raytracer::TiledIndex(unsigned x, unsigned y) const
+{
+    unsigned tilesX = (this->width + this->tileSize - 1) / this->tileSize;
+    size_t tile = size_t(y / this->tileSize) * tilesX + x / this->tileSize;
+    return tile * this->tileSize * this->tileSize + (y % this->tileSize) * this->tileSize + x % this->tileSize;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Raytracer::PrepareTiledBuffer()
+{
+    if (!this->tiledFrameBuffer)
+    {
+        this->tiledBuffer.clear();
+        return;
+    }
+
+    unsigned tilesX = (this->width + this->tileSize - 1) / this->tileSize;
+    unsigned tilesY = (this->height + this->tileSize - 1) / this->tileSize;
+    size_t size = size_t(tilesX) * tilesY * this->tileSize * this->tileSize;
+    if (this->tiledBuffer.size() != size)
+    {
+        // start from what has been accumulated so far, so switching layouts mid frame sequence works
+        this->tiledBuffer.assign(size, Color());
+        for (unsigned y = 0; y < this->height; ++y)
+            for (unsigned x = 0; x < this->width; ++x)
+                this->tiledBuffer[this->TiledIndex(x, y)] = this->frameBuffer[y * this->width + x];
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Linearize a rectangle of pixels. Every row is copied in runs that end at
+    the borders of the storage tiles, so it works for wavefront tiles too,
+    which span several storage tiles.
+*/
+void
+Raytracer::ResolveTile(Tile const& tile)
+{
+    for (unsigned y = tile.y0; y < tile.y1; ++y)
+    {
+        unsigned x = tile.x0;
+        while (x < tile.x1)
+        {
+            unsigned runEnd = std::min(tile.x1, (x / this->tileSize + 1) * this->tileSize);
+            Color const* src = &this->tiledBuffer[this->TiledIndex(x, y)];
+            std::copy(src, src + (runEnd - x), &this->frameBuffer[y * this->width + x]);
+            x = runEnd;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Trace all samples of one pixel and add their average to the framebuffer.
+    The random numbers only depend on pixel, sample and frame, so the result is
+    the same whichever thread gets here.
+*/
+void
+Raytracer::RaytracePixel(unsigned x, unsigned y)
+{
+    unsigned pixel = y * this->width + x;
+
+    Color color;
+    for (int i = 0; i < this->rpp; ++i)
+    {
+        RandomStream rng(pixel, i, this->frameIndex);
+
+        float u = ((float(x + rng.Float()) * (1.0f / this->width)) * 2.0f) - 1.0f;
+        float v = ((float(y + rng.Float()) * (1.0f / this->height)) * 2.0f) - 1.0f;
+
+        vec3 direction = vec3(u, v, -1.0f);
+        direction = transform(direction, this->frustum);
+
+        Ray ray = Ray(get_position(this->view), direction);
+        color += this->TracePathNoRecursion(ray, this->bounces, rng);
+        //color += this->TracePath(ray, 0, rng);
+    }
+
+    // divide by number of samples per pixel, to get the average of the distribution
+    color.r /= this->rpp;
+    color.g /= this->rpp;
+    color.b /= this->rpp;
+
+    this->AccumulatePixel(x, y, color);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Same samples as RaytracePixel for every pixel of the block, so the image
+    doesn't change. Sample i of all pixels is traced together: the camera rays
+    are cast as one packet and every lane then continues its path on its own,
+    since after the first bounce the rays no longer go the same way.
+*/
+void
+Raytracer::RaytraceBlock(unsigned x, unsigned y, unsigned x1, unsigned y1)
+{
+    static_assert(PacketWidth * PacketHeight == RayPacket::Size, "a block has to fill a packet");
+
+    // lanes outside the tile stay inactive
+    uint32_t laneMask = 0;
+    unsigned laneX[RayPacket::Size], laneY[RayPacket::Size];
+    for (unsigned lane = 0; lane < RayPacket::Size; lane++)
+    {
+        laneX[lane] = x + lane % PacketWidth;
+        laneY[lane] = y + lane / PacketWidth;
+        if (laneX[lane] < x1 && laneY[lane] < y1)
+            laneMask |= 1u << lane;
+    }
+
+    vec3 cameraPosition = get_position(this->view);
+    Color colors[RayPacket::Size];
+    for (int i = 0; i < this->rpp; ++i)
+    {
+        // RandomStream has no default state, inactive lanes just get a stream they never use
+        auto stream = [&](unsigned lane) { return RandomStream(laneY[lane] * this->width + laneX[lane], i, this->frameIndex); };
+        RandomStream rng[RayPacket::Size] = { stream(0), stream(1), stream(2), stream(3), stream(4), stream(5), stream(6), stream(7) };
+
+        Ray rays[RayPacket::Size] = { Ray(cameraPosition, vec3()), Ray(cameraPosition, vec3()), Ray(cameraPosition, vec3()), Ray(cameraPosition, vec3()),
+                                      Ray(cameraPosition, vec3()), Ray(cameraPosition, vec3()), Ray(cameraPosition, vec3()), Ray(cameraPosition, vec3()) };
+        for (unsigned lane = 0; lane < RayPacket::Size; lane++)
+        {
+            if (!(laneMask & (1u << lane)))
+                continue;
+
+            float u = ((float(laneX[lane] + rng[lane].Float()) * (1.0f / this->width)) * 2.0f) - 1.0f;
+            float v = ((float(laneY[lane] + rng[lane].Float()) * (1.0f / this->height)) * 2.0f) - 1.0f;
+            rays[lane].m = transform(vec3(u, v, -1.0f), this->frustum);
+        }
+
+        HitResult hits[RayPacket::Size];
+        this->RaycastPacket(rays, laneMask, hits);
+
+        for (unsigned lane = 0; lane < RayPacket::Size; lane++)
+        {
+            if (laneMask & (1u << lane))
+                colors[lane] += this->TracePathNoRecursion(rays[lane], this->bounces, rng[lane], &hits[lane]);
+        }
+    }
+
+    for (unsigned lane = 0; lane < RayPacket::Size; lane++)
+    {
+        if (!(laneMask & (1u << lane)))
+            continue;
+
+        // divide by number of samples per pixel, to get the average of the distribution
+        colors[lane].r /= this->rpp;
+        colors[lane].g /= this->rpp;
+        colors[lane].b /= this->rpp;
+        this->AccumulatePixel(laneX[lane], laneY[lane], colors[lane]);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Raytracer::AccumulatePixel(unsigned x, unsigned y, Color const& color)
+{
+    unsigned pixel = y * this->width + x;
+    if (this->tiledFrameBuffer)
+        this->tiledBuffer[this->TiledIndex(x, y)] += color;
+    else
+        this->frameBuffer[pixel] += color;
 }
 
 //------------------------------------------------------------------------------
@@ -132,7 +350,7 @@ void Raytracer::RaytraceChunk(RayMultithreadParameters Param)
  * @parameter n - the current bounce level
 */
 Color
-Raytracer::TracePathNoRecursion(Ray ray, unsigned n)
+Raytracer::TracePathNoRecursion(Ray ray, unsigned n, RandomStream& rng, HitResult const* primaryHit)
 {
     vec3 hitPoint;
     vec3 hitNormal;
@@ -140,15 +358,44 @@ Raytracer::TracePathNoRecursion(Ray ray, unsigned n)
     float distance = FLT_MAX;
 
     Color color = { 1,1,1 };
+    // emission and sampled light picked up along the path
+    Color radiance = { 0,0,0 };
+    // density BSDF scattered CurrentRay with, 0 for camera rays and specular bounces
+    float scatterPdf = 0.0f;
+    bool sampleLights = this->SamplesLights();
 
     Ray CurrentRay = ray;
 
     for (int i = 0; i < this->bounces; i++)
     {
-        if (Raycast(CurrentRay, hitPoint, hitNormal, hitObject, distance, this->objects))
+        bool isHit;
+        if (i == 0 && primaryHit)
         {
-			color = color * hitObject->GetColor();
-			CurrentRay = Ray(hitObject->ScatterRay(CurrentRay, hitPoint, hitNormal));
+            hitPoint = primaryHit->p;
+            hitNormal = primaryHit->normal;
+            hitObject = primaryHit->object;
+            isHit = hitObject != nullptr;
+        }
+        else
+        {
+            isHit = this->Raycast(CurrentRay, hitPoint, hitNormal, hitObject, distance);
+        }
+
+        if (isHit)
+        {
+			Material const& material = this->materials[hitObject->GetMaterial()];
+			if (material.type == MaterialType::Emissive)
+				return radiance + color * material.color * this->EmitterWeight(CurrentRay.b, hitObject, scatterPdf);
+
+			// the last scattered ray is never traced, so there is nothing to weigh a light sample against
+			if (sampleLights && i + 1 < this->bounces && material.type != MaterialType::Dielectric)
+				radiance += color * this->SampleLight(material, CurrentRay, hitPoint, hitNormal, rng);
+
+			color = color * material.color;
+			Ray scattered = BSDF(material, CurrentRay, hitPoint, hitNormal, rng);
+			if (sampleLights)
+				scatterPdf = ScatterPdf(material, CurrentRay, hitNormal, scattered.m);
+			CurrentRay = scattered;
         }
         else
         {
@@ -160,23 +407,116 @@ Raytracer::TracePathNoRecursion(Ray ray, unsigned n)
             return { 0,0,0 };
     }
 
-    return color;
+    return radiance + color;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Cone a sphere covers seen from point, as the cosine of its half angle and
+    1 minus that cosine, the latter computed without cancellation since small
+    distant lights are the common case. Returns false if point is inside.
+*/
+static bool
+SphereCone(vec3 point, vec3 center, float radius, float& cosMax, float& oneMinusCosMax)
+{
+    vec3 toCenter = center - point;
+    float distance2 = float(dot(toCenter, toCenter));
+    float radius2 = radius * radius;
+    if (distance2 <= radius2)
+        return false;
+
+    float sin2Max = radius2 / distance2;
+    cosMax = sqrtf(1.0f - sin2Max);
+    oneMinusCosMax = sin2Max / (1.0f + cosMax);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+    The light is picked uniformly and the direction uniformly over its cone,
+    so the density is 1 / (lights * cone solid angle). Combined with BSDF
+    sampling by the power heuristic, which keeps the small bright lights from
+    turning into fireflies and the glossy reflections of big ones from
+    getting noisy.
+*/
+Color
+Raytracer::SampleLight(Material const& material, Ray const& ray, vec3 point, vec3 normal, RandomStream& rng)
+{
+    uint32_t count = uint32_t(this->lights.size());
+    // always drawn, so every path uses the same numbers whatever the light turns out to be
+    uint32_t pick = std::min(uint32_t(rng.Float() * count), count - 1);
+    float u1 = rng.Float();
+    float u2 = rng.Float();
+
+    Sphere const* light = this->lights[pick];
+    float cosMax, oneMinusCosMax;
+    if (!SphereCone(point, light->center, light->radius, cosMax, oneMinusCosMax))
+        return {};
+
+    vec3 toCenter = light->center - point;
+    float distance = float(len(toCenter));
+    mat4 basis = TBN(toCenter * (1.0f / distance));
+    float oneMinusCos = u1 * oneMinusCosMax;
+    float cosTheta = 1.0f - oneMinusCos;
+    float sin2Theta = std::max(0.0f, oneMinusCos * (2.0f - oneMinusCos));
+    float sinTheta = sqrtf(sin2Theta);
+    float phi = 2.0f * float(MPI) * u2;
+    vec3 direction = get_row0(basis) * (sinTheta * cosf(phi)) + get_row1(basis) * cosTheta + get_row2(basis) * (sinTheta * sinf(phi));
+
+    float bsdfPdf = ScatterPdf(material, ray, normal, direction);
+    if (bsdfPdf <= 0.0f)
+        return {};
+
+    // stop the shadow ray just short of the near side of the light, or it would hit the light itself
+    float t = distance * cosTheta - sqrtf(std::max(0.0f, light->radius * light->radius - distance * distance * sin2Theta));
+    if (this->Occluded(Ray(point, direction), t * 0.999f))
+        return {};
+
+    // BSDF times cosine over the light density, times the power heuristic weight of the light sample
+    float lightPdf = 1.0f / (2.0f * float(MPI) * oneMinusCosMax * count);
+    float ratio = bsdfPdf / lightPdf;
+    Material const& emitter = this->materials[light->material];
+    return material.color * emitter.color * (ratio / (1.0f + ratio * ratio));
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+float
+Raytracer::EmitterWeight(vec3 origin, Object const* object, float scatterPdf) const
+{
+    if (scatterPdf <= 0.0f)
+        return 1.0f;
+
+    auto found = this->lightIndices.find(object);
+    if (found == this->lightIndices.end())
+        return 1.0f;
+
+    Sphere const* light = this->lights[found->second];
+    float cosMax, oneMinusCosMax;
+    if (!SphereCone(origin, light->center, light->radius, cosMax, oneMinusCosMax))
+        return 1.0f;
+
+    float lightPdf = 1.0f / (2.0f * float(MPI) * oneMinusCosMax * this->lights.size());
+    float ratio = lightPdf / scatterPdf;
+    return 1.0f / (1.0f + ratio * ratio);
 }
 
 Color
-Raytracer::TracePath(Ray ray, unsigned n)
+Raytracer::TracePath(Ray ray, unsigned n, RandomStream& rng)
 {
     vec3 hitPoint;
     vec3 hitNormal;
     Object* hitObject = nullptr;
     float distance = FLT_MAX;
 
-    if (Raycast(ray, hitPoint, hitNormal, hitObject, distance, this->objects))
+    if (this->Raycast(ray, hitPoint, hitNormal, hitObject, distance))
     {
-        Ray scatteredRay = Ray(hitObject->ScatterRay(ray, hitPoint, hitNormal));
+        Material const& material = this->materials[hitObject->GetMaterial()];
+        Ray scatteredRay = BSDF(material, ray, hitPoint, hitNormal, rng);
         if (n < this->bounces)
         {
-            return hitObject->GetColor() * this->TracePath(scatteredRay, n + 1);
+            return material.color * this->TracePath(scatteredRay, n + 1, rng);
         }
 
         if (n == this->bounces)
@@ -188,6 +528,409 @@ Raytracer::TracePath(Ray ray, unsigned n)
     return this->Skybox(ray.m);
 }
 
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Raytracer::BuildAccelerationStructure()
+{
+    std::vector<uint32_t> sphereObjects;
+    std::vector<AABB> bounds;
+    std::vector<AABB> objectBounds;
+    this->boundedObjects.clear();
+    this->unboundedObjects.clear();
+    this->lights.clear();
+    this->lightIndices.clear();
+    for (uint32_t i = 0; i < this->objects.size(); i++)
+    {
+        AABB objectBox = this->objects[i]->GetBounds();
+        if (Sphere const* sphere = dynamic_cast<Sphere*>(this->objects[i]))
+        {
+            sphereObjects.push_back(i);
+            bounds.push_back(objectBox);
+            if (this->materials[sphere->material].type == MaterialType::Emissive)
+            {
+                this->lightIndices[sphere] = uint32_t(this->lights.size());
+                this->lights.push_back(sphere);
+            }
+        }
+        else if (objectBox.IsInfinite())
+        {
+            this->unboundedObjects.push_back(i);
+        }
+        else
+        {
+            this->boundedObjects.push_back(i);
+            objectBounds.push_back(objectBox);
+        }
+    }
+    this->objectBVH.Build(objectBounds, this->bvhBuilder);
+
+    TaskRunner runTasks = [this](std::vector<std::function<void()>>& tasks)
+    {
+        this->RunTasks(tasks);
+    };
+
+    this->bvh4.Clear();
+    this->bvh8.Clear();
+    this->bvh4q.Clear();
+    this->grid.Clear();
+    if (this->accelerator == Accelerator::Grid || this->accelerator == Accelerator::Grid2)
+    {
+        // the point of a grid is the build time, so there is no sphere BVH at all.
+        // The pack is in cell order, a sphere is stored once for every cell it overlaps
+        this->bvh.Clear();
+        this->bvhFromCache = false;
+        this->grid.Build(bounds, this->accelerator == Accelerator::Grid2, runTasks);
+        this->spheres.Resize(uint32_t(this->grid.primitiveIndices.size()));
+        for (uint32_t i = 0; i < this->grid.primitiveIndices.size(); i++)
+        {
+            uint32_t objectIndex = sphereObjects[this->grid.primitiveIndices[i]];
+            Sphere const* sphere = static_cast<Sphere const*>(this->objects[objectIndex]);
+            this->spheres.Set(i, sphere->center, sphere->radius, objectIndex);
+        }
+
+        this->bvhBuildCost = 0.0f;
+        this->sceneDirty = false;
+        this->sceneMoved = false;
+        return;
+    }
+
+    // a tree rebuilt because objects moved is only good for a few frames, not worth a file
+    std::string cacheDirectory = this->sceneMoved ? std::string() : this->bvhCacheDirectory;
+    this->bvhFromCache = BuildCachedBVH(this->bvh, bounds, this->bvhBuilder, runTasks, cacheDirectory, [this, &sphereObjects](uint32_t primitive, AABB const& box)
+    {
+        return static_cast<Sphere const*>(this->objects[sphereObjects[primitive]])->ClipBounds(box);
+    }, this->bvhLayout);
+
+    // store the spheres in leaf order, so every leaf is a contiguous range in the pack.
+    // With spatial splits a sphere can be in several leaves and is stored once for each
+    this->spheres.Resize(uint32_t(this->bvh.primitiveIndices.size()));
+    for (uint32_t i = 0; i < this->bvh.primitiveIndices.size(); i++)
+    {
+        uint32_t objectIndex = sphereObjects[this->bvh.primitiveIndices[i]];
+        Sphere const* sphere = static_cast<Sphere const*>(this->objects[objectIndex]);
+        this->spheres.Set(i, sphere->center, sphere->radius, objectIndex);
+    }
+
+    if (this->accelerator == Accelerator::BVH4)
+        this->bvh4.Build(this->bvh);
+    else if (this->accelerator == Accelerator::BVH8)
+        this->bvh8.Build(this->bvh);
+    else if (this->accelerator == Accelerator::BVH4Q)
+        this->bvh4q.Build(this->bvh);
+
+    this->bvhBuildCost = this->bvh.SAHCost();
+    this->sceneDirty = false;
+    this->sceneMoved = false;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Spheres stay where the last build put them in the pack, only their
+    positions and the node bounds change. The cost check only looks at the
+    sphere BVH, the other objects are usually few and don't move.
+*/
+bool
+Raytracer::RefitAccelerationStructure()
+{
+    // grids are quick enough to build that there is nothing to refit
+    if (this->accelerator == Accelerator::Grid || this->accelerator == Accelerator::Grid2)
+    {
+        this->BuildAccelerationStructure();
+        return true;
+    }
+
+    std::vector<AABB> bounds(this->spheres.Size());
+    for (uint32_t i = 0; i < this->spheres.Size(); i++)
+    {
+        uint32_t objectIndex = this->spheres.objectIndex[i];
+        Sphere* sphere = static_cast<Sphere*>(this->objects[objectIndex]);
+        this->spheres.Set(i, sphere->center, sphere->radius, objectIndex);
+        bounds[this->bvh.primitiveIndices[i]] = sphere->GetBounds();
+    }
+
+    this->bvh.Refit(bounds, [this](std::vector<std::function<void()>>& tasks)
+    {
+        this->RunTasks(tasks);
+    });
+
+    if (this->bvh.SAHCost() > this->bvhBuildCost * this->refitRebuildThreshold)
+    {
+        this->BuildAccelerationStructure();
+        return true;
+    }
+
+    std::vector<AABB> objectBounds(this->boundedObjects.size());
+    for (uint32_t i = 0; i < this->boundedObjects.size(); i++)
+        objectBounds[i] = this->objects[this->boundedObjects[i]]->GetBounds();
+    this->objectBVH.Refit(objectBounds);
+
+    // the wide trees are cheap to collapse again compared to refitting every child box of theirs
+    if (this->accelerator == Accelerator::BVH4)
+        this->bvh4.Build(this->bvh);
+    else if (this->accelerator == Accelerator::BVH8)
+        this->bvh8.Build(this->bvh);
+    else if (this->accelerator == Accelerator::BVH4Q)
+        this->bvh4q.Build(this->bvh);
+
+    this->sceneMoved = false;
+    return false;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Raytracer::UpdateAccelerationStructure()
+{
+    if (this->sceneDirty)
+        this->BuildAccelerationStructure();
+    else if (this->sceneMoved)
+        this->RefitAccelerationStructure();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+size_t
+Raytracer::NodeCount() const
+{
+    switch (this->accelerator)
+    {
+    case Accelerator::Linear: return 0;
+    case Accelerator::BVH4: return this->bvh4.nodes.size();
+    case Accelerator::BVH8: return this->bvh8.nodes.size();
+    case Accelerator::BVH4Q: return this->bvh4q.nodes.size();
+    case Accelerator::Grid:
+    case Accelerator::Grid2: return this->grid.cells.size();
+    default: return this->bvh.nodes.size();
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+size_t
+Raytracer::NodeBytes() const
+{
+    switch (this->accelerator)
+    {
+    case Accelerator::Linear: return 0;
+    case Accelerator::BVH4: return this->bvh4.nodes.size() * sizeof(WideBVHNode<4>);
+    case Accelerator::BVH8: return this->bvh8.nodes.size() * sizeof(WideBVHNode<8>);
+    case Accelerator::BVH4Q: return this->bvh4q.nodes.size() * sizeof(QuantizedBVHNode);
+    case Accelerator::Grid:
+    case Accelerator::Grid2: return this->grid.cells.size() * sizeof(GridCell) + this->grid.levels.size() * sizeof(GridLevel);
+    default: return this->bvh.nodes.size() * sizeof(BVHNode);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+Raytracer::Raycast(Ray ray, vec3& hitPoint, vec3& hitNormal, Object*& hitObject, float& distance, TraversalStats* stats)
+{
+    float closestT = FLT_MAX;
+    uint32_t hitSphere = 0;
+    auto intersectLeaf = [this, &ray, &closestT, &hitSphere](uint32_t first, uint32_t count, float& tMax)
+    {
+        if (!this->spheres.Intersect(ray, first, count, tMax, hitSphere))
+            return false;
+
+        closestT = tMax;
+        return true;
+    };
+
+    bool sphereHit = false;
+    switch (this->accelerator)
+    {
+    case Accelerator::Linear:
+        if (stats)
+            stats->primitiveTests += this->spheres.Size();
+        sphereHit = intersectLeaf(0, this->spheres.Size(), closestT);
+        break;
+    case Accelerator::BVH4:
+        sphereHit = this->bvh4.Intersect(ray, closestT, intersectLeaf, stats);
+        break;
+    case Accelerator::BVH8:
+        sphereHit = this->bvh8.Intersect(ray, closestT, intersectLeaf, stats);
+        break;
+    case Accelerator::BVH4Q:
+        sphereHit = this->bvh4q.Intersect(ray, closestT, intersectLeaf, stats);
+        break;
+    case Accelerator::Grid:
+    case Accelerator::Grid2:
+        sphereHit = this->grid.Intersect(ray, closestT, intersectLeaf, stats);
+        break;
+    default:
+        sphereHit = this->bvh.Intersect(ray, closestT, intersectLeaf, stats);
+        break;
+    }
+
+    HitResult closestHit;
+    closestHit.t = closestT;
+    this->IntersectObjects(ray, closestHit, stats);
+
+    // only compute point and normal once we know the sphere is the closest hit
+    if (sphereHit && !closestHit.object)
+    {
+        this->spheres.Materialize(ray, hitSphere, closestT, closestHit.p, closestHit.normal);
+        closestHit.object = this->objects[this->spheres.objectIndex[hitSphere]];
+    }
+
+    hitPoint = closestHit.p;
+    hitNormal = closestHit.normal;
+    hitObject = closestHit.object;
+    distance = closestHit.t;
+
+    return closestHit.object != nullptr;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Same order as Raycast, the spheres are usually most of the scene and the
+    most likely to be hit
+*/
+bool
+Raytracer::Occluded(Ray ray, float tMax, TraversalStats* stats)
+{
+    auto occludedLeaf = [this, &ray](uint32_t first, uint32_t count, float& tMax)
+    {
+        return this->spheres.Occluded(ray, first, count, tMax);
+    };
+
+    bool sphereHit = false;
+    switch (this->accelerator)
+    {
+    case Accelerator::Linear:
+        if (stats)
+            stats->primitiveTests += this->spheres.Size();
+        sphereHit = occludedLeaf(0, this->spheres.Size(), tMax);
+        break;
+    case Accelerator::BVH4:
+        sphereHit = this->bvh4.Occluded(ray, tMax, occludedLeaf, stats);
+        break;
+    case Accelerator::BVH8:
+        sphereHit = this->bvh8.Occluded(ray, tMax, occludedLeaf, stats);
+        break;
+    case Accelerator::BVH4Q:
+        sphereHit = this->bvh4q.Occluded(ray, tMax, occludedLeaf, stats);
+        break;
+    case Accelerator::Grid:
+    case Accelerator::Grid2:
+        sphereHit = this->grid.Occluded(ray, tMax, occludedLeaf, stats);
+        break;
+    default:
+        sphereHit = this->bvh.Occluded(ray, tMax, occludedLeaf, stats);
+        break;
+    }
+    if (sphereHit)
+        return true;
+
+    auto objectLeaf = [this, &ray](uint32_t first, uint32_t count, float& tMax)
+    {
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            if (this->objects[this->boundedObjects[this->objectBVH.primitiveIndices[i]]]->Occluded(ray, tMax))
+                return true;
+        }
+        return false;
+    };
+    if (this->objectBVH.Occluded(ray, tMax, objectLeaf, stats))
+        return true;
+
+    if (stats)
+        stats->primitiveTests += this->unboundedObjects.size();
+    for (uint32_t index : this->unboundedObjects)
+    {
+        if (this->objects[index]->Occluded(ray, tMax))
+            return true;
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Raytracer::IntersectObjects(Ray const& ray, HitResult& closestHit, TraversalStats* stats)
+{
+    auto intersectLeaf = [this, &ray, &closestHit](uint32_t first, uint32_t count, float& tMax)
+    {
+        bool isHit = false;
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            HitResult hit = this->objects[this->boundedObjects[this->objectBVH.primitiveIndices[i]]]->Intersect(ray, tMax);
+            if (hit.object)
+            {
+                closestHit = hit;
+                tMax = hit.t;
+                isHit = true;
+            }
+        }
+        return isHit;
+    };
+    this->objectBVH.Intersect(ray, closestHit.t, intersectLeaf, stats);
+
+    if (stats)
+        stats->primitiveTests += this->unboundedObjects.size();
+    for (uint32_t index : this->unboundedObjects)
+    {
+        HitResult hit = this->objects[index]->Intersect(ray, closestHit.t);
+        if (hit.object)
+            closestHit = hit;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Packet version of Raycast. Only the spheres are traced as a packet, the
+    other objects are few and tested lane by lane afterwards like in Raycast.
+*/
+void
+Raytracer::RaycastPacket(Ray const rays[RayPacket::Size], uint32_t laneMask, HitResult hits[RayPacket::Size], TraversalStats* stats)
+{
+    assert(this->SupportsPackets());
+
+    RayPacket packet;
+    packet.Set(rays, laneMask);
+    auto intersectLeaf = [this, &packet](uint32_t first, uint32_t count, uint32_t leafMask)
+    {
+        this->spheres.IntersectPacket(packet, first, count, leafMask);
+    };
+
+    if (this->accelerator == Accelerator::Linear)
+    {
+        if (stats)
+            stats->primitiveTests += this->spheres.Size();
+        intersectLeaf(0, this->spheres.Size(), laneMask);
+    }
+    else
+    {
+        this->bvh.IntersectPacket(packet, intersectLeaf, stats);
+    }
+
+    for (unsigned lane = 0; lane < RayPacket::Size; lane++)
+    {
+        if (!(laneMask & (1u << lane)))
+            continue;
+
+        HitResult closestHit;
+        closestHit.t = packet.tMax[lane];
+        this->IntersectObjects(rays[lane], closestHit, stats);
+
+        uint32_t hitSphere = packet.hitIndex[lane];
+        if (hitSphere != UINT32_MAX && !closestHit.object)
+        {
+            this->spheres.Materialize(rays[lane], hitSphere, packet.tMax[lane], closestHit.p, closestHit.normal);
+            closestHit.object = this->objects[this->spheres.objectIndex[hitSphere]];
+        }
+        hits[lane] = closestHit;
+    }
+}
+
 //------------------------------------------------------------------------------
 /**
 */
@@ -234,6 +977,7 @@ Raytracer::Clear()
         color.g = 0.0f;
         color.b = 0.0f;
     }
+    this->tiledBuffer.clear();
 }
 
 //------------------------------------------------------------------------------
@@ -294,28 +1038,64 @@ Raytracer::ThreadLoop()
 {
 	while (true)
 	{
-		RayMultithreadParameters Params;
+		std::function<void()> Job;
 		{
 			std::unique_lock<std::mutex> lock(QueueMutex);
 			MutexCondition.wait(lock, [this]{
-				return !MultithreadParameters.empty() || ShouldTerminate;
+				return !Jobs.empty() || ShouldTerminate;
 			});
 			if (ShouldTerminate)
 				return;
 
-			Params = MultithreadParameters.front();
-			MultithreadParameters.pop();
+			Job = std::move(Jobs.front());
+			Jobs.pop();
 		}
-		RaytraceChunk(Params);
+		Job();
 	}
 }
 
 void 
-Raytracer::QueueJob(RayMultithreadParameters Params)
+Raytracer::QueueJob(std::function<void()> Job)
 {
 	{
 		std::unique_lock<std::mutex> lock(QueueMutex);
-		MultithreadParameters.push(Params);
+		Jobs.push(std::move(Job));
 	}
 	MutexCondition.notify_one();
 }
+
+void 
+Raytracer::RunTasks(std::vector<std::function<void()>>& Tasks)
+{
+	// shared with the helper jobs, which may only get to run after this call returned
+	struct TaskSet
+	{
+		std::atomic<size_t> next{ 0 };
+		size_t count = 0;
+		Latch done;
+	};
+	auto Set = std::make_shared<TaskSet>();
+	Set->count = Tasks.size();
+	Set->done.Reset(int(Tasks.size()));
+
+	// claims tasks until none are left. A task is only claimed while this call is still waiting for it,
+	// so Tasks is never touched after it returned
+	std::vector<std::function<void()>>* TaskList = &Tasks;
+	auto RunClaimed = [Set, TaskList]()
+	{
+		for (size_t i = Set->next.fetch_add(1); i < Set->count; i = Set->next.fetch_add(1))
+		{
+			(*TaskList)[i]();
+			Set->done.CountDown();
+		}
+	};
+
+	size_t Helpers = std::min(Tasks.size(), Threads.size());
+	for (size_t i = 0; i < Helpers; i++)
+		QueueJob(RunClaimed);
+
+	// the caller works on its own tasks too, so this finishes without any worker threads
+	// and when called from inside a task
+	RunClaimed();
+	Set->done.Wait();
+}
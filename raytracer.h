@@ -5,7 +5,17 @@
 #include "color.h"
 #include "ray.h"
 #include "object.h"
+#include "material.h"
+#include "bvh.h"
+#include "widebvh.h"
+#include "quantizedbvh.h"
+#include "grid.h"
+#include "spherepack.h"
+#include "tilescheduler.h"
+#include "latch.h"
+#include "wavefront.h"
 #include <float.h>
+#include <string>
 
 // For multithreading
 #include <functional>
@@ -14,30 +24,48 @@
 #include <thread>
 #include <vector>
 #include <queue>
+#include <unordered_map>
 #include <condition_variable>
 
-//------------------------------------------------------------------------------
-/**
-*/
+class Sphere;
 
-// Passed to each thread
-struct RayMultithreadParameters
+// Which structure Raycast uses to find the closest object
+enum class Accelerator
 {
-    RayMultithreadParameters(int a, int b)
-    {
-        MinY = a;
-        MaxY = b;
-    }
+    // test every sphere with the SIMD kernel, kept around for comparison
+    Linear,
+    // bounding volume hierarchy built with the surface area heuristic
+    BVH,
+    // the BVH collapsed to 4 children per node, tested with SSE
+    BVH4,
+    // the BVH collapsed to 8 children per node, tested with AVX or as two halves with SSE
+    BVH8,
+    // BVH4 with child bounds quantized to 8 bits, half the memory per node
+    BVH4Q,
+    // uniform grid walked with a 3D DDA, no BVH is built for the spheres
+    Grid,
+    // coarse grid with finer grids in its dense cells
+    Grid2,
+};
 
-    RayMultithreadParameters()
+inline char const*
+AcceleratorName(Accelerator accelerator)
+{
+    switch (accelerator)
     {
-        MinY = 0;
-        MaxY = 0;
+    case Accelerator::Linear: return "Linear";
+    case Accelerator::BVH: return "BVH";
+    case Accelerator::BVH4: return "BVH4";
+    case Accelerator::BVH8: return "BVH8";
+    case Accelerator::BVH4Q: return "BVH4Q";
+    case Accelerator::Grid: return "Grid";
+    case Accelerator::Grid2: return "Grid2";
     }
+    return "Unknown";
+}
 
-    int MinY;
-    int MaxY;
-};
+// parse a name as printed by AcceleratorName, case insensitive. Returns false if unknown
+bool AcceleratorFromName(std::string name, Accelerator& accelerator);
 
 class Raytracer
 {
@@ -48,18 +76,75 @@ public:
     // start raytracing!
     unsigned int Raytrace();
 
-    // same thing as above but it uses multithreading
+    // same thing as above but it uses multithreading.
+    // the frame is cut into tiles which at most NumberOfJobs workers share by work stealing
     unsigned int RaytraceMultithreaded(unsigned int NumberOfJobs);
 
-    // same thing as above but it uses multithreading
-    void RaytraceChunk(RayMultithreadParameters Param);
+    // reset the tile scheduler for a frame traced by NumberOfWorkers workers
+    void PrepareWorkers(unsigned NumberOfWorkers);
+    // trace tiles from the scheduler until there are none left
+    void RaytraceWorker(unsigned worker);
+
+    // trace all pixels in a tile
+    void RaytraceTile(Tile const& tile);
+
+    // trace every sample of a single pixel and accumulate it into the framebuffer
+    void RaytracePixel(unsigned x, unsigned y);
+
+    // trace every sample of the pixels in a block of PacketWidth x PacketHeight starting at x, y,
+    // clipped to x1, y1. The camera rays go through the scene as one packet, the bounces one by one
+    void RaytraceBlock(unsigned x, unsigned y, unsigned x1, unsigned y1);
+
+    // add the averaged color of a pixel's samples to the framebuffer
+    void AccumulatePixel(unsigned x, unsigned y, Color const& color);
 
     // add object to scene
     void AddObject(Object* obj);
 
-    // single raycast, find object
+    // add a material to the table, objects refer to it by the returned index
+    uint32_t AddMaterial(Material const& material);
+    Material const& GetMaterial(uint32_t index) const;
+
+    // (re)build the acceleration structure, done automatically before tracing if objects were added
+    void BuildAccelerationStructure();
+
+    // call after moving objects that are already in the scene, the hierarchies are refit before the next frame
+    void ObjectsMoved();
+
+    // update the node bounds to where the objects are now, done automatically before tracing if ObjectsMoved was called.
+    // falls back to a full build when the refit tree got too slow, returns true if it did
+    bool RefitAccelerationStructure();
+
+    // build or refit, whichever is needed for the objects added or moved since the last frame
+    void UpdateAccelerationStructure();
+
+    // the hierarchy Raycast walks when accelerator is BVH
+    BVH const& GetBVH() const;
+    // true if the last BuildAccelerationStructure loaded the sphere BVH from bvhCacheDirectory
+    bool BVHFromCache() const { return this->bvhFromCache; }
+
+    // number of nodes in the structure the current accelerator walks
+    size_t NodeCount() const;
+    // memory used by those nodes, in bytes
+    size_t NodeBytes() const;
+
+    // single raycast against the scene, find object. stats is filled in if given
+    bool Raycast(Ray ray, vec3& hitPoint, vec3& hitNormal, Object*& hitObject, float& distance, TraversalStats* stats = nullptr);
+
+    // true if anything is hit closer than tMax along the ray. Stops at the first hit it finds and computes
+    // no hit point or normal, for shadow and ambient occlusion rays. stats is filled in if given
+    bool Occluded(Ray ray, float tMax, TraversalStats* stats = nullptr);
+
+    // single raycast, find object by testing every object in the list
     static bool Raycast(Ray ray, vec3& hitPoint, vec3& hitNormal, Object*& hitObject, float& distance, std::vector<Object*> const& objects);
 
+    // raycast every ray in laneMask at once, hits of the other lanes are left untouched.
+    // gives the same hits as Raycast for each ray
+    void RaycastPacket(Ray const rays[RayPacket::Size], uint32_t laneMask, HitResult hits[RayPacket::Size], TraversalStats* stats = nullptr);
+
+    // true if the current accelerator can trace packets, the wide BVHs can't
+    bool SupportsPackets() const;
+
     // set camera matrix
     void SetViewMatrix(mat4 val);
 
@@ -71,18 +156,65 @@ public:
 
     // trace a path and return intersection color
     // n is bounce depth
-    Color TracePath(Ray ray, unsigned n);
-    Color TracePathNoRecursion(Ray ray, unsigned n);
+    Color TracePath(Ray ray, unsigned n, RandomStream& rng);
+    // primaryHit is the result of the first raycast if it has already been done
+    Color TracePathNoRecursion(Ray ray, unsigned n, RandomStream& rng, HitResult const* primaryHit = nullptr);
 
     // get the color of the skybox in a direction
     Color Skybox(vec3 direction);
 
+    // next event estimation at a hit: pick one emissive sphere, sample a direction in the cone it covers
+    // seen from point and cast a shadow ray. Returns the light arriving along it times the BSDF, weighted
+    // against the BSDF scattering into the same light. The throughput of the path so far is left out
+    Color SampleLight(Material const& material, Ray const& ray, vec3 point, vec3 normal, RandomStream& rng);
+
+    // weight of the emission of object, found by a ray scattered from origin with density scatterPdf.
+    // 1 if scatterPdf is 0, for camera rays and specular bounces, or if light sampling can't reach the object
+    float EmitterWeight(vec3 origin, Object const* object, float scatterPdf) const;
+
+    // true if paths sample the lights directly, only worth it when there are any
+    bool SamplesLights() const { return this->nextEventEstimation && !this->lights.empty(); }
+
+    // number of emissive spheres found by the last BuildAccelerationStructure
+    size_t LightCount() const { return this->lights.size(); }
+
     std::vector<Color>& frameBuffer;
     
     // rays per pixel
     unsigned rpp;
     // max number of bounces before termination
     unsigned bounces = 5;
+    // number of frames traced so far, part of the random number key
+    unsigned frameIndex = 0;
+    // width and height of the tiles RaytraceMultithreaded hands out
+    unsigned tileSize = 16;
+    // accumulate in a buffer laid out tile by tile, each tile is copied to frameBuffer once it is done
+    bool tiledFrameBuffer = false;
+    // trace tiles with the staged wavefront tracer instead of one path at a time
+    bool wavefront = false;
+    // width and height of the tiles when wavefront is set
+    unsigned wavefrontTileSize = 64;
+    // with wavefront, intersect secondary rays grouped by direction and origin instead of in pixel order
+    bool sortRays = false;
+    // trace the camera rays of PacketWidth x PacketHeight pixel blocks as packets.
+    // ignored with wavefront, or if the accelerator doesn't support it
+    bool packets = false;
+    static constexpr unsigned PacketWidth = 4;
+    static constexpr unsigned PacketHeight = 2;
+    // sample the emissive spheres at every hit and combine that with the rays that run into them by
+    // multiple importance sampling. Without it lights are only found by paths that happen to hit them
+    bool nextEventEstimation = true;
+
+    // acceleration structure used by Raycast
+    Accelerator accelerator = Accelerator::BVH;
+    // how the BVH is built
+    BVHBuilder bvhBuilder = BVHBuilder::BinnedSAH;
+    // order of the sphere BVH nodes in memory
+    BVHLayout bvhLayout = BVHLayout::BuildOrder;
+    // built sphere and mesh BVHs are kept here and loaded on the next run of the same scene, empty to always build
+    std::string bvhCacheDirectory;
+    // RefitAccelerationStructure rebuilds once the SAH cost of the sphere BVH is this many times its cost after the last build
+    float refitRebuildThreshold = 1.5f;
 
     // width of framebuffer
     const unsigned width;
@@ -102,18 +234,67 @@ public:
     // Multithreading methods
 	void StartThreads();
     void ThreadLoop();
-    void QueueJob(RayMultithreadParameters Params);
+    void QueueJob(std::function<void()> Job);
+    // run all tasks on the worker threads and the calling thread, returns once they are finished.
+    // the caller only runs tasks of this call, so it may be called from inside a task or while frame jobs are queued
+    void RunTasks(std::vector<std::function<void()>>& Tasks);
     void JoinAllThreads();
     void StopThreads();
 
 private:
 
+    // position of pixel x, y in tiledBuffer
+    size_t TiledIndex(unsigned x, unsigned y) const;
+    // allocate tiledBuffer if tiledFrameBuffer is set and it doesn't fit the current size, free it otherwise
+    void PrepareTiledBuffer();
+    // copy a finished tile from tiledBuffer to frameBuffer
+    void ResolveTile(Tile const& tile);
+    // test everything that isn't a sphere, replaces closestHit with anything closer than closestHit.t
+    void IntersectObjects(Ray const& ray, HitResult& closestHit, TraversalStats* stats);
+
     std::vector<Object*> objects;
+    std::vector<Material> materials;
+
+    // tileSize x tileSize pixels per tile stored contiguously, tiles in row major order.
+    // edge tiles are padded to the full size
+    std::vector<Color> tiledBuffer;
+
+    // every Sphere in objects, packed in the order of the BVH leaves
+    SpherePack spheres;
+    // bounded objects that aren't spheres, with a hierarchy of their own tested after the spheres.
+    // boundedObjects maps the primitives of objectBVH to objects
+    std::vector<uint32_t> boundedObjects;
+    BVH objectBVH;
+    // objects without finite bounds like planes, these would make every node of a tree huge so they are tested for every ray
+    std::vector<uint32_t> unboundedObjects;
+    // spheres with an emissive material, the lights SampleLight picks from
+    std::vector<Sphere const*> lights;
+    // index in lights of every light, for finding the shape of a light a path hit
+    std::unordered_map<Object const*, uint32_t> lightIndices;
+
+    // hierarchy over the bounds of the spheres, rebuilt when sceneDirty is set
+    BVH bvh;
+    // wide versions of bvh, only built when selected
+    WideBVH<4> bvh4;
+    WideBVH<8> bvh8;
+    QuantizedBVH bvh4q;
+    // built instead of bvh when one of the grid accelerators is selected
+    Grid grid;
+    bool sceneDirty = false;
+    // objects moved since the last frame, only the bounds need to be updated
+    bool sceneMoved = false;
+    // SAH cost of bvh right after it was last built
+    float bvhBuildCost = 0.0f;
+    bool bvhFromCache = false;
 
     // Multithreading variables
 	std::vector<std::thread> Threads;
-    std::atomic<int> DoneThreads;
-    std::queue<RayMultithreadParameters> MultithreadParameters;
+    TileScheduler Tiles;
+    // wavefront state, one per worker
+    std::vector<PathBatch> PathBatches;
+    // counted down by every worker but the calling thread when it runs out of tiles
+    Latch FrameDone;
+    std::queue<std::function<void()>> Jobs;
 	std::mutex QueueMutex;
 	std::condition_variable MutexCondition;
 	bool ShouldTerminate = false;
@@ -122,6 +303,33 @@ private:
 inline void Raytracer::AddObject(Object* o)
 {
     this->objects.push_back(o);
+    this->sceneDirty = true;
+}
+
+inline void Raytracer::ObjectsMoved()
+{
+    this->sceneMoved = true;
+}
+
+inline uint32_t Raytracer::AddMaterial(Material const& material)
+{
+    this->materials.push_back(material);
+    return uint32_t(this->materials.size() - 1);
+}
+
+inline Material const& Raytracer::GetMaterial(uint32_t index) const
+{
+    return this->materials[index];
+}
+
+inline bool Raytracer::SupportsPackets() const
+{
+    return this->accelerator == Accelerator::BVH || this->accelerator == Accelerator::Linear;
+}
+
+inline BVH const& Raytracer::GetBVH() const
+{
+    return this->bvh;
 }
 
 inline void Raytracer::SetViewMatrix(mat4 val)
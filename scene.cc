@@ -0,0 +1,185 @@
+#include "scene.h"
+#include <string>
+#include "material.h"
+#include "random.h"
+#include "sphere.h"
+#include "plane.h"
+#include "obj.h"
+#include "instance.h"
+#include <math.h>
+#include <chrono>
+
+//------------------------------------------------------------------------------
+/**
+*/
+std::vector<Sphere*>
+CreateRandomSphereScene(Raytracer& rt, int spheresAmount)
+{
+	std::vector<Sphere*> spheres;
+	spheres.reserve(spheresAmount);
+
+	uint32_t groundMaterial = rt.AddMaterial(CreateMaterial("Lambertian", { 0.5,0.5,0.5 }, 0.3f));
+	Plane* ground = new Plane({ 0,1,0 }, 0, groundMaterial);
+	rt.AddObject(ground);
+
+	std::vector<std::string> Types = {"Lambertian", "Dielectric", "Conductor"};
+	std::vector<float> Spans = {10, 30, 25};
+
+	for (int it = 0; it < spheresAmount; it++)
+	{
+		float refractionIndex = it % 3 == 1 ? 1.65f : 1.44f;
+		float r = RandomFloat();
+		float g = RandomFloat();
+		float b = RandomFloat();
+		float roughness = RandomFloat();
+		uint32_t mat = rt.AddMaterial(CreateMaterial(Types[it % 3], { r,g,b }, roughness, refractionIndex));
+		const float span = Spans[it % 3];
+		Sphere* ground = new Sphere(
+			RandomFloat() * 0.7f + 0.2f,
+			{
+				RandomFloatNTP() * span,
+				RandomFloat() * span + 0.2f,
+				RandomFloatNTP() * span
+			},
+			mat);
+		rt.AddObject(ground);
+		spheres.push_back(ground);
+	}
+	return spheres;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+std::vector<Sphere*>
+CreateOverlappingSphereScene(Raytracer& rt, int spheresAmount)
+{
+	std::vector<Sphere*> spheres;
+	spheres.reserve(spheresAmount);
+
+	uint32_t groundMaterial = rt.AddMaterial(CreateMaterial("Lambertian", { 0.5,0.5,0.5 }, 0.3f));
+	Plane* ground = new Plane({ 0,1,0 }, 0, groundMaterial);
+	rt.AddObject(ground);
+
+	std::vector<std::string> Types = {"Lambertian", "Dielectric", "Conductor"};
+	const float span = 4.0f;
+
+	for (int it = 0; it < spheresAmount; it++)
+	{
+		float refractionIndex = it % 3 == 1 ? 1.65f : 1.44f;
+		float r = RandomFloat();
+		float g = RandomFloat();
+		float b = RandomFloat();
+		float roughness = RandomFloat();
+		uint32_t mat = rt.AddMaterial(CreateMaterial(Types[it % 3], { r,g,b }, roughness, refractionIndex));
+		// one in 16 is big enough to cover a good part of the box
+		float radius = it % 16 == 0 ? RandomFloat() * 1.5f + 0.5f : RandomFloat() * 0.08f + 0.02f;
+		Sphere* sphere = new Sphere(
+			radius,
+			{
+				RandomFloatNTP() * span,
+				RandomFloat() * span + 0.2f,
+				RandomFloatNTP() * span
+			},
+			mat);
+		rt.AddObject(sphere);
+		spheres.push_back(sphere);
+	}
+	return spheres;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+AddSphereLights(Raytracer& rt, int count)
+{
+	for (int it = 0; it < count; it++)
+	{
+		// warm to white, and the total power stays the same however many lights there are
+		float warmth = RandomFloat();
+		float strength = 400.0f / count;
+		uint32_t mat = rt.AddMaterial(CreateMaterial("Emissive", { strength, strength * (0.8f + 0.2f * warmth), strength * (0.6f + 0.4f * warmth) }, 0.0f));
+		Sphere* light = new Sphere(
+			RandomFloat() * 0.3f + 0.2f,
+			{
+				RandomFloatNTP() * 8.0f,
+				RandomFloat() * 4.0f + 4.0f,
+				RandomFloatNTP() * 8.0f
+			},
+			mat);
+		rt.AddObject(light);
+	}
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+AnimateSpheres(std::vector<Sphere*> const& spheres, std::vector<vec3> const& startPositions, float seconds)
+{
+	for (size_t i = 0; i < spheres.size(); i++)
+	{
+		// golden angle steps spread the phases evenly however many spheres there are
+		float phase = float(i) * 2.39996f;
+		float speed = 0.5f + float(i % 7) * 0.25f;
+		float angle = phase + seconds * speed;
+
+		// the loop goes through the start position at time 0
+		vec3 const& start = startPositions[i];
+		Sphere* sphere = spheres[i];
+		sphere->center.x = start.x + cosf(angle) - cosf(phase);
+		sphere->center.z = start.z + sinf(angle) - sinf(phase);
+		sphere->center.y = std::max(float(start.y) + 0.5f * (sinf(2.0f * angle) - sinf(2.0f * phase)), sphere->radius);
+	}
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+TriangleMesh*
+LoadMeshFromOBJ(Raytracer& rt, std::string const& path, double* loadSeconds, double* buildSeconds)
+{
+	std::vector<vec3> positions;
+	std::vector<uint32_t> indices;
+	auto loadStart = std::chrono::high_resolution_clock::now();
+	if (!LoadOBJ(path, positions, indices))
+		return nullptr;
+	auto loadEnd = std::chrono::high_resolution_clock::now();
+
+	uint32_t material = rt.AddMaterial(CreateMaterial("Lambertian", { 0.8f,0.8f,0.8f }, 0.5f));
+	TriangleMesh* mesh = new TriangleMesh(std::move(positions), std::move(indices), material, [&rt](std::vector<std::function<void()>>& tasks)
+	{
+		rt.RunTasks(tasks);
+	}, rt.bvhCacheDirectory);
+	auto buildEnd = std::chrono::high_resolution_clock::now();
+
+	if (loadSeconds)
+		*loadSeconds = std::chrono::duration<double>(loadEnd - loadStart).count();
+	if (buildSeconds)
+		*buildSeconds = std::chrono::duration<double>(buildEnd - loadEnd).count();
+	return mesh;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+AddInstanceGrid(Raytracer& rt, Object* prototype, int count)
+{
+	AABB bounds = prototype->GetBounds();
+	float size = std::max(std::max(bounds.max.x - bounds.min.x, bounds.max.y - bounds.min.y), bounds.max.z - bounds.min.z);
+	float scale = size > 0 ? 1.5f / size : 1.0f;
+	const float spacing = 2.0f;
+
+	int columns = int(ceilf(sqrtf(float(count))));
+	for (int it = 0; it < count; it++)
+	{
+		mat4 transform = multiply(rotationy(RandomFloat() * 360.0f), scaling(scale));
+		// centered in x, going away from the camera, standing on the ground
+		transform.m30 = (float(it % columns) - columns * 0.5f) * spacing;
+		transform.m31 = -bounds.min.y * scale;
+		transform.m32 = 4.0f - float(it / columns) * spacing;
+		rt.AddObject(new Instance(prototype, transform, prototype->GetMaterial()));
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "raytracer.h"
+#include "mesh.h"
+#include "sphere.h"
+#include <string>
+
+//------------------------------------------------------------------------------
+/**
+    Adds the ground and spheresAmount random spheres with random materials to the raytracer.
+    Uses the global random number generator, so the scene is the same every run.
+    Returns the spheres in the order they were created.
+*/
+std::vector<Sphere*> CreateRandomSphereScene(Raytracer& rt, int spheresAmount);
+
+//------------------------------------------------------------------------------
+/**
+    Adds the ground and spheresAmount spheres packed into a small box in front
+    of the camera. A few of them are big and overlap hundreds of small ones,
+    the case where boxes around whole primitives make a poor BVH. Uses the
+    global random number generator. Returns the spheres in the order they were created.
+*/
+std::vector<Sphere*> CreateOverlappingSphereScene(Raytracer& rt, int spheresAmount);
+
+//------------------------------------------------------------------------------
+/**
+    Adds count small emissive spheres floating above the middle of the random
+    sphere scene, bright enough to light it about as much as the sky does.
+    Uses the global random number generator.
+*/
+void AddSphereLights(Raytracer& rt, int count);
+
+//------------------------------------------------------------------------------
+/**
+    Moves every sphere along a small loop around its start position, with a
+    phase and speed of its own. Only depends on time, so frames can be skipped
+    or repeated. Tell the raytracer with ObjectsMoved afterwards.
+*/
+void AnimateSpheres(std::vector<Sphere*> const& spheres, std::vector<vec3> const& startPositions, float seconds);
+
+//------------------------------------------------------------------------------
+/**
+    Loads an OBJ file as a triangle mesh with a grey lambertian material from the raytracer's table.
+    The mesh BVH is built on the raytracer's threads, or loaded from the raytracer's BVH cache.
+    The mesh isn't added to the scene, add it or instances of it. Returns nullptr if the file
+    can't be loaded.
+    loadSeconds and buildSeconds are set to the time spent parsing and building if given.
+*/
+TriangleMesh* LoadMeshFromOBJ(Raytracer& rt, std::string const& path, double* loadSeconds = nullptr, double* buildSeconds = nullptr);
+
+//------------------------------------------------------------------------------
+/**
+    Adds count instances of prototype on a grid on the ground, each scaled to
+    about the size of a sphere and turned by a random angle. Uses the global
+    random number generator.
+*/
+void AddInstanceGrid(Raytracer& rt, Object* prototype, int count);
@@ -9,13 +9,13 @@
 #include "material.h"
 
 // returns a random point on the surface of a unit sphere
-inline vec3 random_point_on_unit_sphere()
+// uniform over the sphere, which makes normal + point a cosine distributed direction
+inline vec3 random_point_on_unit_sphere(RandomStream& rng)
 {
-    float x = RandomFloatNTP();
-    float y = RandomFloatNTP();
-    float z = RandomFloatNTP();
-    vec3 v( x, y, z );
-    return normalize(v);
+    float z = rng.FloatNTP();
+    float phi = float(MPI) * rng.FloatNTP();
+    float r = sqrtf(std::max(0.0f, 1.0f - z * z));
+    return vec3(r * cosf(phi), r * sinf(phi), z);
 }
 
 // a spherical object
@@ -24,9 +24,9 @@ class Sphere : public Object
 public:
     float radius;
     vec3 center;
-    Material const* const material;
+    uint32_t material;
 
-    Sphere(float radius, vec3 center, Material const* const material) : 
+    Sphere(float radius, vec3 center, uint32_t material) : 
         radius(radius),
         center(center),
         material(material)
@@ -39,9 +39,50 @@ public:
     
     }
 
-    Color GetColor()
+    uint32_t GetMaterial() override
     {
-        return material->color;
+        return this->material;
+    }
+
+    AABB GetBounds() override
+    {
+        AABB bounds;
+        bounds.min = { center.x - radius, center.y - radius, center.z - radius };
+        bounds.max = { center.x + radius, center.y + radius, center.z + radius };
+        return bounds;
+    }
+
+    // bounds of the part of the sphere inside box, empty if the sphere doesn't reach into it.
+    // A point inside the sphere can't be further along one axis than the radius left over
+    // from the distances to the box on the other two, padded a little for rounding
+    AABB ClipBounds(AABB const& box) const
+    {
+        float c[3] = { float(center.x), float(center.y), float(center.z) };
+        float lo[3] = { float(box.min.x), float(box.min.y), float(box.min.z) };
+        float hi[3] = { float(box.max.x), float(box.max.y), float(box.max.z) };
+        float r = this->radius * 1.0001f;
+
+        float d2[3];
+        for (int i = 0; i < 3; i++)
+        {
+            float d = std::max(std::max(lo[i] - c[i], c[i] - hi[i]), 0.0f);
+            d2[i] = d * d;
+        }
+
+        AABB clipped;
+        float left = r * r - d2[0] - d2[1] - d2[2];
+        if (left < 0.0f)
+            return clipped;
+
+        for (int i = 0; i < 3; i++)
+        {
+            float extent = sqrtf(left + d2[i]);
+            lo[i] = std::max(lo[i], c[i] - extent);
+            hi[i] = std::min(hi[i], c[i] + extent);
+        }
+        clipped.min = { lo[0], lo[1], lo[2] };
+        clipped.max = { hi[0], hi[1], hi[2] };
+        return clipped;
     }
 
     HitResult Intersect(Ray ray, float maxDist) override
@@ -90,9 +131,4 @@ public:
         return HitResult();
     }
 
-    Ray ScatterRay(Ray ray, vec3 point, vec3 normal) override
-    {
-        return BSDF(this->material, ray, point, normal);
-    }
-
 };
\ No newline at end of file
@@ -0,0 +1,464 @@
+#include "spherepack.h"
+#include <float.h>
+#include <math.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// same self intersection epsilon as Sphere::Intersect
+static constexpr float MinDist = 0.001f;
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+SpherePack::Resize(uint32_t count)
+{
+    this->count = count;
+    size_t padded = size_t(count) + Padding;
+
+    // a negative infinite radius makes the discriminant -inf, so padding never hits
+    this->centerX.assign(padded, 0.0f);
+    this->centerY.assign(padded, 0.0f);
+    this->centerZ.assign(padded, 0.0f);
+    this->radius2.assign(padded, -INFINITY);
+    this->invRadius.assign(padded, 0.0f);
+    this->objectIndex.assign(padded, 0);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+SpherePack::Set(uint32_t index, vec3 const& center, float radius, uint32_t objectIndex)
+{
+    this->centerX[index] = center.x;
+    this->centerY[index] = center.y;
+    this->centerZ[index] = center.z;
+    this->radius2[index] = radius * radius;
+    this->invRadius[index] = 1.0f / radius;
+    this->objectIndex[index] = objectIndex;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+SpherePack::Clear()
+{
+    this->Resize(0);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Mirrors Sphere::Intersect: spheres whose center is behind the ray are
+    skipped, the near root is used if it is in range, otherwise the far one.
+*/
+bool
+SpherePack::Intersect(Ray const& ray, uint32_t first, uint32_t count, float& tMax, uint32_t& hitIndex) const
+{
+    float const ox = ray.b.x, oy = ray.b.y, oz = ray.b.z;
+    float const dx = ray.m.x, dy = ray.m.y, dz = ray.m.z;
+    float const a = dx * dx + dy * dy + dz * dz;
+    float const invA = 1.0f / a;
+
+    float const* cx = this->centerX.data();
+    float const* cy = this->centerY.data();
+    float const* cz = this->centerZ.data();
+    float const* r2 = this->radius2.data();
+
+#if defined(__AVX2__)
+    __m256 const vox = _mm256_set1_ps(ox), voy = _mm256_set1_ps(oy), voz = _mm256_set1_ps(oz);
+    __m256 const vdx = _mm256_set1_ps(dx), vdy = _mm256_set1_ps(dy), vdz = _mm256_set1_ps(dz);
+    __m256 const va = _mm256_set1_ps(a), vinvA = _mm256_set1_ps(invA);
+    __m256 const vminDist = _mm256_set1_ps(MinDist);
+    __m256 const zero = _mm256_setzero_ps();
+    __m256i const laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    __m256 bestT = _mm256_set1_ps(tMax);
+    __m256i bestIndex = _mm256_set1_epi32(-1);
+
+    for (uint32_t i = 0; i < count; i += 8)
+    {
+        uint32_t base = first + i;
+        __m256 ocx = _mm256_sub_ps(vox, _mm256_loadu_ps(cx + base));
+        __m256 ocy = _mm256_sub_ps(voy, _mm256_loadu_ps(cy + base));
+        __m256 ocz = _mm256_sub_ps(voz, _mm256_loadu_ps(cz + base));
+
+        __m256 b = _mm256_fmadd_ps(ocz, vdz, _mm256_fmadd_ps(ocy, vdy, _mm256_mul_ps(ocx, vdx)));
+        __m256 c = _mm256_sub_ps(_mm256_fmadd_ps(ocz, ocz, _mm256_fmadd_ps(ocy, ocy, _mm256_mul_ps(ocx, ocx))), _mm256_loadu_ps(r2 + base));
+        __m256 disc = _mm256_fmsub_ps(b, b, _mm256_mul_ps(va, c));
+
+        // lanes past the end of the range belong to other leaves
+        __m256i lanes = _mm256_cmpgt_epi32(_mm256_set1_epi32(int(count - i)), laneIndex);
+        __m256 valid = _mm256_and_ps(_mm256_castsi256_ps(lanes),
+                       _mm256_and_ps(_mm256_cmp_ps(disc, zero, _CMP_GT_OQ), _mm256_cmp_ps(b, zero, _CMP_LE_OQ)));
+        if (_mm256_movemask_ps(valid) == 0)
+            continue;
+
+        __m256 sqrtDisc = _mm256_sqrt_ps(_mm256_max_ps(disc, zero));
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(zero, b), sqrtDisc), vinvA);
+        __m256 t2 = _mm256_mul_ps(_mm256_add_ps(_mm256_sub_ps(zero, b), sqrtDisc), vinvA);
+        __m256 nearInRange = _mm256_and_ps(_mm256_cmp_ps(t1, vminDist, _CMP_GT_OQ), _mm256_cmp_ps(t1, bestT, _CMP_LT_OQ));
+        __m256 t = _mm256_blendv_ps(t2, t1, nearInRange);
+
+        __m256 hit = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, vminDist, _CMP_GT_OQ), _mm256_cmp_ps(t, bestT, _CMP_LT_OQ)));
+        bestT = _mm256_blendv_ps(bestT, t, hit);
+        bestIndex = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(bestIndex),
+                    _mm256_castsi256_ps(_mm256_add_epi32(_mm256_set1_epi32(int(base)), laneIndex)), hit));
+    }
+
+    alignas(32) float lanesT[8];
+    alignas(32) uint32_t lanesIndex[8];
+    _mm256_store_ps(lanesT, bestT);
+    _mm256_store_si256((__m256i*)lanesIndex, bestIndex);
+    constexpr int Width = 8;
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128 const vox = _mm_set1_ps(ox), voy = _mm_set1_ps(oy), voz = _mm_set1_ps(oz);
+    __m128 const vdx = _mm_set1_ps(dx), vdy = _mm_set1_ps(dy), vdz = _mm_set1_ps(dz);
+    __m128 const va = _mm_set1_ps(a), vinvA = _mm_set1_ps(invA);
+    __m128 const vminDist = _mm_set1_ps(MinDist);
+    __m128 const zero = _mm_setzero_ps();
+    __m128i const laneIndex = _mm_setr_epi32(0, 1, 2, 3);
+
+    __m128 bestT = _mm_set1_ps(tMax);
+    __m128i bestIndex = _mm_set1_epi32(-1);
+
+    for (uint32_t i = 0; i < count; i += 4)
+    {
+        uint32_t base = first + i;
+        __m128 ocx = _mm_sub_ps(vox, _mm_loadu_ps(cx + base));
+        __m128 ocy = _mm_sub_ps(voy, _mm_loadu_ps(cy + base));
+        __m128 ocz = _mm_sub_ps(voz, _mm_loadu_ps(cz + base));
+
+        __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, vdx), _mm_mul_ps(ocy, vdy)), _mm_mul_ps(ocz, vdz));
+        __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz)), _mm_loadu_ps(r2 + base));
+        __m128 disc = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(va, c));
+
+        // lanes past the end of the range belong to other leaves
+        __m128i lanes = _mm_cmpgt_epi32(_mm_set1_epi32(int(count - i)), laneIndex);
+        __m128 valid = _mm_and_ps(_mm_castsi128_ps(lanes), _mm_and_ps(_mm_cmpgt_ps(disc, zero), _mm_cmple_ps(b, zero)));
+        if (_mm_movemask_ps(valid) == 0)
+            continue;
+
+        __m128 sqrtDisc = _mm_sqrt_ps(_mm_max_ps(disc, zero));
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(zero, b), sqrtDisc), vinvA);
+        __m128 t2 = _mm_mul_ps(_mm_add_ps(_mm_sub_ps(zero, b), sqrtDisc), vinvA);
+        __m128 nearInRange = _mm_and_ps(_mm_cmpgt_ps(t1, vminDist), _mm_cmplt_ps(t1, bestT));
+        __m128 t = _mm_or_ps(_mm_and_ps(nearInRange, t1), _mm_andnot_ps(nearInRange, t2));
+
+        __m128 hit = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(t, vminDist), _mm_cmplt_ps(t, bestT)));
+        __m128i hiti = _mm_castps_si128(hit);
+        bestT = _mm_or_ps(_mm_and_ps(hit, t), _mm_andnot_ps(hit, bestT));
+        bestIndex = _mm_or_si128(_mm_and_si128(hiti, _mm_add_epi32(_mm_set1_epi32(int(base)), laneIndex)), _mm_andnot_si128(hiti, bestIndex));
+    }
+
+    alignas(16) float lanesT[4];
+    alignas(16) uint32_t lanesIndex[4];
+    _mm_store_ps(lanesT, bestT);
+    _mm_store_si128((__m128i*)lanesIndex, bestIndex);
+    constexpr int Width = 4;
+#else
+    float lanesT[1] = { tMax };
+    uint32_t lanesIndex[1] = { UINT32_MAX };
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        float ocx = ox - cx[i], ocy = oy - cy[i], ocz = oz - cz[i];
+        float b = ocx * dx + ocy * dy + ocz * dz;
+        if (b > 0)
+            continue;
+
+        float c = ocx * ocx + ocy * ocy + ocz * ocz - r2[i];
+        float disc = b * b - a * c;
+        if (disc <= 0)
+            continue;
+
+        float sqrtDisc = sqrtf(disc);
+        float t = (-b - sqrtDisc) * invA;
+        if (!(t > MinDist && t < lanesT[0]))
+            t = (-b + sqrtDisc) * invA;
+        if (t > MinDist && t < lanesT[0])
+        {
+            lanesT[0] = t;
+            lanesIndex[0] = i;
+        }
+    }
+    constexpr int Width = 1;
+#endif
+
+    // closest lane, the lowest index wins a tie so the result matches a sequential loop
+    bool isHit = false;
+    for (int lane = 0; lane < Width; lane++)
+    {
+        if (lanesIndex[lane] == UINT32_MAX)
+            continue;
+        if (lanesT[lane] < tMax || (lanesT[lane] == tMax && isHit && lanesIndex[lane] < hitIndex))
+        {
+            tMax = lanesT[lane];
+            hitIndex = lanesIndex[lane];
+            isHit = true;
+        }
+    }
+    return isHit;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Same math as Intersect with the roles of the SIMD lanes swapped: spheres are
+    broadcast and the lanes hold rays. Spheres are visited in order and only
+    strictly closer hits are taken, so every lane ends up with exactly the hit
+    Intersect finds for that ray.
+*/
+void
+SpherePack::IntersectPacket(RayPacket& packet, uint32_t first, uint32_t count, uint32_t laneMask) const
+{
+    float const* cx = this->centerX.data();
+    float const* cy = this->centerY.data();
+    float const* cz = this->centerZ.data();
+    float const* r2 = this->radius2.data();
+
+#if defined(__AVX2__)
+    __m256 const vox = _mm256_load_ps(packet.ox), voy = _mm256_load_ps(packet.oy), voz = _mm256_load_ps(packet.oz);
+    __m256 const vdx = _mm256_load_ps(packet.dx), vdy = _mm256_load_ps(packet.dy), vdz = _mm256_load_ps(packet.dz);
+    __m256 const va = _mm256_load_ps(packet.a);
+    __m256 const vinvA = _mm256_div_ps(_mm256_set1_ps(1.0f), va);
+    __m256 const vminDist = _mm256_set1_ps(MinDist);
+    __m256 const zero = _mm256_setzero_ps();
+    __m256i const laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256 const lanes = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(int(laneMask)), laneBits), laneBits));
+
+    __m256 bestT = _mm256_load_ps(packet.tMax);
+    __m256i bestIndex = _mm256_load_si256((__m256i const*)packet.hitIndex);
+
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        __m256 ocx = _mm256_sub_ps(vox, _mm256_set1_ps(cx[i]));
+        __m256 ocy = _mm256_sub_ps(voy, _mm256_set1_ps(cy[i]));
+        __m256 ocz = _mm256_sub_ps(voz, _mm256_set1_ps(cz[i]));
+
+        __m256 b = _mm256_fmadd_ps(ocz, vdz, _mm256_fmadd_ps(ocy, vdy, _mm256_mul_ps(ocx, vdx)));
+        __m256 c = _mm256_sub_ps(_mm256_fmadd_ps(ocz, ocz, _mm256_fmadd_ps(ocy, ocy, _mm256_mul_ps(ocx, ocx))), _mm256_set1_ps(r2[i]));
+        __m256 disc = _mm256_fmsub_ps(b, b, _mm256_mul_ps(va, c));
+
+        __m256 valid = _mm256_and_ps(lanes, _mm256_and_ps(_mm256_cmp_ps(disc, zero, _CMP_GT_OQ), _mm256_cmp_ps(b, zero, _CMP_LE_OQ)));
+        if (_mm256_movemask_ps(valid) == 0)
+            continue;
+
+        __m256 sqrtDisc = _mm256_sqrt_ps(_mm256_max_ps(disc, zero));
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(zero, b), sqrtDisc), vinvA);
+        __m256 t2 = _mm256_mul_ps(_mm256_add_ps(_mm256_sub_ps(zero, b), sqrtDisc), vinvA);
+        __m256 nearInRange = _mm256_and_ps(_mm256_cmp_ps(t1, vminDist, _CMP_GT_OQ), _mm256_cmp_ps(t1, bestT, _CMP_LT_OQ));
+        __m256 t = _mm256_blendv_ps(t2, t1, nearInRange);
+
+        __m256 hit = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, vminDist, _CMP_GT_OQ), _mm256_cmp_ps(t, bestT, _CMP_LT_OQ)));
+        bestT = _mm256_blendv_ps(bestT, t, hit);
+        bestIndex = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(bestIndex), _mm256_castsi256_ps(_mm256_set1_epi32(int(i))), hit));
+    }
+
+    _mm256_store_ps(packet.tMax, bestT);
+    _mm256_store_si256((__m256i*)packet.hitIndex, bestIndex);
+#elif defined(__SSE2__) || defined(_M_X64)
+    // the packet as two halves of four lanes, with the same expressions as the SSE2 path of Intersect
+    __m128 const vminDist = _mm_set1_ps(MinDist);
+    __m128 const zero = _mm_setzero_ps();
+    __m128i const laneBits = _mm_setr_epi32(1, 2, 4, 8);
+
+    for (int half = 0; half < RayPacket::Size; half += 4)
+    {
+        uint32_t halfMask = (laneMask >> half) & 0xf;
+        if (halfMask == 0)
+            continue;
+
+        __m128 const vox = _mm_load_ps(packet.ox + half), voy = _mm_load_ps(packet.oy + half), voz = _mm_load_ps(packet.oz + half);
+        __m128 const vdx = _mm_load_ps(packet.dx + half), vdy = _mm_load_ps(packet.dy + half), vdz = _mm_load_ps(packet.dz + half);
+        __m128 const va = _mm_load_ps(packet.a + half);
+        __m128 const vinvA = _mm_div_ps(_mm_set1_ps(1.0f), va);
+        __m128 const lanes = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(int(halfMask)), laneBits), laneBits));
+
+        __m128 bestT = _mm_load_ps(packet.tMax + half);
+        __m128i bestIndex = _mm_load_si128((__m128i const*)(packet.hitIndex + half));
+
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            __m128 ocx = _mm_sub_ps(vox, _mm_set1_ps(cx[i]));
+            __m128 ocy = _mm_sub_ps(voy, _mm_set1_ps(cy[i]));
+            __m128 ocz = _mm_sub_ps(voz, _mm_set1_ps(cz[i]));
+
+            __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, vdx), _mm_mul_ps(ocy, vdy)), _mm_mul_ps(ocz, vdz));
+            __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz)), _mm_set1_ps(r2[i]));
+            __m128 disc = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(va, c));
+
+            __m128 valid = _mm_and_ps(lanes, _mm_and_ps(_mm_cmpgt_ps(disc, zero), _mm_cmple_ps(b, zero)));
+            if (_mm_movemask_ps(valid) == 0)
+                continue;
+
+            __m128 sqrtDisc = _mm_sqrt_ps(_mm_max_ps(disc, zero));
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(zero, b), sqrtDisc), vinvA);
+            __m128 t2 = _mm_mul_ps(_mm_add_ps(_mm_sub_ps(zero, b), sqrtDisc), vinvA);
+            __m128 nearInRange = _mm_and_ps(_mm_cmpgt_ps(t1, vminDist), _mm_cmplt_ps(t1, bestT));
+            __m128 t = _mm_or_ps(_mm_and_ps(nearInRange, t1), _mm_andnot_ps(nearInRange, t2));
+
+            __m128 hit = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(t, vminDist), _mm_cmplt_ps(t, bestT)));
+            __m128i hiti = _mm_castps_si128(hit);
+            bestT = _mm_or_ps(_mm_and_ps(hit, t), _mm_andnot_ps(hit, bestT));
+            bestIndex = _mm_or_si128(_mm_and_si128(hiti, _mm_set1_epi32(int(i))), _mm_andnot_si128(hiti, bestIndex));
+        }
+
+        _mm_store_ps(packet.tMax + half, bestT);
+        _mm_store_si128((__m128i*)(packet.hitIndex + half), bestIndex);
+    }
+#else
+    // without SIMD the lanes are walked one by one, with the same expressions as the scalar path above
+    for (int lane = 0; lane < RayPacket::Size; lane++)
+    {
+        if (!(laneMask & (1u << lane)))
+            continue;
+
+        float const ox = packet.ox[lane], oy = packet.oy[lane], oz = packet.oz[lane];
+        float const dx = packet.dx[lane], dy = packet.dy[lane], dz = packet.dz[lane];
+        float const a = packet.a[lane];
+        float const invA = 1.0f / a;
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            float ocx = ox - cx[i], ocy = oy - cy[i], ocz = oz - cz[i];
+            float b = ocx * dx + ocy * dy + ocz * dz;
+            if (b > 0)
+                continue;
+
+            float c = ocx * ocx + ocy * ocy + ocz * ocz - r2[i];
+            float disc = b * b - a * c;
+            if (disc <= 0)
+                continue;
+
+            float sqrtDisc = sqrtf(disc);
+            float t = (-b - sqrtDisc) * invA;
+            if (!(t > MinDist && t < packet.tMax[lane]))
+                t = (-b + sqrtDisc) * invA;
+            if (t > MinDist && t < packet.tMax[lane])
+            {
+                packet.tMax[lane] = t;
+                packet.hitIndex[lane] = i;
+            }
+        }
+    }
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+    Same test as Intersect, but returns at the first sphere hit in
+    (MinDist, tMax), which one it is doesn't matter
+*/
+bool
+SpherePack::Occluded(Ray const& ray, uint32_t first, uint32_t count, float tMax) const
+{
+    float const ox = ray.b.x, oy = ray.b.y, oz = ray.b.z;
+    float const dx = ray.m.x, dy = ray.m.y, dz = ray.m.z;
+    float const a = dx * dx + dy * dy + dz * dz;
+    float const invA = 1.0f / a;
+
+    float const* cx = this->centerX.data();
+    float const* cy = this->centerY.data();
+    float const* cz = this->centerZ.data();
+    float const* r2 = this->radius2.data();
+
+#if defined(__AVX2__)
+    __m256 const vox = _mm256_set1_ps(ox), voy = _mm256_set1_ps(oy), voz = _mm256_set1_ps(oz);
+    __m256 const vdx = _mm256_set1_ps(dx), vdy = _mm256_set1_ps(dy), vdz = _mm256_set1_ps(dz);
+    __m256 const va = _mm256_set1_ps(a), vinvA = _mm256_set1_ps(invA);
+    __m256 const vminDist = _mm256_set1_ps(MinDist), vtMax = _mm256_set1_ps(tMax);
+    __m256 const zero = _mm256_setzero_ps();
+    __m256i const laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    for (uint32_t i = 0; i < count; i += 8)
+    {
+        uint32_t base = first + i;
+        __m256 ocx = _mm256_sub_ps(vox, _mm256_loadu_ps(cx + base));
+        __m256 ocy = _mm256_sub_ps(voy, _mm256_loadu_ps(cy + base));
+        __m256 ocz = _mm256_sub_ps(voz, _mm256_loadu_ps(cz + base));
+
+        __m256 b = _mm256_fmadd_ps(ocz, vdz, _mm256_fmadd_ps(ocy, vdy, _mm256_mul_ps(ocx, vdx)));
+        __m256 c = _mm256_sub_ps(_mm256_fmadd_ps(ocz, ocz, _mm256_fmadd_ps(ocy, ocy, _mm256_mul_ps(ocx, ocx))), _mm256_loadu_ps(r2 + base));
+        __m256 disc = _mm256_fmsub_ps(b, b, _mm256_mul_ps(va, c));
+
+        __m256i lanes = _mm256_cmpgt_epi32(_mm256_set1_epi32(int(count - i)), laneIndex);
+        __m256 valid = _mm256_and_ps(_mm256_castsi256_ps(lanes),
+                       _mm256_and_ps(_mm256_cmp_ps(disc, zero, _CMP_GT_OQ), _mm256_cmp_ps(b, zero, _CMP_LE_OQ)));
+        if (_mm256_movemask_ps(valid) == 0)
+            continue;
+
+        // either root in range is a hit
+        __m256 sqrtDisc = _mm256_sqrt_ps(_mm256_max_ps(disc, zero));
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(zero, b), sqrtDisc), vinvA);
+        __m256 t2 = _mm256_mul_ps(_mm256_add_ps(_mm256_sub_ps(zero, b), sqrtDisc), vinvA);
+        __m256 hit1 = _mm256_and_ps(_mm256_cmp_ps(t1, vminDist, _CMP_GT_OQ), _mm256_cmp_ps(t1, vtMax, _CMP_LT_OQ));
+        __m256 hit2 = _mm256_and_ps(_mm256_cmp_ps(t2, vminDist, _CMP_GT_OQ), _mm256_cmp_ps(t2, vtMax, _CMP_LT_OQ));
+        if (_mm256_movemask_ps(_mm256_and_ps(valid, _mm256_or_ps(hit1, hit2))) != 0)
+            return true;
+    }
+    return false;
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128 const vox = _mm_set1_ps(ox), voy = _mm_set1_ps(oy), voz = _mm_set1_ps(oz);
+    __m128 const vdx = _mm_set1_ps(dx), vdy = _mm_set1_ps(dy), vdz = _mm_set1_ps(dz);
+    __m128 const va = _mm_set1_ps(a), vinvA = _mm_set1_ps(invA);
+    __m128 const vminDist = _mm_set1_ps(MinDist), vtMax = _mm_set1_ps(tMax);
+    __m128 const zero = _mm_setzero_ps();
+    __m128i const laneIndex = _mm_setr_epi32(0, 1, 2, 3);
+
+    for (uint32_t i = 0; i < count; i += 4)
+    {
+        uint32_t base = first + i;
+        __m128 ocx = _mm_sub_ps(vox, _mm_loadu_ps(cx + base));
+        __m128 ocy = _mm_sub_ps(voy, _mm_loadu_ps(cy + base));
+        __m128 ocz = _mm_sub_ps(voz, _mm_loadu_ps(cz + base));
+
+        __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, vdx), _mm_mul_ps(ocy, vdy)), _mm_mul_ps(ocz, vdz));
+        __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz)), _mm_loadu_ps(r2 + base));
+        __m128 disc = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(va, c));
+
+        __m128i lanes = _mm_cmpgt_epi32(_mm_set1_epi32(int(count - i)), laneIndex);
+        __m128 valid = _mm_and_ps(_mm_castsi128_ps(lanes), _mm_and_ps(_mm_cmpgt_ps(disc, zero), _mm_cmple_ps(b, zero)));
+        if (_mm_movemask_ps(valid) == 0)
+            continue;
+
+        __m128 sqrtDisc = _mm_sqrt_ps(_mm_max_ps(disc, zero));
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(zero, b), sqrtDisc), vinvA);
+        __m128 t2 = _mm_mul_ps(_mm_add_ps(_mm_sub_ps(zero, b), sqrtDisc), vinvA);
+        __m128 hit1 = _mm_and_ps(_mm_cmpgt_ps(t1, vminDist), _mm_cmplt_ps(t1, vtMax));
+        __m128 hit2 = _mm_and_ps(_mm_cmpgt_ps(t2, vminDist), _mm_cmplt_ps(t2, vtMax));
+        if (_mm_movemask_ps(_mm_and_ps(valid, _mm_or_ps(hit1, hit2))) != 0)
+            return true;
+    }
+    return false;
+#else
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        float ocx = ox - cx[i], ocy = oy - cy[i], ocz = oz - cz[i];
+        float b = ocx * dx + ocy * dy + ocz * dz;
+        if (b > 0)
+            continue;
+
+        float c = ocx * ocx + ocy * ocy + ocz * ocz - r2[i];
+        float disc = b * b - a * c;
+        if (disc <= 0)
+            continue;
+
+        float sqrtDisc = sqrtf(disc);
+        float t1 = (-b - sqrtDisc) * invA;
+        float t2 = (-b + sqrtDisc) * invA;
+        if ((t1 > MinDist && t1 < tMax) || (t2 > MinDist && t2 < tMax))
+            return true;
+    }
+    return false;
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+SpherePack::Materialize(Ray const& ray, uint32_t index, float t, vec3& point, vec3& normal) const
+{
+    point = ray.PointAt(t);
+    normal = vec3(point.x - this->centerX[index], point.y - this->centerY[index], point.z - this->centerZ[index]) * this->invRadius[index];
+}
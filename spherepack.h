@@ -0,0 +1,54 @@
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include "vec3.h"
+#include "ray.h"
+#include "raypacket.h"
+
+//------------------------------------------------------------------------------
+/**
+    Spheres stored as structure of arrays so the intersection kernel can test
+    8 of them at once with AVX2 (4 with SSE2, one at a time otherwise).
+    Only the distance and index of the closest hit come out of the kernel,
+    hit point and normal are computed afterwards with Materialize.
+    The arrays are padded past Size() with spheres that can never be hit, so
+    the kernels may always load full SIMD widths.
+*/
+class SpherePack
+{
+public:
+    // resize to hold count spheres, all of them start out unhittable
+    void Resize(uint32_t count);
+    void Set(uint32_t index, vec3 const& center, float radius, uint32_t objectIndex);
+    void Clear();
+
+    uint32_t Size() const { return this->count; }
+
+    // find the closest sphere in [first, first + count) hit closer than tMax.
+    // on a hit tMax is shrunk to the hit distance and hitIndex is set.
+    bool Intersect(Ray const& ray, uint32_t first, uint32_t count, float& tMax, uint32_t& hitIndex) const;
+
+    // same for the lanes of a packet in laneMask, one sphere at a time against all lanes.
+    // shrinks packet.tMax and sets packet.hitIndex of the lanes that hit something closer
+    void IntersectPacket(RayPacket& packet, uint32_t first, uint32_t count, uint32_t laneMask) const;
+
+    // true if any sphere in [first, first + count) is hit closer than tMax, stops at the first one found
+    bool Occluded(Ray const& ray, uint32_t first, uint32_t count, float tMax) const;
+
+    // hit point and normal for a hit returned by Intersect
+    void Materialize(Ray const& ray, uint32_t index, float t, vec3& point, vec3& normal) const;
+
+    std::vector<float> centerX;
+    std::vector<float> centerY;
+    std::vector<float> centerZ;
+    std::vector<float> radius2;
+    std::vector<float> invRadius;
+    // index of the Sphere object in the raytracer, used to look up its material
+    std::vector<uint32_t> objectIndex;
+
+    // widest SIMD width any kernel reads at once
+    static constexpr uint32_t Padding = 8;
+
+private:
+    uint32_t count = 0;
+};
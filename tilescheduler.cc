@@ -0,0 +1,134 @@
+#include "tilescheduler.h"
+#include <algorithm>
+
+//------------------------------------------------------------------------------
+/**
+*/
+static uint64_t
+PackRange(uint32_t begin, uint32_t end)
+{
+    return (uint64_t(end) << 32) | begin;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Must not be called while workers are still asking for tiles.
+*/
+void
+TileScheduler::Reset(unsigned width, unsigned height, unsigned tileSize, unsigned numWorkers)
+{
+    numWorkers = std::max(numWorkers, 1u);
+    if (numWorkers != this->numWorkers)
+    {
+        this->deques.reset(new Deque[numWorkers]);
+        this->numWorkers = numWorkers;
+    }
+
+    this->width = width;
+    this->height = height;
+    this->tileSize = tileSize;
+    this->tilesX = (width + tileSize - 1) / tileSize;
+    this->tilesY = (height + tileSize - 1) / tileSize;
+
+    // contiguous runs of tiles, stealing evens out runs that turn out to be more expensive
+    uint32_t numTiles = this->NumTiles();
+    for (unsigned i = 0; i < numWorkers; i++)
+    {
+        uint32_t begin = uint32_t((uint64_t(numTiles) * i) / numWorkers);
+        uint32_t end = uint32_t((uint64_t(numTiles) * (i + 1)) / numWorkers);
+        this->deques[i].range.store(PackRange(begin, end), std::memory_order_relaxed);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+TileScheduler::Next(unsigned worker, Tile& tile)
+{
+    uint32_t index;
+    if (this->PopFront(worker, index))
+    {
+        tile = this->GetTile(index);
+        return true;
+    }
+
+    // start with the neighbour so thieves don't all pile onto worker 0
+    for (unsigned i = 1; i < this->numWorkers; i++)
+    {
+        unsigned victim = (worker + i) % this->numWorkers;
+        if (this->Steal(worker, victim, index))
+        {
+            tile = this->GetTile(index);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+TileScheduler::PopFront(unsigned worker, uint32_t& index)
+{
+    std::atomic<uint64_t>& range = this->deques[worker].range;
+    uint64_t current = range.load(std::memory_order_relaxed);
+    while (true)
+    {
+        uint32_t begin = uint32_t(current);
+        uint32_t end = uint32_t(current >> 32);
+        if (begin >= end)
+            return false;
+
+        if (range.compare_exchange_weak(current, PackRange(begin + 1, end), std::memory_order_relaxed))
+        {
+            index = begin;
+            return true;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Only called by a thief whose own deque is empty, so storing the stolen
+    range into it can't overwrite tiles. Other thieves only ever compare
+    exchange against what they read, so they can't lose it either.
+*/
+bool
+TileScheduler::Steal(unsigned thief, unsigned victim, uint32_t& index)
+{
+    std::atomic<uint64_t>& range = this->deques[victim].range;
+    uint64_t current = range.load(std::memory_order_relaxed);
+    while (true)
+    {
+        uint32_t begin = uint32_t(current);
+        uint32_t end = uint32_t(current >> 32);
+        if (begin >= end)
+            return false;
+
+        uint32_t stolen = (end - begin + 1) / 2;
+        uint32_t split = end - stolen;
+        if (range.compare_exchange_weak(current, PackRange(begin, split), std::memory_order_relaxed))
+        {
+            index = split;
+            this->deques[thief].range.store(PackRange(split + 1, end), std::memory_order_relaxed);
+            return true;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+Tile
+TileScheduler::GetTile(uint32_t index) const
+{
+    Tile tile;
+    tile.x0 = (index % this->tilesX) * this->tileSize;
+    tile.y0 = (index / this->tilesX) * this->tileSize;
+    tile.x1 = std::min(tile.x0 + this->tileSize, this->width);
+    tile.y1 = std::min(tile.y0 + this->tileSize, this->height);
+    return tile;
+}
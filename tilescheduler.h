@@ -0,0 +1,57 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+/**
+    Rectangle of pixels, x1 and y1 are exclusive
+*/
+struct Tile
+{
+    unsigned x0, y0;
+    unsigned x1, y1;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Hands out the tiles of a frame to a fixed number of workers.
+
+    Every worker owns a deque holding a contiguous range of tile indices, packed
+    into a single atomic so both ends can be updated with one compare exchange.
+    A worker takes tiles from the front of its own deque, and once that runs dry
+    it steals the back half of another worker's deque. No locks are taken.
+*/
+class TileScheduler
+{
+public:
+    // cut a width x height image into tiles and deal them out to numWorkers deques
+    void Reset(unsigned width, unsigned height, unsigned tileSize, unsigned numWorkers);
+
+    // next tile for a worker, returns false once there is nothing left to render or steal
+    bool Next(unsigned worker, Tile& tile);
+
+    unsigned NumWorkers() const { return this->numWorkers; }
+    unsigned NumTiles() const { return this->tilesX * this->tilesY; }
+
+private:
+    // take the tile at the front of a worker's own deque
+    bool PopFront(unsigned worker, uint32_t& index);
+    // move the back half of victim's deque to thief's, returning the first stolen tile
+    bool Steal(unsigned thief, unsigned victim, uint32_t& index);
+    Tile GetTile(uint32_t index) const;
+
+    // [begin, end) of tile indices, begin in the low 32 bits
+    struct alignas(64) Deque
+    {
+        std::atomic<uint64_t> range;
+    };
+
+    std::unique_ptr<Deque[]> deques;
+    unsigned numWorkers = 0;
+    unsigned width = 0;
+    unsigned height = 0;
+    unsigned tileSize = 0;
+    unsigned tilesX = 0;
+    unsigned tilesY = 0;
+};
@@ -0,0 +1,147 @@
+#include "trianglepack.h"
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+
+// same self intersection epsilon as the spheres
+static constexpr float MinDist = 0.001f;
+
+//------------------------------------------------------------------------------
+/**
+*/
+WatertightRay::WatertightRay(Ray const& ray)
+{
+    float const dir[3] = { float(ray.m.x), float(ray.m.y), float(ray.m.z) };
+    this->org[0] = float(ray.b.x);
+    this->org[1] = float(ray.b.y);
+    this->org[2] = float(ray.b.z);
+
+    // the dominant axis becomes z, swapping x and y keeps the winding when it points down
+    this->kz = 0;
+    if (fabsf(dir[1]) > fabsf(dir[this->kz]))
+        this->kz = 1;
+    if (fabsf(dir[2]) > fabsf(dir[this->kz]))
+        this->kz = 2;
+    this->kx = (this->kz + 1) % 3;
+    this->ky = (this->kx + 1) % 3;
+    if (dir[this->kz] < 0)
+        std::swap(this->kx, this->ky);
+
+    this->sx = dir[this->kx] / dir[this->kz];
+    this->sy = dir[this->ky] / dir[this->kz];
+    this->sz = 1.0f / dir[this->kz];
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+TrianglePack::Resize(uint32_t count)
+{
+    this->count = count;
+    for (auto& coordinate : this->v)
+        coordinate.assign(count, 0.0f);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+TrianglePack::Set(uint32_t index, vec3 const& v0, vec3 const& v1, vec3 const& v2)
+{
+    vec3 const* vertices[3] = { &v0, &v1, &v2 };
+    for (int vertex = 0; vertex < 3; vertex++)
+    {
+        this->v[vertex * 3 + 0][index] = vertices[vertex]->x;
+        this->v[vertex * 3 + 1][index] = vertices[vertex]->y;
+        this->v[vertex * 3 + 2][index] = vertices[vertex]->z;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+TrianglePack::Clear()
+{
+    this->Resize(0);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Woop, Benthin and Wald, "Watertight Ray/Triangle Intersection" (JCGT 2013).
+    The vertices are translated to the ray origin and sheared so the ray runs
+    along +z, then the 2D edge functions decide the hit. Edges shared by two
+    triangles give the exact same edge function values with opposite signs, so
+    no ray can pass between them. Apart from the rare exact edge case the loop
+    is straight line math on the arrays, so an 8 wide version can be written
+    like the sphere kernel.
+*/
+bool
+TrianglePack::Intersect(WatertightRay const& ray, uint32_t first, uint32_t count, float& tMax, uint32_t& hitIndex) const
+{
+    float const* ax = this->v[ray.kx].data();
+    float const* ay = this->v[ray.ky].data();
+    float const* az = this->v[ray.kz].data();
+    float const* bx = this->v[3 + ray.kx].data();
+    float const* by = this->v[3 + ray.ky].data();
+    float const* bz = this->v[3 + ray.kz].data();
+    float const* cx = this->v[6 + ray.kx].data();
+    float const* cy = this->v[6 + ray.ky].data();
+    float const* cz = this->v[6 + ray.kz].data();
+    float const ox = ray.org[ray.kx], oy = ray.org[ray.ky], oz = ray.org[ray.kz];
+
+    bool isHit = false;
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        // vertices relative to the origin, sheared into ray space
+        float Az = az[i] - oz, Bz = bz[i] - oz, Cz = cz[i] - oz;
+        float Ax = (ax[i] - ox) - ray.sx * Az, Ay = (ay[i] - oy) - ray.sy * Az;
+        float Bx = (bx[i] - ox) - ray.sx * Bz, By = (by[i] - oy) - ray.sy * Bz;
+        float Cx = (cx[i] - ox) - ray.sx * Cz, Cy = (cy[i] - oy) - ray.sy * Cz;
+
+        // scaled barycentrics
+        float U = Cx * By - Cy * Bx;
+        float V = Ax * Cy - Ay * Cx;
+        float W = Bx * Ay - By * Ax;
+
+        // exactly on an edge, redo it in double so float rounding does not cause false misses.
+        // a value that is still 0 passes the test below, so an edge shared by two triangles can be hit by both
+        if (U == 0.0f || V == 0.0f || W == 0.0f)
+        {
+            U = float(double(Cx) * double(By) - double(Cy) * double(Bx));
+            V = float(double(Ax) * double(Cy) - double(Ay) * double(Cx));
+            W = float(double(Bx) * double(Ay) - double(By) * double(Ax));
+        }
+
+        if ((U < 0.0f || V < 0.0f || W < 0.0f) && (U > 0.0f || V > 0.0f || W > 0.0f))
+            continue;
+
+        float det = U + V + W;
+        if (det == 0.0f)
+            continue;
+
+        // distance scaled by det
+        float T = (U * Az + V * Bz + W * Cz) * ray.sz;
+        float t = T / det;
+        if (t > MinDist && t < tMax)
+        {
+            tMax = t;
+            hitIndex = i;
+            isHit = true;
+        }
+    }
+    return isHit;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+vec3
+TrianglePack::Normal(uint32_t index) const
+{
+    vec3 v0(this->v[0][index], this->v[1][index], this->v[2][index]);
+    vec3 v1(this->v[3][index], this->v[4][index], this->v[5][index]);
+    vec3 v2(this->v[6][index], this->v[7][index], this->v[8][index]);
+    return cross(v1 - v0, v2 - v0);
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include "vec3.h"
+#include "ray.h"
+
+//------------------------------------------------------------------------------
+/**
+    Ray prepared for the watertight triangle test: the axes are permuted so the
+    ray travels along z, and the shear that maps its direction to +z is
+    precomputed. Built once per ray and reused for every triangle.
+*/
+struct WatertightRay
+{
+    WatertightRay(Ray const& ray);
+
+    float org[3];
+    int kx, ky, kz;
+    float sx, sy, sz;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Triangles stored as structure of arrays, one array per vertex coordinate,
+    like SpherePack does for spheres. A triangle mesh keeps them in the order
+    of its BVH leaves so every leaf is a contiguous range, which is also the
+    layout an 8 wide kernel would want to load from.
+*/
+class TrianglePack
+{
+public:
+    // resize to hold count triangles
+    void Resize(uint32_t count);
+    void Set(uint32_t index, vec3 const& v0, vec3 const& v1, vec3 const& v2);
+    void Clear();
+
+    uint32_t Size() const { return this->count; }
+
+    // find the closest triangle in [first, first + count) hit closer than tMax.
+    // on a hit tMax is shrunk to the hit distance and hitIndex is set.
+    // watertight, rays through shared edges and vertices never slip between two triangles
+    bool Intersect(WatertightRay const& ray, uint32_t first, uint32_t count, float& tMax, uint32_t& hitIndex) const;
+
+    // unnormalized geometric normal, following the winding order
+    vec3 Normal(uint32_t index) const;
+
+    // vertex coordinates, v[vertex * 3 + axis][triangle]
+    std::vector<float> v[9];
+
+private:
+    uint32_t count = 0;
+};
@@ -1,120 +1,101 @@
 #pragma once
 #include <cmath>
-#include <initializer_list>
-#include <assert.h>
 
 #define MPI 3.14159265358979323846
 
-
-class vec3;
-
-inline double len(vec3 const& v);
-
-class vec3
+// Scalar type of vec3. Floats by default, build with TRAYRACER_DOUBLE_PRECISION
+// to render with doubles instead and compare the two.
+#ifdef TRAYRACER_DOUBLE_PRECISION
+typedef double Real;
+#else
+typedef float Real;
+#endif
+
+//------------------------------------------------------------------------------
+/**
+    3D vector, use the vec3 alias unless a specific precision is needed
+*/
+template<typename T>
+class vec3t
 {
 public:
-    vec3() : x(0), y(0), z(0)
-    {
-    }
-
-    vec3(double x, double y, double z) : x(x), y(y), z(z)
-    {
-    }
-
-    vec3(std::initializer_list<double> const il)
+    constexpr vec3t() : x(0), y(0), z(0)
     {
-        assert(il.size() == 3);
-
-        int i = 0;
-        for (auto v : il)
-        {
-            double* d = reinterpret_cast<double*>(this);
-            d += i;
-            *d = v;
-            i++;
-        }
     }
 
-    ~vec3()
+    constexpr vec3t(T x, T y, T z) : x(x), y(y), z(z)
     {
     }
 
-    vec3(vec3 const& rhs)
-    {
-        this->x = rhs.x;
-        this->y = rhs.y;
-        this->z = rhs.z;
-    }
+    constexpr vec3t operator+(vec3t const& rhs) const { return {x + rhs.x, y + rhs.y, z + rhs.z};}
+    constexpr vec3t operator-(vec3t const& rhs) const { return {x - rhs.x, y - rhs.y, z - rhs.z};}
+    constexpr vec3t operator-() const { return {-x, -y, -z};}
+    constexpr vec3t operator*(T const c) const { return {x * c, y * c, z * c};}
 
-    vec3 operator+(vec3 const& rhs) { return {x + rhs.x, y + rhs.y, z + rhs.z};}
-    vec3 operator-(vec3 const& rhs) { return {x - rhs.x, y - rhs.y, z - rhs.z};}
-    vec3 operator-() { return {-x, -y, -z};}
-    vec3 operator*(float const c) { return {x * c, y * c, z * c};}
-
-    double x, y, z;
+    T x, y, z;
 
     bool IsNormalized() const
     {
-		if (len(*this) == 1.0)
-		{
-			return true;
-		}
-		
-		return false;
+        return x * x + y * y + z * z == T(1);
     }
 
-    bool IsZero() const
+    constexpr bool IsZero() const
     {
-		if (len(*this) == 0.0)
-		{
-			return true;
-		}
-		
-		return false;
+        return x == 0 && y == 0 && z == 0;
     }
 };
 
+typedef vec3t<Real> vec3;
+
 // Get length of 3D vector
-inline double len(vec3 const& v)
+template<typename T>
+inline T len(vec3t<T> const& v)
 {
-    return sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+    return std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
 }
 
 // Get normalized version of v
-inline vec3 normalize(vec3 v)
+template<typename T>
+inline vec3t<T> normalize(vec3t<T> const& v)
 {
-    double l = len(v);
+    T l = len(v);
     if (l == 0)
-        return vec3(0,0,0);
+        return vec3t<T>(0,0,0);
 
-    return vec3(v.x / l, v.y / l, v.z / l);
+    T invL = T(1) / l;
+    return vec3t<T>(v.x * invL, v.y * invL, v.z * invL);
 }
 
 // piecewise multiplication between two vectors
-inline vec3 mul(vec3 a, vec3 b)
+template<typename T>
+constexpr vec3t<T> mul(vec3t<T> const& a, vec3t<T> const& b)
 {
     return {a.x * b.x, a.y * b.y, a.z * b.z};
 }
 
 // piecewise add between two vectors
-inline vec3 add(vec3 a, vec3 b)
+template<typename T>
+constexpr vec3t<T> add(vec3t<T> const& a, vec3t<T> const& b)
 {
     return {a.x + b.x, a.y + b.y, a.z + b.z};
 }
 
-inline float dot(vec3 a, vec3 b)
+template<typename T>
+constexpr T dot(vec3t<T> const& a, vec3t<T> const& b)
 {
     return a.x * b.x + a.y * b.y + a.z * b.z;
 }
 
-inline vec3 reflect(vec3 v, vec3 n)
+template<typename T>
+constexpr vec3t<T> reflect(vec3t<T> const& v, vec3t<T> const& n)
 {
     return v - n * (2 * dot(v,n));
 }
 
-inline vec3 cross(vec3 a, vec3 b)
+template<typename T>
+constexpr vec3t<T> cross(vec3t<T> const& a, vec3t<T> const& b)
 {
     return { a.y * b.z - a.z * b.y,
              a.z * b.x - a.x * b.z,
              a.x * b.y - a.y * b.x, };
-}
\ No newline at end of file
+}
@@ -0,0 +1,260 @@
+#include "wavefront.h"
+#include "raytracer.h"
+#include "material.h"
+#include "morton.h"
+#include <algorithm>
+
+// shade stage buckets, misses first and then one per MaterialType
+static constexpr uint32_t NumBuckets = 5;
+
+//------------------------------------------------------------------------------
+/**
+    One path per sample of every pixel in the tile, same camera rays as RaytracePixel
+*/
+static void
+GenerateCameraRays(Raytracer& rt, Tile const& tile, PathBatch& batch)
+{
+    unsigned tileWidth = tile.x1 - tile.x0;
+    uint32_t numPaths = tileWidth * (tile.y1 - tile.y0) * rt.rpp;
+
+    batch.origin.resize(numPaths);
+    batch.direction.resize(numPaths);
+    batch.throughput.resize(numPaths);
+    batch.scatterPdf.resize(numPaths);
+    batch.path.resize(numPaths);
+    batch.hitPoint.resize(numPaths);
+    batch.hitNormal.resize(numPaths);
+    batch.hitMaterial.resize(numPaths);
+    batch.hitObject.resize(numPaths);
+    batch.alive.resize(numPaths);
+    batch.order.resize(numPaths);
+    batch.radiance.resize(numPaths);
+    // RandomStream has no default state, so this one is rebuilt instead of resized
+    batch.rng.clear();
+    batch.rng.reserve(numPaths);
+
+    vec3 cameraPosition = get_position(rt.view);
+    uint32_t p = 0;
+    for (unsigned y = tile.y0; y < tile.y1; ++y)
+    {
+        for (unsigned x = tile.x0; x < tile.x1; ++x)
+        {
+            unsigned pixel = y * rt.width + x;
+            for (unsigned i = 0; i < rt.rpp; ++i)
+            {
+                batch.rng.emplace_back(pixel, i, rt.frameIndex);
+                RandomStream& rng = batch.rng[p];
+
+                float u = ((float(x + rng.Float()) * (1.0f / rt.width)) * 2.0f) - 1.0f;
+                float v = ((float(y + rng.Float()) * (1.0f / rt.height)) * 2.0f) - 1.0f;
+
+                batch.origin[p] = cameraPosition;
+                batch.direction[p] = transform(vec3(u, v, -1.0f), rt.frustum);
+                batch.throughput[p] = { 1,1,1 };
+                batch.scatterPdf[p] = 0.0f;
+                batch.radiance[p] = { 0,0,0 };
+                batch.path[p] = p;
+                p++;
+            }
+        }
+    }
+    batch.count = numPaths;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Order the live paths by direction octant first and then by the Morton code
+    of their origin within the bounds of all origins. Rays next to each other
+    in this order start close together and head the same way, so they walk
+    mostly the same nodes and test the same spheres while those are in cache.
+*/
+static void
+SortRays(PathBatch& batch)
+{
+    AABB bounds;
+    for (uint32_t i = 0; i < batch.count; i++)
+        bounds.Grow(batch.origin[i]);
+
+    batch.traceOrder.resize(batch.count);
+    for (uint32_t i = 0; i < batch.count; i++)
+    {
+        vec3 const& d = batch.direction[i];
+        uint32_t octant = (d.x < 0 ? 4 : 0) | (d.y < 0 ? 2 : 0) | (d.z < 0 ? 1 : 0);
+        uint32_t key = (octant << 29) | (MortonCode(batch.origin[i], bounds) >> 1);
+        batch.traceOrder[i] = (uint64_t(key) << 32) | i;
+    }
+    std::sort(batch.traceOrder.begin(), batch.traceOrder.end());
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static void
+Intersect(Raytracer& rt, PathBatch& batch, bool sorted)
+{
+    for (uint32_t o = 0; o < batch.count; o++)
+    {
+        uint32_t i = sorted ? uint32_t(batch.traceOrder[o]) : o;
+        Object* hitObject = nullptr;
+        float distance = FLT_MAX;
+        if (rt.Raycast(Ray(batch.origin[i], batch.direction[i]), batch.hitPoint[i], batch.hitNormal[i], hitObject, distance))
+            batch.hitMaterial[i] = hitObject->GetMaterial();
+        else
+            batch.hitMaterial[i] = PathBatch::Miss;
+        batch.hitObject[i] = hitObject;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Scatter every path in order[begin, end), all of which hit a material of type Type
+*/
+template<MaterialType Type>
+static void
+ShadeBucket(Raytracer& rt, PathBatch& batch, uint32_t begin, uint32_t end, bool lastBounce)
+{
+    // specular bounces can't be combined with light samples
+    bool const sampleLights = rt.SamplesLights() && Type != MaterialType::Dielectric;
+    for (uint32_t o = begin; o < end; o++)
+    {
+        uint32_t i = batch.order[o];
+        Material const& material = rt.GetMaterial(batch.hitMaterial[i]);
+        Ray ray(batch.origin[i], batch.direction[i]);
+        if (sampleLights && !lastBounce)
+            batch.radiance[batch.path[i]] += batch.throughput[i] * rt.SampleLight(material, ray, batch.hitPoint[i], batch.hitNormal[i], batch.rng[i]);
+        batch.throughput[i] = batch.throughput[i] * material.color;
+
+        // the scattered ray would never be traced
+        if (lastBounce)
+        {
+            batch.radiance[batch.path[i]] += batch.throughput[i];
+            batch.alive[i] = false;
+            continue;
+        }
+
+        Ray scattered = Scatter<Type>(material, ray, batch.hitPoint[i], batch.hitNormal[i], batch.rng[i]);
+        if (rt.SamplesLights())
+            batch.scatterPdf[i] = ScatterPdf(material, ray, batch.hitNormal[i], scattered.m);
+        batch.origin[i] = scattered.b;
+        batch.direction[i] = scattered.m;
+        batch.alive[i] = true;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Counting sort of the live paths by material type, then one tight loop per type
+*/
+static void
+Shade(Raytracer& rt, PathBatch& batch, bool lastBounce)
+{
+    auto bucketOf = [&rt, &batch](uint32_t i)
+    {
+        if (batch.hitMaterial[i] == PathBatch::Miss)
+            return 0u;
+        return 1u + uint32_t(rt.GetMaterial(batch.hitMaterial[i]).type);
+    };
+
+    uint32_t bucketStart[NumBuckets + 1] = {};
+    for (uint32_t i = 0; i < batch.count; i++)
+        bucketStart[bucketOf(i) + 1]++;
+    for (uint32_t b = 0; b < NumBuckets; b++)
+        bucketStart[b + 1] += bucketStart[b];
+
+    uint32_t next[NumBuckets];
+    for (uint32_t b = 0; b < NumBuckets; b++)
+        next[b] = bucketStart[b];
+    for (uint32_t i = 0; i < batch.count; i++)
+        batch.order[next[bucketOf(i)]++] = i;
+
+    // misses pick up the sky and end
+    for (uint32_t o = bucketStart[0]; o < bucketStart[1]; o++)
+    {
+        uint32_t i = batch.order[o];
+        batch.radiance[batch.path[i]] += batch.throughput[i] * rt.Skybox(batch.direction[i]);
+        batch.alive[i] = false;
+    }
+
+    // and so do paths that run into a light
+    for (uint32_t o = bucketStart[1 + uint32_t(MaterialType::Emissive)]; o < bucketStart[2 + uint32_t(MaterialType::Emissive)]; o++)
+    {
+        uint32_t i = batch.order[o];
+        float weight = rt.EmitterWeight(batch.origin[i], batch.hitObject[i], batch.scatterPdf[i]);
+        batch.radiance[batch.path[i]] += batch.throughput[i] * rt.GetMaterial(batch.hitMaterial[i]).color * weight;
+        batch.alive[i] = false;
+    }
+
+    ShadeBucket<MaterialType::Lambertian>(rt, batch, bucketStart[1 + uint32_t(MaterialType::Lambertian)], bucketStart[2 + uint32_t(MaterialType::Lambertian)], lastBounce);
+    ShadeBucket<MaterialType::Dielectric>(rt, batch, bucketStart[1 + uint32_t(MaterialType::Dielectric)], bucketStart[2 + uint32_t(MaterialType::Dielectric)], lastBounce);
+    ShadeBucket<MaterialType::Conductor>(rt, batch, bucketStart[1 + uint32_t(MaterialType::Conductor)], bucketStart[2 + uint32_t(MaterialType::Conductor)], lastBounce);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Move the live paths to the front, keeping their order
+*/
+static void
+Compact(PathBatch& batch)
+{
+    uint32_t live = 0;
+    for (uint32_t i = 0; i < batch.count; i++)
+    {
+        if (!batch.alive[i])
+            continue;
+
+        if (live != i)
+        {
+            batch.origin[live] = batch.origin[i];
+            batch.direction[live] = batch.direction[i];
+            batch.throughput[live] = batch.throughput[i];
+            batch.scatterPdf[live] = batch.scatterPdf[i];
+            batch.rng[live] = batch.rng[i];
+            batch.path[live] = batch.path[i];
+        }
+        live++;
+    }
+    batch.count = live;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+TraceTileWavefront(Raytracer& rt, Tile const& tile, PathBatch& batch)
+{
+    GenerateCameraRays(rt, tile, batch);
+
+    for (unsigned bounce = 0; bounce < rt.bounces && batch.count > 0; bounce++)
+    {
+        // camera rays are already coherent in tile order
+        bool sorted = rt.sortRays && bounce > 0;
+        if (sorted)
+            SortRays(batch);
+
+        Intersect(rt, batch, sorted);
+        Shade(rt, batch, bounce + 1 == rt.bounces);
+        Compact(batch);
+    }
+
+    // only happens without any bounces, paths that were never traced keep their throughput
+    for (uint32_t i = 0; i < batch.count; i++)
+        batch.radiance[batch.path[i]] += batch.throughput[i];
+
+    // same summation order as RaytracePixel
+    unsigned tileWidth = tile.x1 - tile.x0;
+    for (unsigned y = tile.y0; y < tile.y1; ++y)
+    {
+        for (unsigned x = tile.x0; x < tile.x1; ++x)
+        {
+            Color const* samples = &batch.radiance[((y - tile.y0) * tileWidth + (x - tile.x0)) * rt.rpp];
+            Color color;
+            for (unsigned i = 0; i < rt.rpp; ++i)
+                color += samples[i];
+
+            color.r /= rt.rpp;
+            color.g /= rt.rpp;
+            color.b /= rt.rpp;
+            rt.AccumulatePixel(x, y, color);
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include "vec3.h"
+#include "color.h"
+#include "random.h"
+#include "tilescheduler.h"
+
+class Raytracer;
+class Object;
+
+//------------------------------------------------------------------------------
+/**
+    Structure of arrays state for every path of a tile, reused from tile to tile.
+    Entries [0, count) are the paths that are still alive, they get compacted
+    after every bounce so each stage only loops over live paths.
+*/
+struct PathBatch
+{
+    // live paths
+    std::vector<vec3> origin;
+    std::vector<vec3> direction;
+    std::vector<Color> throughput;
+    // density BSDF scattered the current ray with, 0 for camera rays and specular bounces
+    std::vector<float> scatterPdf;
+    std::vector<RandomStream> rng;
+    // where the path writes its result in radiance
+    std::vector<uint32_t> path;
+    uint32_t count = 0;
+
+    // written by the intersect stage
+    std::vector<vec3> hitPoint;
+    std::vector<vec3> hitNormal;
+    // material index of the hit, Miss if the path left the scene
+    std::vector<uint32_t> hitMaterial;
+    // only needed to weigh the emission of lights that were hit
+    std::vector<Object*> hitObject;
+    // cleared by the shade stage when a path ends
+    std::vector<uint8_t> alive;
+
+    // live path indices sorted by material type, filled by the shade stage
+    std::vector<uint32_t> order;
+
+    // order the intersect stage visits the live paths in, filled by the sort stage if it runs.
+    // sort key in the upper 32 bits, path index in the lower ones
+    std::vector<uint64_t> traceOrder;
+
+    // color of every path, pixel by pixel with all samples of a pixel next to each other.
+    // Light is added up in here as the paths find it
+    std::vector<Color> radiance;
+
+    static constexpr uint32_t Miss = UINT32_MAX;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Alternative to calling TracePathNoRecursion for every sample. Traces all
+    samples of a tile in stages, one bounce at a time: generate camera rays,
+    intersect them all, shade them grouped by material type, then compact the
+    paths that are still alive. Shading samples the lights like
+    TracePathNoRecursion does. Produces the same image as the path at a time
+    loop, since every path draws the same random numbers in the same order.
+    With rt.sortRays the secondary rays are intersected grouped by direction
+    octant and origin, which only changes the order rays are traced in.
+*/
+void TraceTileWavefront(Raytracer& rt, Tile const& tile, PathBatch& batch);
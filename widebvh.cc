@@ -0,0 +1,127 @@
+#include "widebvh.h"
+#include <math.h>
+
+//------------------------------------------------------------------------------
+/**
+*/
+static float
+NodeHalfArea(BVHNode const& node)
+{
+    float dx = node.bmax[0] - node.bmin[0];
+    float dy = node.bmax[1] - node.bmin[1];
+    float dz = node.bmax[2] - node.bmin[2];
+    return dx * dy + dy * dz + dz * dx;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<int N>
+void
+WideBVH<N>::Build(BVH const& bvh)
+{
+    this->Clear();
+    if (bvh.Empty())
+        return;
+
+    this->primitiveIndices.assign(bvh.primitiveIndices.begin(), bvh.primitiveIndices.end());
+    this->nodes.reserve(bvh.nodes.size() / 2 + 1);
+    this->Collapse(bvh, 0);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<int N>
+void
+WideBVH<N>::Clear()
+{
+    this->nodes.clear();
+    this->primitiveIndices.clear();
+}
+
+//------------------------------------------------------------------------------
+/**
+    Pull up to N descendants of a binary node into one wide node, always
+    opening the interior child with the largest surface area first.
+    Returns the index of the new wide node.
+*/
+template<int N>
+uint32_t
+WideBVH<N>::Collapse(BVH const& bvh, uint32_t binaryIndex)
+{
+    uint32_t children[N];
+    int numChildren = 0;
+
+    BVHNode const& binaryNode = bvh.nodes[binaryIndex];
+    if (binaryNode.IsLeaf())
+    {
+        // only happens when the whole tree is a single leaf
+        children[numChildren++] = binaryIndex;
+    }
+    else
+    {
+        children[numChildren++] = binaryNode.leftFirst;
+        children[numChildren++] = binaryNode.leftFirst + 1;
+    }
+
+    while (numChildren < N)
+    {
+        int largest = -1;
+        float largestArea = -1.0f;
+        for (int i = 0; i < numChildren; i++)
+        {
+            BVHNode const& child = bvh.nodes[children[i]];
+            if (!child.IsLeaf() && NodeHalfArea(child) > largestArea)
+            {
+                largest = i;
+                largestArea = NodeHalfArea(child);
+            }
+        }
+
+        if (largest == -1)
+            break;
+
+        uint32_t opened = bvh.nodes[children[largest]].leftFirst;
+        children[largest] = opened;
+        children[numChildren++] = opened + 1;
+    }
+
+    uint32_t wideIndex = uint32_t(this->nodes.size());
+    this->nodes.emplace_back();
+
+    for (int i = 0; i < N; i++)
+    {
+        WideBVHNode<N>& node = this->nodes[wideIndex];
+        if (i >= numChildren)
+        {
+            node.bminx[i] = node.bminy[i] = node.bminz[i] = INFINITY;
+            node.bmaxx[i] = node.bmaxy[i] = node.bmaxz[i] = INFINITY;
+            node.child[i] = 0;
+            node.count[i] = 0;
+            continue;
+        }
+
+        BVHNode const& child = bvh.nodes[children[i]];
+        node.bminx[i] = child.bmin[0]; node.bminy[i] = child.bmin[1]; node.bminz[i] = child.bmin[2];
+        node.bmaxx[i] = child.bmax[0]; node.bmaxy[i] = child.bmax[1]; node.bmaxz[i] = child.bmax[2];
+
+        if (child.IsLeaf())
+        {
+            node.child[i] = child.leftFirst;
+            node.count[i] = child.count;
+        }
+        else
+        {
+            // recursing may grow the node list, so don't hold on to the reference
+            uint32_t childIndex = this->Collapse(bvh, children[i]);
+            this->nodes[wideIndex].child[i] = childIndex;
+            this->nodes[wideIndex].count[i] = 0;
+        }
+    }
+
+    return wideIndex;
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
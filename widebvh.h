@@ -0,0 +1,259 @@
+#pragma once
+#include "bvh.h"
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+//------------------------------------------------------------------------------
+/**
+    A node with up to N children, child bounds stored as structure of arrays so
+    one SIMD slab test covers all of them.
+    Unused child slots get a box at +infinity, which every slab test rejects.
+*/
+template<int N>
+struct alignas(64) WideBVHNode
+{
+    float bminx[N], bminy[N], bminz[N];
+    float bmaxx[N], bmaxy[N], bmaxz[N];
+    // node index for interior children, first primitive for leaves
+    uint32_t child[N];
+    // number of primitives for leaf children, 0 for interior children
+    uint32_t count[N];
+};
+
+//------------------------------------------------------------------------------
+/**
+    N-way BVH made by collapsing a binary BVH. BVH4 uses SSE slab tests,
+    BVH8 uses AVX when the build enables it and two SSE tests otherwise.
+    Anything else falls back to testing the children one at a time.
+*/
+template<int N>
+class WideBVH
+{
+public:
+    // collapse a built binary tree, leaves are kept as they are
+    void Build(BVH const& bvh);
+
+    // remove all nodes
+    void Clear();
+
+    // same contract as BVH::Intersect
+    template<typename IntersectFunc>
+    bool Intersect(Ray const& ray, float tMax, IntersectFunc&& intersectLeaf, TraversalStats* stats = nullptr) const;
+
+    // same contract as BVH::Occluded
+    template<typename OccludedFunc>
+    bool Occluded(Ray const& ray, float tMax, OccludedFunc&& occludedLeaf, TraversalStats* stats = nullptr) const;
+
+    // root is at index 0
+    std::vector<WideBVHNode<N>> nodes;
+    // primitive indices, leaves point into this list
+    std::vector<uint32_t> primitiveIndices;
+
+private:
+    uint32_t Collapse(BVH const& bvh, uint32_t binaryIndex);
+    // see BVH::Traverse
+    template<bool AnyHit, typename IntersectFunc>
+    bool Traverse(Ray const& ray, float tMax, IntersectFunc&& intersectLeaf, TraversalStats* stats) const;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Slab test against all children of a node. Fills dist with the entry distances
+    and returns a bitmask of the children that were hit closer than tMax.
+*/
+template<int N>
+inline uint32_t
+IntersectChildren(WideBVHNode<N> const& node, RayInv const& ray, float tMax, float dist[N])
+{
+    uint32_t mask = 0;
+    for (int i = 0; i < N; i++)
+    {
+        float const bmin[3] = { node.bminx[i], node.bminy[i], node.bminz[i] };
+        float const bmax[3] = { node.bmaxx[i], node.bmaxy[i], node.bmaxz[i] };
+        dist[i] = IntersectAABB(ray, bmin, bmax, tMax);
+        if (dist[i] != FLT_MAX)
+            mask |= 1 << i;
+    }
+    return mask;
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+//------------------------------------------------------------------------------
+/**
+    SSE slab test of the four children starting at first, bit i of the mask is child first + i
+*/
+template<int N>
+inline uint32_t
+IntersectChildrenSSE(WideBVHNode<N> const& node, int first, RayInv const& ray, float tMax, float dist[4])
+{
+    __m128 ox = _mm_set1_ps(ray.ox), oy = _mm_set1_ps(ray.oy), oz = _mm_set1_ps(ray.oz);
+    __m128 ix = _mm_set1_ps(ray.ix), iy = _mm_set1_ps(ray.iy), iz = _mm_set1_ps(ray.iz);
+
+    __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bminx + first), ox), ix);
+    __m128 tx2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bmaxx + first), ox), ix);
+    __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bminy + first), oy), iy);
+    __m128 ty2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bmaxy + first), oy), iy);
+    __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bminz + first), oz), iz);
+    __m128 tz2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bmaxz + first), oz), iz);
+
+    __m128 tmin = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2)), _mm_min_ps(tz1, tz2));
+    __m128 tmax = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2)), _mm_max_ps(tz1, tz2));
+
+    __m128 hit = _mm_and_ps(_mm_cmpge_ps(tmax, tmin),
+                 _mm_and_ps(_mm_cmplt_ps(tmin, _mm_set1_ps(tMax)), _mm_cmpgt_ps(tmax, _mm_setzero_ps())));
+    _mm_storeu_ps(dist, tmin);
+    return uint32_t(_mm_movemask_ps(hit));
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<>
+inline uint32_t
+IntersectChildren<4>(WideBVHNode<4> const& node, RayInv const& ray, float tMax, float dist[4])
+{
+    return IntersectChildrenSSE(node, 0, ray, tMax, dist);
+}
+#endif
+
+#if defined(__AVX__)
+//------------------------------------------------------------------------------
+/**
+*/
+template<>
+inline uint32_t
+IntersectChildren<8>(WideBVHNode<8> const& node, RayInv const& ray, float tMax, float dist[8])
+{
+    __m256 ox = _mm256_set1_ps(ray.ox), oy = _mm256_set1_ps(ray.oy), oz = _mm256_set1_ps(ray.oz);
+    __m256 ix = _mm256_set1_ps(ray.ix), iy = _mm256_set1_ps(ray.iy), iz = _mm256_set1_ps(ray.iz);
+
+    __m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bminx), ox), ix);
+    __m256 tx2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bmaxx), ox), ix);
+    __m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bminy), oy), iy);
+    __m256 ty2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bmaxy), oy), iy);
+    __m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bminz), oz), iz);
+    __m256 tz2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bmaxz), oz), iz);
+
+    __m256 tmin = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx1, tx2), _mm256_min_ps(ty1, ty2)), _mm256_min_ps(tz1, tz2));
+    __m256 tmax = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx1, tx2), _mm256_max_ps(ty1, ty2)), _mm256_max_ps(tz1, tz2));
+
+    __m256 hit = _mm256_and_ps(_mm256_cmp_ps(tmax, tmin, _CMP_GE_OQ),
+                 _mm256_and_ps(_mm256_cmp_ps(tmin, _mm256_set1_ps(tMax), _CMP_LT_OQ), _mm256_cmp_ps(tmax, _mm256_setzero_ps(), _CMP_GT_OQ)));
+    _mm256_storeu_ps(dist, tmin);
+    return uint32_t(_mm256_movemask_ps(hit));
+}
+#elif defined(__SSE2__) || defined(_M_X64)
+//------------------------------------------------------------------------------
+/**
+    Without AVX the eight children are tested as two halves of four
+*/
+template<>
+inline uint32_t
+IntersectChildren<8>(WideBVHNode<8> const& node, RayInv const& ray, float tMax, float dist[8])
+{
+    uint32_t mask = IntersectChildrenSSE(node, 0, ray, tMax, dist);
+    return mask | (IntersectChildrenSSE(node, 4, ray, tMax, dist + 4) << 4);
+}
+#endif
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<int N>
+template<typename IntersectFunc>
+inline bool
+WideBVH<N>::Intersect(Ray const& ray, float tMax, IntersectFunc&& intersectLeaf, TraversalStats* stats) const
+{
+    return this->template Traverse<false>(ray, tMax, intersectLeaf, stats);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<int N>
+template<typename OccludedFunc>
+inline bool
+WideBVH<N>::Occluded(Ray const& ray, float tMax, OccludedFunc&& occludedLeaf, TraversalStats* stats) const
+{
+    return this->template Traverse<true>(ray, tMax, occludedLeaf, stats);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<int N>
+template<bool AnyHit, typename IntersectFunc>
+inline bool
+WideBVH<N>::Traverse(Ray const& ray, float tMax, IntersectFunc&& intersectLeaf, TraversalStats* stats) const
+{
+    if (this->nodes.empty())
+        return false;
+
+    struct StackEntry
+    {
+        uint32_t index;
+        // primitives for leaves, 0 for interior nodes
+        uint32_t count;
+        float dist;
+    };
+
+    RayInv rayInv(ray);
+    bool isHit = false;
+    // every level can push at most N - 1 entries on top of the one it pops
+    StackEntry stack[64 * (N - 1) + 1];
+    uint32_t stackPtr = 0;
+    stack[stackPtr++] = { 0, 0, 0.0f };
+
+    while (stackPtr > 0)
+    {
+        StackEntry entry = stack[--stackPtr];
+        // a closer hit may have been found since this was pushed
+        if (entry.dist >= tMax)
+            continue;
+
+        if (stats)
+            stats->nodeVisits++;
+
+        if (entry.count > 0)
+        {
+            if (stats)
+                stats->primitiveTests += entry.count;
+
+            if (intersectLeaf(entry.index, entry.count, tMax))
+            {
+                if (AnyHit)
+                    return true;
+                isHit = true;
+            }
+            continue;
+        }
+
+        WideBVHNode<N> const& node = this->nodes[entry.index];
+        alignas(32) float dist[N];
+        uint32_t mask = IntersectChildren<N>(node, rayInv, tMax, dist);
+        if (mask == 0)
+            continue;
+
+        // push the hit children far to near so the nearest one is popped first
+        uint32_t first = stackPtr;
+        while (mask)
+        {
+            int i = 0;
+            while (!(mask & (1u << i)))
+                i++;
+            mask &= mask - 1;
+
+            StackEntry child = { node.child[i], node.count[i], dist[i] };
+            uint32_t j = stackPtr++;
+            while (j > first && stack[j - 1].dist < child.dist)
+            {
+                stack[j] = stack[j - 1];
+                j--;
+            }
+            stack[j] = child;
+        }
+    }
+
+    return isHit;
+}